@@ -21,6 +21,9 @@ public:
     float seconds = 0; // length of animation or zero means run forever.
     float f1 = 0;
     float f2 = 0;
+    float f3 = 0;
+    float f4 = 0;
+    bool dither = false; // for Brightness command.
     int iterations = 0; // number of iterations on something like neural drop
     int size = 0; // size of rainbow
     int strip = 0; // specify a strip
@@ -28,11 +31,14 @@ public:
     int index = 0; // specify one led in the strip
     std::vector<int> columns; // for column fade
     std::vector<Pixel> pixels; // for SetPixels command.
+    std::vector<uint8_t> program; // for Effect command, the bytecode the Teensy runs (see EffectVM.h).
+    std::vector<int> params; // for Effect command.
+    nlohmann::json cues; // for Timeline command, each one is a command with the seconds it starts "at".
 
     bool operator==(const Command& other)
     {
         if (command == other.command && seconds == other.seconds && iterations == other.iterations && size == other.size && strip == other.strip && index == other.index
-            && f1 == other.f1 && f2 == other.f2)
+            && f1 == other.f1 && f2 == other.f2 && f3 == other.f3 && f4 == other.f4 && dither == other.dither && program == other.program && params == other.params && cues == other.cues)
         {
             if (colors.size() == other.colors.size())
             {
@@ -164,7 +170,7 @@ public:
             }
             else if (command == "MovingGradient")
             {
-                seconds = GetFloat(doc, "speed", 0);
+                seconds = GetFloat(doc, "speed", 0); // LEDs per second
                 f1 = GetFloat(doc, "direction", 0);
                 size = GetInt(doc, "size", 0);
                 auto data = doc["colors"];
@@ -203,6 +209,68 @@ public:
                 f1 = GetFloat(doc, "f1", 55.0f);
                 f2 = GetFloat(doc, "f2", 120.0f);
             }
+            else if (command == "FrameRate")
+            {
+                f1 = GetFloat(doc, "fps", 0);
+            }
+            else if (command == "Brightness")
+            {
+                // "gamma" is all three channels, "gammaRed", "gammaGreen" and "gammaBlue" set one.
+                f1 = GetFloat(doc, "brightness", 1.0f);
+                float gamma = GetFloat(doc, "gamma", 1.0f);
+                f2 = GetFloat(doc, "gammaRed", gamma);
+                f3 = GetFloat(doc, "gammaGreen", gamma);
+                f4 = GetFloat(doc, "gammaBlue", gamma);
+                dither = GetInt(doc, "dither", 0) != 0;
+            }
+            else if (command == "Effect")
+            {
+                // a program for the effect VM on the Teensy, run per LED row or per pixel.
+                seconds = GetFloat(doc, "seconds", 0);
+                size = GetInt(doc, "pixels", 0);
+                program.clear();
+                params.clear();
+                auto code = doc["program"];
+                if (code.is_array())
+                {
+                    for (auto it = code.begin(); it != code.end(); ++it)
+                    {
+                        program.push_back((uint8_t)it->get<int>());
+                    }
+                }
+                auto data = doc["params"];
+                if (data.is_array())
+                {
+                    for (auto it = data.begin(); it != data.end(); ++it)
+                    {
+                        params.push_back(it->get<int>());
+                    }
+                }
+            }
+            else if (command == "Timeline")
+            {
+                // the Teensy plays the cues by itself, looping every period seconds when loop is set.
+                size = GetInt(doc, "loop", 0);
+                f1 = GetFloat(doc, "period", 0);
+                cues = doc["cues"];
+                if (!cues.is_array())
+                {
+                    std::cout << "### Timeline has no cues\n";
+                    return false;
+                }
+            }
+            else if (command == "Palette")
+            {
+                // new colors for the last IndexedBuffer from entry "first", and the range of
+                // entries that cycles at "speed" entries per second.
+                seconds = GetFloat(doc, "seconds", 0);
+                strip = GetInt(doc, "first", 0);
+                f1 = GetFloat(doc, "speed", 0);
+                index = GetInt(doc, "cycleFirst", 0);
+                size = GetInt(doc, "cycleCount", 0);
+                auto data = doc["colors"];
+                ParseColors(data);
+            }
             else if (command == "FirmwareHash")
             {
                 hash = GetString(doc, "hash");
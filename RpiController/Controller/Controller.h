@@ -7,6 +7,8 @@
 #include <memory>
 #include <mutex>
 #include <fstream>
+#include <algorithm>
+#include <utility>
 #include "SerialPort.h"
 #include "TcpClientPort.h"
 #include "TeensyPixelBuffer.h"
@@ -82,6 +84,16 @@ public:
         commandRunning = true;
         commandTimer.start();
 
+        SendCommand();
+
+        commandRunning = false;
+        commandCompleted = true;
+        commandStarted = false;
+    }
+
+    // Send the current command to the Teensy.
+    void SendCommand()
+    {
         if (currentCommand.command == "RunSensei")
         {
             // Sensei is not a command, it is a command loop.
@@ -152,6 +164,30 @@ public:
         else if (currentCommand.command == "Fire")
         {
             buffer.Fire(currentCommand.f1, currentCommand.f2, currentCommand.seconds);
+        }
+        else if (currentCommand.command == "FrameRate")
+        {
+            buffer.FrameRate(currentCommand.f1);
+        }
+        else if (currentCommand.command == "Brightness")
+        {
+            buffer.Brightness(currentCommand.f1, currentCommand.f2, currentCommand.f3, currentCommand.f4, currentCommand.dither);
+        }
+        else if (currentCommand.command == "Effect")
+        {
+            buffer.Effect(currentCommand.program, currentCommand.params, currentCommand.size != 0, currentCommand.seconds);
+        }
+        else if (currentCommand.command == "Timeline")
+        {
+            RunTimeline();
+        }
+        else if (currentCommand.command == "StopTimeline")
+        {
+            buffer.StopTimeline();
+        }
+        else if (currentCommand.command == "Palette")
+        {
+            buffer.SetPalette(currentCommand.colors, currentCommand.strip, currentCommand.seconds, currentCommand.index, currentCommand.size, currentCommand.f1);
         }
 		else if (currentCommand.command == "Twinkle")
         {
@@ -160,9 +196,6 @@ public:
                 buffer.Twinkle(currentCommand.colors[0], currentCommand.colors[1], currentCommand.seconds, currentCommand.size);
             }
         }
-        commandRunning = false;
-        commandCompleted = true;
-        commandStarted = false;
     }
 
     void StartCommand()
@@ -317,6 +350,57 @@ public:
         StartCommand();
     }
 
+    void StartFrameRate(float fps)
+    {
+        WaitForComplete(); // wait for previous command to be sent to Teensy.
+        currentCommand.command = "FrameRate";
+        currentCommand.f1 = fps;
+        StartCommand();
+    }
+
+    void StartBrightness(float brightness, float gammaRed, float gammaGreen, float gammaBlue, bool dither)
+    {
+        WaitForComplete(); // wait for previous command to be sent to Teensy.
+        currentCommand.command = "Brightness";
+        currentCommand.f1 = brightness;
+        currentCommand.f2 = gammaRed;
+        currentCommand.f3 = gammaGreen;
+        currentCommand.f4 = gammaBlue;
+        currentCommand.dither = dither;
+        StartCommand();
+    }
+
+    void StartEffect(const std::vector<uint8_t>& program, const std::vector<int>& params, bool perPixel, float seconds)
+    {
+        WaitForComplete(); // wait for previous command to be sent to Teensy.
+        currentCommand.command = "Effect";
+        currentCommand.program = program;
+        currentCommand.params = params;
+        currentCommand.size = perPixel ? 1 : 0;
+        currentCommand.seconds = seconds;
+        StartCommand();
+    }
+
+    void StartPalette(std::vector<Color>& colors, float seconds, int cycleFirst, int cycleCount, float speed)
+    {
+        WaitForComplete(); // wait for previous command to be sent to Teensy.
+        currentCommand.command = "Palette";
+        currentCommand.colors = colors;
+        currentCommand.strip = 0;
+        currentCommand.seconds = seconds;
+        currentCommand.index = cycleFirst;
+        currentCommand.size = cycleCount;
+        currentCommand.f1 = speed;
+        StartCommand();
+    }
+
+    void StopTimeline()
+    {
+        WaitForComplete(); // wait for previous command to be sent to Teensy.
+        currentCommand.command = "StopTimeline";
+        StartCommand();
+    }
+
 	void StartRain(int length, float f1)
 	{
         WaitForComplete(); // wait for previous command to be sent to Teensy.
@@ -374,6 +458,44 @@ public:
 
 private:
 
+    // The cues are recorded as they would be sent and go to the Teensy in one Timeline command,
+    // which plays them on its own.  Only the commands that are one record can be cues.
+    void RunTimeline()
+    {
+        Command timeline = currentCommand;
+
+        // the Teensy plays the cues in time order and rejects a timeline that isn't, the JSON
+        // can list them in any order.  Cues at the same time keep their order.
+        std::vector<std::pair<float, nlohmann::json*>> ordered;
+        for (auto& json : timeline.cues)
+        {
+            ordered.push_back(std::make_pair(timeline.GetFloat(json, "at", 0), &json));
+        }
+        std::stable_sort(ordered.begin(), ordered.end(), [](const std::pair<float, nlohmann::json*>& a, const std::pair<float, nlohmann::json*>& b) {
+            return a.first < b.first;
+        });
+
+        buffer.BeginTimeline();
+        for (auto& item : ordered)
+        {
+            Command cue;
+            if (!cue.ParseCommand(*item.second))
+            {
+                continue;
+            }
+            if (cue.command == "Timeline" || cue.command == "RunSensei" || cue.command == "SpeedTest" || cue.command == "SerialTest")
+            {
+                std::cout << "### " << cue.command << " can't be a timeline cue\n";
+                continue;
+            }
+            buffer.Cue(item.first);
+            currentCommand = cue;
+            SendCommand();
+        }
+        currentCommand = timeline;
+        buffer.EndTimeline(timeline.size != 0, timeline.f1);
+    }
+
     void RunBreathe()
     {
         buffer.Breathe(currentCommand.seconds, currentCommand.f1, currentCommand.f2);
@@ -6,6 +6,7 @@
 #include <math.h>
 #include "Utils.h"
 #include "StreamWriter.h"
+#include "Quantizer.h"
 
 // This class abstracts the 16 LED strips as one big pixel buffer that we can setup.
 // It provides a "write" method which then sends the buffer to the Teensy.
@@ -18,6 +19,10 @@ class TeensyPixelBuffer
     int numStrips;
     int ledsPerStrip;
     CancelToken& _token;
+    StreamWriter cues; // the commands recorded for a Timeline
+    bool recording = false;
+    uint32_t cueMicroseconds = 0;
+    ColorQuantizer quantizer;
 public:
     TeensyPixelBuffer(Port& port, int numStrips, int ledsPerStrip, CancelToken& token) : _port(port), _token(token)
     {
@@ -237,7 +242,15 @@ public:
 
         uint32_t payloadSize = writer.Size() - offset;
 
-        if (payloadSize > bufferSize)
+        int numPixels = numStrips * ledsPerStrip;
+        if (payloadSize > (uint32_t)numPixels + 16 && quantizer.Quantize(pixelBuffer, numPixels) &&
+            IndexedSize() < payloadSize)
+        {
+            // too many runs, but few enough colors for a byte per pixel to lose nothing.
+            SendIndexedBuffer(seconds);
+            return;
+        }
+        else if (payloadSize > bufferSize)
         {
             // degenerate case, we'd be better off just sending every pixel.
             SendFullBuffer(seconds);
@@ -312,6 +325,41 @@ public:
     }
 
 
+    // Send the buffer as a byte per pixel and a palette of up to 256 colors, a quarter of the
+    // size of the FullBuffer.  Frames with more colors than that are quantized (see
+    // ColorQuantizer), so they come out close but not exact.
+    void SendIndexedBuffer(float seconds)
+    {
+        quantizer.Quantize(pixelBuffer, numStrips * ledsPerStrip);
+        WriteIndexedBuffer(seconds);
+    }
+
+    // Change the palette the last IndexedBuffer is drawn with, without sending its pixels.  The
+    // colors replace the entries from first on, fading to them over seconds, and the cycleCount
+    // entries from cycleFirst rotate by speed entries per second (0 stops them).
+    void SetPalette(const std::vector<Color>& colors, int first = 0, float seconds = 0, int cycleFirst = 0, int cycleCount = 0, float speed = 0)
+    {
+        StreamWriter writer;
+        writer.WriteString(header);
+        writer.WriteString("Palette");
+        writer.WriteByte(0); // null terminate the command string
+        auto lenOffset = writer.Size();
+        writer.WriteInt(0); // placeholder for length
+        auto offset = writer.Size();
+        writer.WriteFloat(seconds);
+        writer.WriteFloat(speed);
+        writer.WriteInt((uint32_t)cycleFirst);
+        writer.WriteInt((uint32_t)cycleCount);
+        writer.WriteInt((uint32_t)first);
+        for (auto c : colors)
+        {
+            writer.WriteInt(c.pack());
+        }
+        writer.WriteLength(lenOffset, writer.Size() - offset);
+        writer.WriteCRC(offset);
+        Send(writer);
+    }
+
     // Set entire buffer to new color, using smooth crossfade over given number of seconds.
     void CrossFadeTo(Color color, float seconds)
     {
@@ -364,6 +412,70 @@ public:
         Send(writer);
     }
 
+    // Frames per second the Teensy runs its animations at, 0 runs them as fast as possible.
+    void FrameRate(float fps)
+    {
+        StreamWriter writer;
+        writer.WriteString(header);
+        writer.WriteString("FrameRate");
+        writer.WriteByte(0); // null terminate the command string
+        auto lenOffset = writer.Size();
+        writer.WriteInt(0); // placeholder for length
+        auto offset = writer.Size();
+        writer.WriteFloat(fps);
+        writer.WriteLength(lenOffset, writer.Size() - offset);
+        writer.WriteCRC(offset);
+        Send(writer);
+    }
+
+    // Global brightness [0-1], gamma of red, green and blue and temporal dithering the Teensy
+    // applies to everything it shows, the current animation keeps running.
+    void Brightness(float brightness = 1, float gammaRed = 1, float gammaGreen = 1, float gammaBlue = 1, bool dither = false)
+    {
+        StreamWriter writer;
+        writer.WriteString(header);
+        writer.WriteString("Brightness");
+        writer.WriteByte(0); // null terminate the command string
+        auto lenOffset = writer.Size();
+        writer.WriteInt(0); // placeholder for length
+        auto offset = writer.Size();
+        writer.WriteFloat(brightness);
+        writer.WriteFloat(gammaRed);
+        writer.WriteFloat(gammaGreen);
+        writer.WriteFloat(gammaBlue);
+        writer.WriteInt(dither ? 1 : 0);
+        writer.WriteLength(lenOffset, writer.Size() - offset);
+        writer.WriteCRC(offset);
+        Send(writer);
+    }
+
+    // Run a program on the effect VM of the Teensy (see TeensyFirmware/include/EffectVM.h), once
+    // per LED row or once per pixel, for the given seconds (0 runs it until the next command).
+    void Effect(const std::vector<uint8_t>& program, const std::vector<int>& params, bool perPixel = false, float seconds = 0)
+    {
+        StreamWriter writer;
+        writer.WriteString(header);
+        writer.WriteString("Effect");
+        writer.WriteByte(0); // null terminate the command string
+        auto lenOffset = writer.Size();
+        writer.WriteInt(0); // placeholder for length
+        auto offset = writer.Size();
+        writer.WriteFloat(seconds);
+        writer.WriteInt(perPixel ? 1 : 0);
+        writer.WriteInt((uint32_t)params.size());
+        for (int p : params)
+        {
+            writer.WriteInt((uint32_t)p);
+        }
+        for (uint8_t b : program)
+        {
+            writer.WriteByte(b);
+        }
+        writer.WriteLength(lenOffset, writer.Size() - offset);
+        writer.WriteCRC(offset);
+        Send(writer);
+    }
+
     //
     void VerticalGradient(const std::vector<Color>& colors, float seconds = 0, int strip = -1, int colorsPerStrip = 0)
     {
@@ -483,10 +595,96 @@ public:
         writer.WriteCRC(0);
 		Send(writer);
 	}
+    // Record the commands that follow as the cues of a Timeline instead of sending them, until
+    // EndTimeline sends them all in one Timeline command.
+    void BeginTimeline()
+    {
+        cues.Clear();
+        recording = true;
+        cueMicroseconds = 0;
+    }
+
+    // The time from the start of the timeline of the commands that follow.
+    void Cue(float seconds)
+    {
+        cueMicroseconds = seconds > 0 ? (uint32_t)(seconds * 1000000) : 0;
+    }
+
+    // Send the recorded cues, the timeline starts over every period seconds when it loops, a
+    // period of 0 is the time of the last cue.
+    void EndTimeline(bool loop, float periodSeconds)
+    {
+        recording = false;
+        StreamWriter writer;
+        writer.WriteString(header);
+        writer.WriteString("Timeline");
+        writer.WriteByte(0); // null terminate the command string
+        auto lenOffset = writer.Size();
+        writer.WriteInt(0); // placeholder for length
+        auto offset = writer.Size();
+        writer.WriteInt(loop ? 1 : 0);
+        writer.WriteInt(periodSeconds > 0 ? (uint32_t)(periodSeconds * 1000000) : 0);
+        writer.WriteBytes(cues.GetBuffer(), cues.Size());
+        writer.WriteLength(lenOffset, writer.Size() - offset);
+        writer.WriteCRC(offset);
+        Send(writer);
+        cues.Clear();
+    }
+
+    void StopTimeline()
+    {
+        StreamWriter writer;
+        writer.WriteString(header);
+        writer.WriteString("StopTimeline");
+        writer.WriteByte(0); // null terminate the command string
+        writer.WriteInt(0); // length, no payload.
+        writer.WriteCRC(0);
+        Send(writer);
+    }
+
 private:
 
+    uint32_t IndexedSize()
+    {
+        return 16 + (uint32_t)(quantizer.GetPalette().size() * sizeof(uint32_t) + quantizer.GetIndices().size());
+    }
+
+    // Write the frame the quantizer has ready with its palette.
+    void WriteIndexedBuffer(float seconds)
+    {
+        auto& palette = quantizer.GetPalette();
+        auto& indices = quantizer.GetIndices();
+        StreamWriter writer;
+        writer.WriteString(header);
+        writer.WriteString("IndexedBuffer");
+        writer.WriteByte(0); // null terminate the command string
+        auto lenOffset = writer.Size();
+        writer.WriteInt(0); // placeholder for length
+        auto offset = writer.Size();
+        writer.WriteInt(this->numStrips);
+        writer.WriteInt(this->ledsPerStrip);
+        writer.WriteFloat(seconds);
+        writer.WriteInt((uint32_t)palette.size());
+        for (uint32_t color : palette)
+        {
+            writer.WriteInt(color);
+        }
+        writer.WriteBytes((const char*)indices.data(), (int)indices.size());
+        writer.WriteLength(lenOffset, writer.Size() - offset);
+        writer.WriteCRC(offset);
+        Send(writer);
+    }
+
     void Send(StreamWriter& writer)
     {
+        if (recording)
+        {
+            // a cue is the record without the header and the CRC, after the time it starts.
+            int headerSize = (int)strlen(header);
+            cues.WriteInt(cueMicroseconds);
+            cues.WriteBytes(writer.GetBuffer() + headerSize, writer.Size() - headerSize - (int)sizeof(uint32_t));
+            return;
+        }
         // write the complete record to the serial port.
         std::cout << "writing " << writer.Size() << " bytes to Teensy...";
         int n = _port.write((uint8_t*)writer.GetBuffer(), writer.Size());
@@ -0,0 +1,186 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#ifndef _QUANTIZER_H
+#define _QUANTIZER_H
+
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+// Reduces a frame of packed pixels to a palette of at most 256 colors and a byte per pixel, for
+// the IndexedBuffer command.  A frame with 256 colors or fewer keeps them exactly, otherwise
+// the colors are split by median cut: the box of colors with the widest channel is cut in two
+// at the median pixel until there are 256 boxes, and each box becomes the average of its
+// pixels.  Either way every pixel is looked up once in a hash of the distinct colors, so it is
+// quick enough to run on every frame.
+class ColorQuantizer
+{
+public:
+    static const int MaxColors = 256;
+
+private:
+    struct Entry
+    {
+        uint32_t color;
+        uint32_t count; // pixels with this color
+    };
+
+    struct Box
+    {
+        size_t begin;
+        size_t end;
+        int channel; // the widest channel, shift of 0, 8 or 16
+        int range;   // of that channel
+    };
+
+    std::unordered_map<uint32_t, uint32_t> lookup; // color to its entry, then to its palette index
+    std::vector<Entry> entries;
+    std::vector<uint32_t> palette;
+    std::vector<uint8_t> indices;
+    bool exact = true;
+
+public:
+    // Build the palette and indices of count pixels, returns true when no color was lost.
+    bool Quantize(const uint32_t* pixels, int count)
+    {
+        lookup.clear();
+        entries.clear();
+        palette.clear();
+        indices.resize(count);
+        for (int i = 0; i < count; i++)
+        {
+            uint32_t color = pixels[i];
+            auto it = lookup.find(color);
+            if (it == lookup.end())
+            {
+                lookup[color] = (uint32_t)entries.size();
+                entries.push_back(Entry{ color, 1 });
+            }
+            else
+            {
+                entries[it->second].count++;
+            }
+        }
+
+        exact = entries.size() <= MaxColors;
+        if (exact)
+        {
+            for (auto& e : entries)
+            {
+                palette.push_back(e.color);
+            }
+        }
+        else
+        {
+            MedianCut();
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            indices[i] = (uint8_t)lookup[pixels[i]];
+        }
+        return exact;
+    }
+
+    const std::vector<uint32_t>& GetPalette() { return palette; }
+    const std::vector<uint8_t>& GetIndices() { return indices; }
+    bool IsExact() { return exact; }
+
+private:
+    static int Channel(uint32_t color, int shift)
+    {
+        return (color >> shift) & 0xff;
+    }
+
+    static Box MakeBox(std::vector<Entry>& entries, size_t begin, size_t end)
+    {
+        Box box{ begin, end, 0, 0 };
+        for (int shift = 0; shift <= 16; shift += 8)
+        {
+            int lo = 255, hi = 0;
+            for (size_t i = begin; i < end; i++)
+            {
+                int c = Channel(entries[i].color, shift);
+                lo = std::min(lo, c);
+                hi = std::max(hi, c);
+            }
+            if (hi - lo > box.range)
+            {
+                box.range = hi - lo;
+                box.channel = shift;
+            }
+        }
+        return box;
+    }
+
+    void MedianCut()
+    {
+        std::vector<Box> boxes;
+        boxes.push_back(MakeBox(entries, 0, entries.size()));
+        while (boxes.size() < MaxColors)
+        {
+            // cut the box with the widest channel.
+            size_t widest = 0;
+            for (size_t i = 1; i < boxes.size(); i++)
+            {
+                if (boxes[i].range > boxes[widest].range)
+                {
+                    widest = i;
+                }
+            }
+            Box box = boxes[widest];
+            if (box.range == 0)
+            {
+                break;
+            }
+            int shift = box.channel;
+            std::sort(entries.begin() + box.begin, entries.begin() + box.end, [shift](const Entry& a, const Entry& b) {
+                return Channel(a.color, shift) < Channel(b.color, shift);
+            });
+            uint64_t total = 0;
+            for (size_t i = box.begin; i < box.end; i++)
+            {
+                total += entries[i].count;
+            }
+            // the median pixel, leaving at least one color on each side.
+            uint64_t half = 0;
+            size_t cut = box.begin + 1;
+            for (size_t i = box.begin; i < box.end - 1; i++)
+            {
+                half += entries[i].count;
+                cut = i + 1;
+                if (half * 2 >= total)
+                {
+                    break;
+                }
+            }
+            boxes[widest] = MakeBox(entries, box.begin, cut);
+            boxes.push_back(MakeBox(entries, cut, box.end));
+        }
+
+        for (size_t b = 0; b < boxes.size(); b++)
+        {
+            uint64_t sum[3] = { 0, 0, 0 };
+            uint64_t total = 0;
+            for (size_t i = boxes[b].begin; i < boxes[b].end; i++)
+            {
+                const Entry& e = entries[i];
+                for (int c = 0; c < 3; c++)
+                {
+                    sum[c] += (uint64_t)Channel(e.color, c * 8) * e.count;
+                }
+                total += e.count;
+                lookup[e.color] = (uint32_t)b;
+            }
+            uint32_t color = 0;
+            for (int c = 0; c < 3; c++)
+            {
+                color |= (uint32_t)((sum[c] + total / 2) / total) << (c * 8);
+            }
+            palette.push_back(color);
+        }
+    }
+};
+
+#endif
@@ -92,11 +92,18 @@ public:
         pos += bytes;
     }
 
+    void WriteBytes(const char* data, int len)
+    {
+        CheckAllocate(len);
+        ::memcpy(&buffer[pos], data, len);
+        pos += len;
+    }
+
     void WriteFloat(float f)
     {
         CheckAllocate(4);
-        float* ptr = (float*)& buffer[pos];
-        *ptr = f;
+        // the records are packed, so the float can be at any offset.
+        ::memcpy(&buffer[pos], &f, sizeof(f));
         pos += 4;
     }
 
@@ -1,6 +1,7 @@
 // Copyright (c) Microsoft Corporation.
 // Licensed under the MIT license.
 #include "crc32.h"
+#include <string.h>
 
 uint32_t poly8_lookup[256] =
 {
@@ -70,11 +71,64 @@ uint32_t poly8_lookup[256] =
  0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
 };
 
-// calculate a checksum on a buffer -- start address = p, length = bytelength
-uint32_t crc32(uint8_t* p, uint32_t bytelength)
+// slice by 8: slice8_lookup[k][i] is the crc of byte i followed by k zero bytes, so 8 bytes
+// are folded in with 8 independent lookups instead of 8 dependent ones.  The tables are built
+// from poly8_lookup before main runs.
+static uint32_t slice8_lookup[8][256];
+
+static struct Slice8Tables
+{
+    Slice8Tables()
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            slice8_lookup[0][i] = poly8_lookup[i];
+        }
+        for (int k = 1; k < 8; k++)
+        {
+            for (int i = 0; i < 256; i++)
+            {
+                uint32_t crc = slice8_lookup[k - 1][i];
+                slice8_lookup[k][i] = poly8_lookup[crc & 0xff] ^ (crc >> 8);
+            }
+        }
+    }
+} slice8_tables;
+
+uint32_t crc32_begin()
+{
+    return 0xffffffff;
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t* p, uint32_t bytelength)
 {
-    uint32_t crc = 0xffffffff;
+    // the words are read little endian, as they are on the Teensy and the Pi.
+    while (bytelength >= 8)
+    {
+        uint32_t one;
+        uint32_t two;
+        ::memcpy(&one, p, 4);
+        ::memcpy(&two, p + 4, 4);
+        one ^= crc;
+        crc = slice8_lookup[7][one & 0xff] ^ slice8_lookup[6][(one >> 8) & 0xff] ^
+            slice8_lookup[5][(one >> 16) & 0xff] ^ slice8_lookup[4][one >> 24] ^
+            slice8_lookup[3][two & 0xff] ^ slice8_lookup[2][(two >> 8) & 0xff] ^
+            slice8_lookup[1][(two >> 16) & 0xff] ^ slice8_lookup[0][two >> 24];
+        p += 8;
+        bytelength -= 8;
+    }
     while (bytelength-- != 0) crc = poly8_lookup[((uint8_t)crc ^ *(p++))] ^ (crc >> 8);
+    return crc;
+}
+
+uint32_t crc32_end(uint32_t crc)
+{
     // return (~crc); also works
     return (crc ^ 0xffffffff);
 }
+
+// calculate a checksum on a buffer -- start address = p, length = bytelength
+uint32_t crc32(uint8_t* p, uint32_t bytelength)
+{
+    return crc32_end(crc32_update(crc32_begin(), p, bytelength));
+}
@@ -22,6 +22,7 @@ const int TeensyVid = 0x16C0;
 const int TeensyPid = 0x0483;
 const int tcpPort = 21567;
 
+// Must match LEDLayout in TeensyFirmware/include/StripLayout.h
 const uint32_t LEDSPerStrip = 392;
 const uint32_t NUM_LEDStrips = 16;
 
@@ -59,12 +60,18 @@ void PrintHelp()
     std::cout << "  g i n s { R G B }*      set a smooth gradient from top to bottom of given strip (-1 for all strips),\n" <<
                  "                          with 'n' colors per strip (0 = all strips the same colors) animated over s seconds.\n";
     std::cout << "  ga s { R G B }*         test setting animated color for each strip one by one in rapid increments.\n";
-    std::cout << "  m s d s { R G B }*      moving gradient, speed, direction, size, colors.\n";
+    std::cout << "  m s d s { R G B }*      moving gradient, speed (LEDs per second), direction, size, colors.\n";
     std::cout << "  z R G B R G B s d       setup the twinkle pattern with base color rgb, star color rgb, speed, and density.\n";
     std::cout << "  w s d a                 water droplet over existing color, s=size, d=drops, a=amount of color to add for droplet.\n";
     std::cout << "  p { s l R G B }*        set a series of individual pixels to each color, s=strip, l=led.\n";
     std::cout << "  rain [on|off] s a       start or stop rain animation overlay with given size and color amount\n";
     std::cout << "  fire c s s              fire animation with cooling, sparkle and seconds\n";
+    std::cout << "  fps n                   run the Teensy animations at n frames per second (0 runs them as fast as possible)\n";
+    std::cout << "  bright b g d            set global brightness (0-1), gamma and dithering (0|1) of the strips\n";
+    std::cout << "  bright b r g b d        the same with a gamma for each of red, green and blue\n";
+    std::cout << "  effect p s { b }*       run an effect VM program of hex bytes per row (p=0) or per pixel (p=1) for s seconds\n";
+    std::cout << "  timeline off            stop the timeline the Teensy is playing\n";
+    std::cout << "  palette s v f n { R G B }*  fade the indexed frame palette to the colors over s seconds and cycle n entries from f at v per second\n";
     std::cout << "  0                       run serial speed test.\n";
 }
 
@@ -191,6 +198,52 @@ void RunCommandLine(Controller& controller) {
             }
             controller.StartFire(cooling, sparkle, seconds);
         }
+        else if (command == "fps")
+        {
+            float fps = 0;
+            if (size > 1) {
+                fps = (float)atof(parts[1].c_str());
+            }
+            controller.StartFrameRate(fps);
+        }
+        else if (command == "bright")
+        {
+            float brightness = 1;
+            if (size > 1) {
+                brightness = (float)atof(parts[1].c_str());
+            }
+            // one gamma for all three channels, or one each for red, green and blue.
+            float gamma[3] = { 1, 1, 1 };
+            int channels = size > 4 ? 3 : 1;
+            for (int c = 0; c < channels && c + 2 < size; c++) {
+                gamma[c] = (float)atof(parts[c + 2].c_str());
+            }
+            if (channels == 1) {
+                gamma[1] = gamma[2] = gamma[0];
+            }
+            bool dither = false;
+            if (size > channels + 2) {
+                dither = atoi(parts[channels + 2].c_str()) != 0;
+            }
+            controller.StartBrightness(brightness, gamma[0], gamma[1], gamma[2], dither);
+        }
+        else if (command == "effect")
+        {
+            bool perPixel = false;
+            if (size > 1) {
+                perPixel = atoi(parts[1].c_str()) != 0;
+            }
+            float seconds = 0;
+            if (size > 2) {
+                seconds = (float)atof(parts[2].c_str());
+            }
+            std::vector<uint8_t> program;
+            for (int i = 3; i < size; i++)
+            {
+                program.push_back((uint8_t)strtoul(parts[i].c_str(), nullptr, 16));
+            }
+            controller.StartEffect(program, std::vector<int>(), perPixel, seconds);
+        }
         else if (command == "w")
         {
             int length = 16;
@@ -207,6 +260,39 @@ void RunCommandLine(Controller& controller) {
             }
             controller.StartWaterDrop(length, drops, amount);
         }
+        else if (command == "palette")
+        {
+            float seconds = 0;
+            float speed = 0;
+            int cycleFirst = 0;
+            int cycleCount = 0;
+            if (size > 1) {
+                seconds = (float)atof(parts[1].c_str());
+            }
+            if (size > 2) {
+                speed = (float)atof(parts[2].c_str());
+            }
+            if (size > 3) {
+                cycleFirst = atoi(parts[3].c_str());
+            }
+            if (size > 4) {
+                cycleCount = atoi(parts[4].c_str());
+            }
+            std::vector<Color> colors;
+            for (int i = 5; i + 2 < size; i += 3)
+            {
+                uint8_t r = (uint8_t)atoi(parts[i].c_str());
+                uint8_t g = (uint8_t)atoi(parts[i + 1].c_str());
+                uint8_t b = (uint8_t)atoi(parts[i + 2].c_str());
+                colors.push_back(Color{ r, g, b });
+            }
+            controller.StartPalette(colors, seconds, cycleFirst, cycleCount, speed);
+        }
+        else if (command == "timeline")
+        {
+            // timelines come from the server, this can only stop one.
+            controller.StopTimeline();
+        }
         else if (command == "rain")
         {
             bool on = true;
@@ -9,31 +9,49 @@
 #include "Timer.h"
 #include "Vector.h"
 #include "HlsColor.h"
+#include "PixelKernels.h"
+#include "Envelope.h"
+#include "LookupTables.h"
+#include "Compositor.h"
+#include "FrameScheduler.h"
+#include "EffectVM.h"
+#include "Palette.h"
+#include "Random.h"
 
 enum class AnimationType
 {
     Breathe,
     CrossFade,
+    Effect,
     Fire,
     Gradient,
+    Indexed,
     MovingGradient,
     NeuralDrop,
     Rainbow,
     Rain,
     Twinkle,
-    WaterDrop,
-    CopySource
+    WaterDrop
 };
 
-class Animation
+// An animation draws the frames in the PixelBuffer, the overlay animations (like rain) can also
+// run as a layer of the Compositor on top of whatever the current animation draws.
+//
+// Run() is given the seconds since the previous frame (see FrameClock) and the animations move
+// by that much time, so they look the same at any frame rate.  The ones that move in steps use
+// a StepClock and skip the steps a slow frame missed.
+class Animation : public LayerSource
 {
 protected:
+    // The rate the step animations move at by default, one step per frame at the 60 fps they
+    // were first tuned for.
+    static constexpr float StepsPerSecond = 60;
+
+
     PixelBuffer &buffer;
     Timer timer;
     int frames = 0;
     float fps = 0;
-    Animation *overlay = nullptr;
-    const double pi = 3.14159265358979323846; // pi
     const int MaxName = 100;
     AnimationType type;
 
@@ -49,15 +67,11 @@ public:
 
     virtual ~Animation()
     {
-        if (this->overlay != nullptr)
-        {
-            delete this->overlay;
-            this->overlay = nullptr;
-        }
     }
 
-    // run one timeslice of the animation and return true when the animation has finished.
-    virtual bool Run()
+    // run one timeslice of the animation, elapsed seconds after the last one, and return true
+    // when the animation has finished.
+    virtual bool Run(float /*elapsed*/)
     {
         Draw();
         return false; // runs forever
@@ -65,49 +79,14 @@ public:
 
     virtual void Draw()
     {
-        RunOverlay();
-
-        if (this->IsOverlay())
-        {
-            // if this is an overlay it does not write the buffer, the owning Animation needs to do that.
-            return;
-        }
-
         buffer.Write();
         frames++;
     }
 
     virtual void Stop() {}
 
-    virtual void AddOverlay(Animation *new_overlay)
-    {
-        if (this->overlay != nullptr)
-        {
-            delete this->overlay;
-        }
-        this->overlay = new_overlay;
-    }
-
-    virtual Animation *RemoveOverlay()
-    {
-        auto result = this->overlay;
-        this->overlay = nullptr;
-        return result;
-    }
-
-    virtual Animation *GetOverlay()
-    {
-        return this->overlay;
-    }
-
-    virtual bool RunOverlay()
-    {
-        if (this->overlay != nullptr)
-        {
-            return this->overlay->Run();
-        }
-        return true;
-    }
+    // Only the animations that can be a layer draw anything here.
+    void RenderLayer(Compositor &, float) override {}
 
     virtual SimpleString GetName()
     {
@@ -115,13 +94,12 @@ public:
     }
 
     float GetFps() { return fps; }
-
-    virtual bool IsOverlay() { return false; }
 };
 
 class BreatheAnimation : public Animation
 {
 private:
+    FrameSlot snapshotSlot;
     uint32_t *snapshot = nullptr;
     float seconds = 0;
     bool forever = false;
@@ -129,69 +107,43 @@ private:
     float f2;
     float ramp = 0;
     const float breathing_time = 2e3; // 2 seconds
+    // exp(cos()) of the time, which is the breath curve a quarter period ahead.
+    Envelope breath{ EnvelopeShape::Breath, 2 * breathing_time, 0.25f };
 public:
     BreatheAnimation(PixelBuffer &buffer, float seconds, float f1, float f2) : Animation(AnimationType::Breathe, buffer)
     {
         this->seconds = seconds;
         this->f1 = f1;
         this->f2 = f2;
-        ramp = 1 / (float)exp(cos(0)) / f1 + f2;
+        ramp = 1 / (Lookup::Breath(Lookup::Phase(0.25f)) / 4096.0f) / f1 + f2; // 1 / exp(cos(0))
         forever = (seconds == 0);
-        snapshot = buffer.CopyPixels();
+        snapshot = buffer.CopyPixels(snapshotSlot);
         timer.start();
     }
 
-    ~BreatheAnimation()
-    {
-        delete[] snapshot;
-    }
-
     SimpleString GetName() override
     {
         return "BreatheAnimation";
     }
 
     // run one timeslice of the animation and return
-    bool Run() override
+    bool Run(float elapsed) override
     {
         if (snapshot == nullptr)
         {
             return true;
         }
-        int numStrips = buffer.NumStrips();
-        int ledsPerStrip = buffer.NumLedsPerStrip();
-
-        uint32_t *original = snapshot;
-
         if (forever || timer.seconds() < seconds)
         {
-            for (int i = 0; i < numStrips; i++)
-            {
-                for (int j = 0; j < ledsPerStrip; j++)
-                {
-                    float millis = timer.milliseconds();
-                    // this produces a nice sin curve with a bit of an extended quiet time between each peak.
-                    // it produces numbers ranging from about 0.89 to 1.47.
-                    float amplitude = ramp * (float)exp(cos(millis / breathing_time * 3.1415926)) / f1 + f2;
-                    if (amplitude > 1)
-                    {
-                        amplitude = 1;
-                    }
-
-                    uint32_t offset = (j * numStrips) + i;
-                    uint32_t *source = (uint32_t *)(original + offset);
-                    Color basecolor = Color::from(*source);
-
-                    float r = Clamped((float)basecolor.r, amplitude);
-                    float g = Clamped((float)basecolor.g, amplitude);
-                    float b = Clamped((float)basecolor.b, amplitude);
+            // this produces a nice sin curve with a bit of an extended quiet time between each peak.
+            // it produces numbers ranging from about 0.89 to 1.47.
+            float amplitude = ramp * breath.Evaluate(timer.milliseconds()) / f1 + f2;
 
-                    buffer.SetPixel(Color{(uint8_t)r, (uint8_t)g, (uint8_t)b}, i, j);
-                }
-            }
+            // the whole frame is the snapshot dimmed by the same amount.
+            Envelope::Apply(buffer.Span(), snapshot, buffer.GetNumberOfPixels(), amplitude);
             if (ramp > 1)
             {
-                ramp -= 0.001f; // about a 5 second ramp down to the color
+                ramp -= 0.06f * elapsed; // about a 5 second ramp down to the color
             }
             else
             {
@@ -209,30 +161,11 @@ public:
 
     void Stop() override
     {
-        int numStrips = buffer.NumStrips();
-        int ledsPerStrip = buffer.NumLedsPerStrip();
-
-        for (int i = 0; i < numStrips; i++)
+        if (snapshot != nullptr)
         {
-            for (int j = 0; j < ledsPerStrip; j++)
-            {
-                uint32_t offset = (j * numStrips) + i;
-                uint32_t *source = (uint32_t *)(snapshot + offset);
-                Color basecolor = Color::from(*source);
-                buffer.SetPixel(basecolor, i, j);
-            }
+            buffer.CopyFrom(snapshot, buffer.GetBufferSize());
         }
     }
-
-    float Clamped(float c, float amplitude)
-    {
-        c *= amplitude;
-        if (c > 255)
-            c = 255;
-        if (c < 0)
-            c = 0;
-        return c;
-    }
 };
 
 // Similar to NeuralDrop but maintains the existing background colors.
@@ -240,13 +173,15 @@ class WaterDropAnimation : public Animation
 {
 
 private:
+    FrameSlot snapshotSlot;
     uint32_t *snapshot = nullptr;
     int drops = 0;
     bool forever = false;
     int size = 0;
     int index = 0;
     float amount = 0;
-    Vector<float> amplitudes;
+    Vector<uint32_t> drop; // gray added to each row of the droplet
+    StepClock rows{ StepsPerSecond };
 
 public:
     WaterDropAnimation(PixelBuffer &buffer, int drops, int bubble_size, float amount) : Animation(AnimationType::WaterDrop, buffer)
@@ -256,69 +191,46 @@ public:
         this->amount = amount;
 
         forever = (drops == 0);
-        snapshot = buffer.CopyPixels();
+        snapshot = buffer.CopyPixels(snapshotSlot);
 
-        float start = 0;
         for (int i = 0; i < bubble_size; i++)
         {
-            float amplitude = pow(sin(start), (float)2.0);
-            amplitudes.push_back(amplitude);
-            start += (float)(pi / 15);
+            float amplitude = Lookup::Bubble(i, 15) / 256.0f;
+            drop.push_back(DropColor(amplitude * amount));
         }
 
         index = 0;
         timer.start();
     }
 
-    ~WaterDropAnimation()
-    {
-        delete[] snapshot;
-    }
-
     SimpleString GetName() override
     {
         return "WaterDropAnimation";
     }
 
     // run one timeslice of the animation and return
-    bool Run() override
+    bool Run(float elapsed) override
     {
         if (forever || drops > 0)
         {
             int numStrips = buffer.NumStrips();
             int ledsPerStrip = buffer.NumLedsPerStrip();
-            uint32_t *original = snapshot;
+            buffer.CopyFrom(snapshot, buffer.GetBufferSize());
 
-            for (int i = 0; i < numStrips; i++)
+            // Paint the animating water droplet falling down the strip, a row of the buffer
+            // is the same LED on every strip.
+            for (int offset = 0; offset < size && index + offset < ledsPerStrip; offset++)
             {
-                for (int j = 0; j < ledsPerStrip; j++)
-                {
-                    uint32_t *source = (uint32_t *)(original + (j * numStrips) + i);
-                    Color basecolor = Color::from(*source);
-                    float r = (float)basecolor.r;
-                    float g = (float)basecolor.g;
-                    float b = (float)basecolor.b;
-
-                    // Paint the animating water droplet falling down the strip:
-                    int offset = j - index;
-                    if (offset >= 0 && offset < size)
-                    {
-                        float percent = amplitudes[offset] * amount;
-                        r = Clamp(r + percent);
-                        g = Clamp(g + percent);
-                        b = Clamp(b + percent);
-                    }
-
-                    buffer.SetPixel(Color{(uint8_t)r, (uint8_t)g, (uint8_t)b}, i, j);
-                }
+                uint32_t *row = buffer.GetRow(index + offset);
+                PixelKernels::AddSpan(row, row, numStrips, drop[offset]);
             }
 
             Draw();
 
-            index++;
-            if (index == ledsPerStrip)
+            index += rows.Advance(elapsed);
+            while (index >= ledsPerStrip)
             {
-                index = 0;
+                index -= ledsPerStrip;
                 drops--;
             }
             return false;
@@ -328,31 +240,24 @@ public:
 
     void Stop() override
     {
-        int numStrips = buffer.NumStrips();
-        int ledsPerStrip = buffer.NumLedsPerStrip();
-
-        for (int i = 0; i < numStrips; i++)
+        if (snapshot != nullptr)
         {
-            for (int j = 0; j < ledsPerStrip; j++)
-            {
-                uint32_t *source = (uint32_t *)(snapshot + (j * numStrips) + i);
-                Color basecolor = Color::from(*source);
-                buffer.SetPixel(basecolor, i, j);
-            }
+            buffer.CopyFrom(snapshot, buffer.GetBufferSize());
         }
     }
 
-    float Clamp(float c)
+    // The gray added to the background for this much color, the fraction is dropped.
+    static uint32_t DropColor(float amount)
     {
-        if (c > 255)
-            return 255;
-        return c;
+        if (!(amount > 0))
+            return 0;
+        return PixelKernels::Gray(amount >= 255 ? 255 : (uint8_t)amount);
     }
 };
 
 // This draws a falling rain animation on top of whatever is currently there
-// So this is designed to be an overlay on top of something else that constantly
-// refreshes the underlying buffer with something else (like a smooth fade).
+// So this is designed to be a Compositor layer (BlendMode::Add) on top of whatever
+// the current animation draws, only the rows of the droplet are touched.
 // In other words this is like WaterDropAnimation without the snapshot.
 class RainOverlayAnimation : public Animation
 {
@@ -360,128 +265,40 @@ private:
     int size = 0;
     int index = 0;
     float amount = 0;
-    Vector<float> amplitudes;
+    Vector<uint32_t> drop; // gray added to each row of the droplet
+    StepClock rows{ StepsPerSecond };
 
 public:
     RainOverlayAnimation(PixelBuffer &buffer, int bubble_size, float amount) : Animation(AnimationType::Rain, buffer)
     {
         this->size = bubble_size;
         this->amount = amount;
-        float start = 0;
         for (int i = 0; i < bubble_size; i++)
         {
-            float amplitude = pow(sin(start), (float)2.0);
-            amplitudes.push_back(amplitude);
-            start += (float)(pi / bubble_size);
+            float amplitude = Lookup::Bubble(i, bubble_size) / 256.0f;
+            drop.push_back(WaterDropAnimation::DropColor(amplitude * amount));
         }
         index = 0;
         timer.start();
     }
 
-    bool IsOverlay() override { return true; }
-
     SimpleString GetName() override
     {
         return "RainOverlayAnimation";
     }
 
-    // run one timeslice of the animation and return
-    bool Run() override
+    void RenderLayer(Compositor &compositor, float elapsed) override
     {
         int numStrips = buffer.NumStrips();
         int ledsPerStrip = buffer.NumLedsPerStrip();
 
-        for (int i = 0; i < numStrips; i++)
+        // Paint the animating water droplet falling down the strip:
+        for (int offset = 0; offset < size && index + offset < ledsPerStrip; offset++)
         {
-            for (int j = index; j < index + size && j < ledsPerStrip; j++)
-            {
-                auto basecolor = buffer.GetPixel(i, j);
-                float r = (float)basecolor.r;
-                float g = (float)basecolor.g;
-                float b = (float)basecolor.b;
-
-                // Paint the animating water droplet falling down the strip:
-                int offset = j - index;
-                if (offset >= 0 && offset < size)
-                {
-                    float percent = amplitudes[offset] * amount;
-                    r = Clamp(r + percent);
-                    g = Clamp(g + percent);
-                    b = Clamp(b + percent);
-                }
-
-                buffer.SetPixel(Color{(uint8_t)r, (uint8_t)g, (uint8_t)b}, i, j);
-            }
+            compositor.Fill(index + offset, 0, numStrips, drop[offset]);
         }
 
-        Draw();
-
-        index++;
-        if (index == ledsPerStrip)
-        {
-            index = 0;
-        }
-
-        // runs forever
-        return false;
-    }
-
-    float Clamp(float c)
-    {
-        if (c > 255)
-            return 255;
-        return c;
-    }
-};
-
-class CopySourceAnimation : public Animation
-{
-protected:
-    uint32_t *snapshot = nullptr;
-
-public:
-    CopySourceAnimation(PixelBuffer &buffer) : Animation(AnimationType::CopySource, buffer)
-    {
-        snapshot = buffer.CopyPixels();
-    }
-    ~CopySourceAnimation()
-    {
-        delete[] snapshot;
-        snapshot = nullptr;
-    }
-
-    SimpleString GetName() override
-    {
-        return "CopySourceAnimation";
-    }
-
-    bool Run() override
-    {
-        bool rc = true;
-        if (snapshot != nullptr)
-        {
-            CopySnapshot();
-            rc = RunOverlay(); // only run as long as we have an overlay
-            buffer.Write();
-            frames++;
-        }
-        return rc;
-    }
-
-    void CopySnapshot()
-    {
-        if (snapshot != nullptr)
-        {
-            buffer.CopyFrom(snapshot, buffer.GetBufferSize());
-        }
-    }
-
-    void UpdateSnapshot()
-    {
-        if (snapshot != nullptr)
-        {
-            buffer.CopyTo(snapshot, buffer.GetBufferSize());
-        }
+        index = (index + rows.Advance(elapsed)) % ledsPerStrip;
     }
 };
 
@@ -493,6 +310,7 @@ class BaseCrossFadeAnimation : public Animation
 protected:
     PixelBuffer &target;
     float seconds = 0;
+    FrameSlot originalSlot;
     uint32_t *original = nullptr;
     bool hold = false; // whether to hold final position and never complete the animation.
 public:
@@ -501,71 +319,30 @@ public:
         this->seconds = seconds;
     }
 
-    ~BaseCrossFadeAnimation()
-    {
-        if (original != nullptr)
-        {
-            delete[] original;
-            original = nullptr;
-        }
-    }
-
     SimpleString GetName() override
     {
         return "BaseCrossFadeAnimation";
     }
 
-    // Call start to create a snapshot of the origin buffer and start the timer.
+    // Call start to create a snapshot of the origin buffer and start the timer.  A fade of no
+    // seconds goes straight to the target and needs no snapshot.
     void Start()
     {
-        if (original != nullptr)
+        if (seconds > 0)
         {
-            delete[] original;
+            original = buffer.CopyPixels(originalSlot);
         }
-        original = buffer.CopyPixels();
         timer.start();
     }
 
-    bool Run() override
+    bool Run(float /*elapsed*/) override
     {
-        size_t ledsPerStrip = buffer.NumLedsPerStrip();
-        size_t numStrips = buffer.NumStrips();
-        uint32_t *pixelBuffer = buffer.GetPixelBuffer();
-
         // cross fade to a target buffer.
         if (timer.seconds() < seconds && original != nullptr)
         {
             float percent = 1 - ((float)seconds - (float)timer.seconds()) / (float)seconds;
-            uint32_t *goal = target.GetPixelBuffer();
-            uint32_t *before = original;
-            uint32_t *pixels = pixelBuffer;
-            uint32_t position = 0;
-            for (size_t i = 0; i < numStrips; i++)
-            {
-                for (size_t j = 0; j < ledsPerStrip; j++)
-                {
-                    // extract previous colors, could lift this out of the loop, but it would be a lot of floats!
-                    uint32_t value = *before;
-                    Color previous = Color::from(value);
-
-                    Color tc = Color::from(*goal); // get target colors
-
-                    float dr = (float)tc.r - (float)previous.r;
-                    float dg = (float)tc.g - (float)previous.g;
-                    float db = (float)tc.b - (float)previous.b;
-
-                    // interpolate to the new color.
-                    Color ic{(uint8_t)(previous.r + (percent * dr)),
-                             (uint8_t)(previous.g + (percent * dg)),
-                             (uint8_t)(previous.b + (percent * db))};
-                    value = ic.pack();
-                    *pixels = value;
-                    pixels++;
-                    before++;
-                    goal++;
-                    position++;
-                }
-            }
+            PixelKernels::LerpSpan(buffer.Span(), original, target.Span(), buffer.GetNumberOfPixels(),
+                PixelKernels::Fraction(percent));
 
             // this base class does not call Draw because it lets the subclass take care of that.
             return false;
@@ -579,13 +356,9 @@ public:
 
     void Stop() override
     {
-        size_t ledsPerStrip = buffer.NumLedsPerStrip();
-        size_t numStrips = buffer.NumStrips();
-        uint32_t *pixelBuffer = buffer.GetPixelBuffer();
         fps = (float)frames / (float)seconds;
         // write the final values.
-        uint32_t size = (uint32_t)(ledsPerStrip * numStrips);
-        ::memcpy(pixelBuffer, target.GetPixelBuffer(), sizeof(uint32_t) * size);
+        buffer.CopyFrom(target.Span(), buffer.GetBufferSize());
     }
 };
 
@@ -599,22 +372,36 @@ private:
     int currentColor = 0;
     bool hasColors = false;
     bool started = false;
+    bool shown = false; // the target has become the display buffer.
 
 public:
     CrossFadeToAnimation(PixelBuffer &buffer, const Vector<Color> &fade_colors, float seconds)
-        : BaseCrossFadeAnimation(buffer, target, seconds), target(buffer.NumStrips(), buffer.NumLedsPerStrip()), colors(fade_colors)
+        : BaseCrossFadeAnimation(buffer, target, seconds), colors(fade_colors)
     {
         hasColors = (colors.size() > 0);
         target.Initialize();
     }
 
+    // Fade to a copy of pixels that stay with the caller.
     CrossFadeToAnimation(PixelBuffer &buffer, uint32_t *source, uint32_t size, float seconds)
-        : BaseCrossFadeAnimation(buffer, target, seconds), target(buffer.NumStrips(), buffer.NumLedsPerStrip())
+        : BaseCrossFadeAnimation(buffer, target, seconds)
     {
         target.Initialize();
         this->target.CopyFrom(source, size);
     }
 
+    // Fade to a frame the target takes ownership of, at the end of the fade it becomes the
+    // display buffer, so the pixels are never copied.
+    CrossFadeToAnimation(PixelBuffer &buffer, FrameSlot &&frame, float seconds)
+        : BaseCrossFadeAnimation(buffer, target, seconds)
+    {
+        target.Exchange(frame);
+        if (target.Span() == nullptr)
+        {
+            target.Initialize();
+        }
+    }
+
     ~CrossFadeToAnimation()
     {
     }
@@ -625,7 +412,7 @@ public:
     }
 
     // run one timeslice of the animation and return true when the animation has finished.
-    bool Run() override
+    bool Run(float elapsed) override
     {
         if (!started)
         {
@@ -637,7 +424,7 @@ public:
             Start();
         }
 
-        bool rc = BaseCrossFadeAnimation::Run();
+        bool rc = BaseCrossFadeAnimation::Run(elapsed);
         if (rc && hasColors)
         {
             currentColor++;
@@ -652,6 +439,22 @@ public:
 
         return rc;
     }
+
+    void Stop() override
+    {
+        if (hasColors)
+        {
+            BaseCrossFadeAnimation::Stop();
+        }
+        else if (!shown)
+        {
+            // swap the target in rather than copying it, only once since it then holds the
+            // frame that was on display.
+            fps = (float)frames / (float)seconds;
+            buffer.Exchange(target);
+            shown = true;
+        }
+    }
 };
 
 class RainbowAnimation : public Animation
@@ -661,6 +464,7 @@ private:
     uint32_t start_offset = 0;
     float duration = 0;
     bool forever;
+    StepClock steps{ StepsPerSecond }; // LEDs per second the colors scroll by
 
 public:
     RainbowAnimation(PixelBuffer &buffer, int length, float seconds) : Animation(AnimationType::Rainbow, buffer)
@@ -678,7 +482,7 @@ public:
     }
 
     // run one timeslice of the animation and return true when the animation has finished.
-    bool Run() override
+    bool Run(float elapsed) override
     {
         float thirds = (float)length / 3.0f;
         float factor1, factor2;
@@ -686,7 +490,8 @@ public:
         if (forever || timer.seconds() < duration)
         {
             int ledsPerStrip = buffer.NumLedsPerStrip();
-            uint32_t offset = start_offset++;
+            uint32_t offset = start_offset;
+            start_offset += steps.Advance(elapsed);
             for (int i = 0; i < ledsPerStrip; i++)
             {
                 uint32_t index = offset + i;
@@ -725,150 +530,200 @@ public:
     }
 };
 
+// Fades each strip to its own gradient.  AddStrip() renders the gradient once into a ribbon of
+// one strip's LEDs and copies it into that strip of the target (every strip for -1), and each
+// strip keeps its own fade, so updating one strip costs O(ledsPerStrip) and doesn't restart the
+// fades of the others.  A strip fades from whatever it showed when its gradient was added, the
+// strips that never get one keep what they were showing.
 class GradientAnimation : public BaseCrossFadeAnimation
 {
 private:
+    struct StripFade
+    {
+        float seconds = 0;
+        float time = 0;
+    };
+
     PixelBuffer target;
-    Vector<Vector<Color>> strip_colors;
-    Vector<Color> colors; // if we are animating all strips.
+    StripFade fades[LEDLayout::Strips];
+    uint32_t ribbon[LEDLayout::LedsPerStrip];
+    uint32_t ownColors = 0; // bit per strip with a gradient of its own, the -1 gradient leaves those alone.
+    uint32_t fading = 0;    // bit per strip that is still fading, only those columns are drawn.
+
 public:
     GradientAnimation(PixelBuffer &buffer, bool hold = true)
-        : BaseCrossFadeAnimation(buffer, target, 0), target(buffer.NumStrips(), buffer.NumLedsPerStrip())
+        : BaseCrossFadeAnimation(buffer, target, 0)
     {
         type = AnimationType::Gradient;
         this->hold = hold;
+        target.Initialize();
+        original = buffer.CopyPixels(originalSlot);
+        if (original != nullptr)
+        {
+            target.CopyFrom(original, buffer.GetBufferSize());
+        }
     }
 
     void AddStrip(int strip, const Vector<Color> &gradient, float seconds)
     {
-        this->seconds = seconds;
-        target.Initialize();
+        if (gradient.size() > 0)
+        {
+            AddStrip(strip, &gradient[0], (int)gradient.size(), seconds);
+        }
+    }
 
-        if (gradient.size() == 0)
+    // Add count colors for one strip (-1 for all strips), colors can point into the colors of
+    // a command that has several strips so nothing is copied.
+    void AddStrip(int strip, const Color *colors, int count, float seconds)
+    {
+        int numStrips = buffer.NumStrips();
+        if (count <= 0 || original == nullptr || strip < -1 || strip >= numStrips)
         {
             return;
         }
 
+        RenderRibbon(colors, count);
         if (strip == -1)
         {
             // animating all strips with the same colors.
-            colors = gradient;
+            for (int i = 0; i < numStrips; i++)
+            {
+                if ((ownColors & (1u << i)) == 0)
+                {
+                    StartStrip(i, seconds);
+                }
+            }
         }
         else
         {
-            // animating individual strips with the given colors.
-            if (strip >= 0 && strip < buffer.NumStrips())
-            {
-                strip_colors.reserve(buffer.NumStrips());
-                strip_colors[strip] = gradient;
-            }
+            ownColors |= (1u << strip);
+            StartStrip(strip, seconds);
         }
+        timer.start();
+    }
 
-        int s = (int)(gradient.size() - 1);
-
-        int ledsPerStrip = buffer.NumLedsPerStrip();
-        int numStrips = buffer.NumStrips();
-        int num_strip_colors = (int)strip_colors.reserved();
+    SimpleString GetName() override
+    {
+        return "GradientAnimation";
+    }
 
-        for (int i = 0; i < numStrips; i++)
+    // run one timeslice of the animation and return true when the animation has finished.
+    bool Run(float elapsed) override
+    {
+        if (fading != 0)
         {
-            for (int j = 0; j < ledsPerStrip; j++)
+            int numStrips = buffer.NumStrips();
+            int ledsPerStrip = buffer.NumLedsPerStrip();
+            const uint32_t *from = original;
+            const uint32_t *to = target.GetPixelBuffer();
+            uint32_t *pixels = buffer.GetPixelBuffer();
+            for (int i = 0; i < numStrips; i++)
             {
-                int segment = 0;
-                float segment_length = (float)ledsPerStrip;
-                int num_segments = 1;
-                bool has_color = false;
-                Color start;
-                Color end;
-                bool interpolate = false;
-                Vector<Color> &colors = this->colors;
-                if (i < num_strip_colors && strip_colors[i].size() > 0)
+                if ((fading & (1u << i)) == 0)
                 {
-                    // we have a specific color setting for this strip.
-                    colors = strip_colors[i];
+                    continue;
                 }
-
-                // prepare the target buffer with the gradient we want to fade to.
-                num_segments = (int)colors.size() - 1;
-                if (num_segments > 1)
-                {
-                    segment_length /= (float)num_segments;
-                }
-
-                if (num_segments > 1)
-                {
-                    segment = (int)(j / segment_length);
-                    if (segment > num_segments)
-                    {
-                        segment = num_segments;
-                    }
-                }
-                int num_colors = (int)colors.size();
-                if (num_colors > segment)
+                StripFade &fade = fades[i];
+                fade.time += elapsed;
+                if (fade.time < fade.seconds)
                 {
-                    start = end = colors[segment];
-                    if (num_colors > segment + 1)
+                    uint32_t fraction = PixelKernels::Fraction(fade.time / fade.seconds);
+                    for (int j = 0, index = i; j < ledsPerStrip; j++, index += numStrips)
                     {
-                        end = colors[segment + 1];
-                        interpolate = true;
+                        pixels[index] = PixelKernels::Lerp(from[index], to[index], fraction);
                     }
-                    has_color = true;
                 }
-
-                if (has_color)
+                else
                 {
-                    if (interpolate)
-                    {
-                        int offset = j - (int)(segment_length * segment);
-                        float dr = (float)end.r - (float)start.r;
-                        float dg = (float)end.g - (float)start.g;
-                        float db = (float)end.b - (float)start.b;
-                        float percent = (float)offset / segment_length;
-                        if (percent > 1)
-                            percent = 1;
-                        Color ic{(uint8_t)(start.r + (percent * dr)),
-                                 (uint8_t)(start.g + (percent * dg)),
-                                 (uint8_t)(start.b + (percent * db))};
-                        target.SetPixel(ic, i, j);
-                    }
-                    else
+                    // done, the strip gets its target once and isn't touched again.
+                    for (int j = 0, index = i; j < ledsPerStrip; j++, index += numStrips)
                     {
-                        target.SetPixel(start, i, j);
+                        pixels[index] = to[index];
                     }
+                    fading &= ~(1u << i);
                 }
             }
         }
+        Draw();
+        return fading == 0 && !hold;
+    }
 
-        Start();
+    void Stop() override
+    {
+        fps = (float)frames / (float)timer.seconds();
+        buffer.CopyFrom(target.Span(), buffer.GetBufferSize());
     }
 
-    SimpleString GetName() override
+private:
+    // The gradient down one strip: the colors are spaced evenly and each segment between two
+    // of them is interpolated, the last color only covers what is left over at the end.
+    void RenderRibbon(const Color *colors, int num_colors)
     {
-        return "GradientAnimation";
+        int ledsPerStrip = buffer.NumLedsPerStrip();
+        int num_segments = num_colors - 1;
+        float segment_length = (float)ledsPerStrip;
+        if (num_segments > 1)
+        {
+            segment_length /= (float)num_segments;
+        }
+        for (int j = 0; j < ledsPerStrip; j++)
+        {
+            int segment = 0;
+            if (num_segments > 1)
+            {
+                segment = (int)(j / segment_length);
+                if (segment > num_segments)
+                {
+                    segment = num_segments;
+                }
+            }
+            uint32_t start = colors[segment].pack();
+            if (segment + 1 < num_colors)
+            {
+                int offset = j - (int)(segment_length * segment);
+                float percent = (float)offset / segment_length;
+                ribbon[j] = PixelKernels::Lerp(start, colors[segment + 1].pack(), PixelKernels::Fraction(percent));
+            }
+            else
+            {
+                ribbon[j] = start;
+            }
+        }
     }
 
-    // run one timeslice of the animation and return true when the animation has finished.
-    bool Run() override
+    // Put the ribbon in the target for one strip and fade it in from what the strip shows now.
+    void StartStrip(int strip, float seconds)
     {
-        bool rc = BaseCrossFadeAnimation::Run();
-        Draw();
-        return rc;
+        int ledsPerStrip = buffer.NumLedsPerStrip();
+        int numStrips = buffer.NumStrips();
+        const uint32_t *pixels = buffer.GetPixelBuffer();
+        uint32_t *to = target.GetPixelBuffer();
+        for (int j = 0; j < ledsPerStrip; j++)
+        {
+            int index = j * numStrips + strip;
+            original[index] = pixels[index];
+            to[index] = ribbon[j];
+        }
+        StripFade &fade = fades[strip];
+        fade.seconds = seconds;
+        fade.time = 0;
+        fading |= (1u << strip);
     }
 };
 
 // This is an additive animation in that it scrolls a new gradient into the current buffer,
 // in a given direction, so there is no need to cross fade into the target buffer.
-class MovingGradientAnimation : public CopySourceAnimation
+class MovingGradientAnimation : public Animation
 {
 private:
     Vector<Color> colors;
-    float speed; // number of pixels to move the animation on each frame of the animation, 1 is the smoothest.
+    float speed; // LEDs per second the gradient moves.
     int direction;
-    long ticks = 0;
+    float position = 0; // LEDs moved so far
     int size; // size of the gradient that we are scrolling through the buffer.
 public:
     MovingGradientAnimation(PixelBuffer &buffer, const Vector<Color> &gradient, float speed, float direction, int size)
-        : CopySourceAnimation(buffer), colors(gradient), speed(speed), direction((int)direction), size(size)
+        : Animation(AnimationType::MovingGradient, buffer), colors(gradient), speed(speed), direction((int)direction), size(size)
     {
         int ledsPerStrip = buffer.NumLedsPerStrip();
         if (size > ledsPerStrip)
@@ -878,17 +733,14 @@ public:
     }
 
     // run one timeslice of the animation and return true when the animation has finished.
-    bool Run() override
+    bool Run(float elapsed) override
     {
-        ticks++;
-        int offset = (int)(ticks * speed);
+        position += elapsed * speed;
+        int offset = (int)position;
         int step = 1;
         bool finished = false;
         int ledsPerStrip = buffer.NumLedsPerStrip();
 
-        // undo any overlay effect.
-        this->CopySnapshot();
-
         if (direction < 0)
         {
             // start at the bottom and scroll in from there.
@@ -910,50 +762,36 @@ public:
             }
         }
 
-        int numStrips = buffer.NumStrips();
-
         int num_segments = (int)colors.size() - 1;
         float segment_length = (float)size / (float)num_segments;
 
-        for (int i = 0; i < numStrips; i++)
+        // every strip gets the same gradient, so each LED is one color across the row.
+        int end = offset + (size * step);
+        int k = 0;
+        for (int j = offset; (direction > 0 && j < end) || (direction < 0 && j > end); j += step)
         {
-            int end = offset + (size * step);
-            int k = 0;
-            for (int j = offset; (direction > 0 && j < end) || (direction < 0 && j > end); j += step)
+            if (j >= 0 && j < ledsPerStrip)
             {
-                if (j >= 0 && j < ledsPerStrip)
+                int segment = (int)(k / segment_length);
+                if (segment > num_segments)
                 {
-                    int segment = (int)(k / segment_length);
-                    if (segment > num_segments)
-                    {
-                        segment = num_segments;
-                    }
-                    int p = k - (int)(segment_length * segment);
-                    Color start = colors[num_segments - segment];
-                    Color end = start;
-                    int q = num_segments - (segment + 1);
-                    if (q >= 0 && q <= num_segments)
-                    {
-                        end = colors[q];
-                    }
-                    float dr = (float)end.r - (float)start.r;
-                    float dg = (float)end.g - (float)start.g;
-                    float db = (float)end.b - (float)start.b;
-                    float percent = (float)p / segment_length;
-                    if (percent > 1)
-                        percent = 1;
-                    Color ic{(uint8_t)(start.r + (percent * dr)),
-                             (uint8_t)(start.g + (percent * dg)),
-                             (uint8_t)(start.b + (percent * db))};
-                    buffer.SetPixel(ic, i, j);
+                    segment = num_segments;
+                }
+                int p = k - (int)(segment_length * segment);
+                Color start = colors[num_segments - segment];
+                Color end = start;
+                int q = num_segments - (segment + 1);
+                if (q >= 0 && q <= num_segments)
+                {
+                    end = colors[q];
                 }
-                k++;
+                float percent = (float)p / segment_length;
+                uint32_t color = PixelKernels::Lerp(start.pack(), end.pack(), PixelKernels::Fraction(percent));
+                PixelBuffer::FillRow(buffer.GetRow(j), color);
             }
+            k++;
         }
 
-        // save snapshot before any overlay is applied.
-        this->UpdateSnapshot();
-
         Draw();
         return finished;
     }
@@ -974,17 +812,17 @@ private:
     const float breathing_time = 3e3; // 3 seconds
     const int bubble_size = 16;
     Vector<Color> bubble_colors;
+    Envelope breath{ EnvelopeShape::Breath, 2 * breathing_time };
+    StepClock rows{ StepsPerSecond };
 
 public:
     NeuralDropAnimation(PixelBuffer &buffer, int drops) : Animation(AnimationType::NeuralDrop, buffer)
     {
-        float start = 0;
         for (int i = 0; i < bubble_size; i++)
         {
-            int temperature = (int)(128 * pow(sin(start), (float)2.0) + 8);
+            int temperature = ((128 * Lookup::Bubble(i, 15)) >> 8) + 8;
             uint8_t nc = (uint8_t)(temperature);
             bubble_colors.push_back(Color{nc, 0, nc});
-            start += (float)(pi / 15);
         }
 
         timer.start();
@@ -999,21 +837,17 @@ public:
     }
 
     // run one timeslice of the animation and return
-    bool Run() override
+    bool Run(float elapsed) override
     {
         int ledsPerStrip = buffer.NumLedsPerStrip();
         if (forever || drops > 0)
         {
             // Generate a 'breathing' animation with a pseudo triangular wave with different decay:
-            float millis = timer.milliseconds();
             // this produces a nice sin curve with a bit of an extended quiet time between each peak.
-            float amplitude = (float)exp(sin(millis / breathing_time * 3.1415926)) / 6.0f + 0.25f;
-            uint8_t r = (uint8_t)((float)basecolor.r * amplitude);
-            uint8_t g = (uint8_t)((float)basecolor.g * amplitude);
-            uint8_t b = (uint8_t)((float)basecolor.b * amplitude);
+            float amplitude = breath.Evaluate(timer.milliseconds()) / 6.0f + 0.25f;
 
             // Paint the entire canvas the 'background' breathing color:
-            buffer.SetColor(Color{r, g, b});
+            buffer.SetColor(Color::from(Envelope::Apply(basecolor.pack(), amplitude)));
 
             // Paint the animating section falling down the strip:
             for (int j = index; j < (index + bubble_size); j++)
@@ -1027,10 +861,10 @@ public:
 
             Draw();
 
-            index++;
-            if (index == ledsPerStrip)
+            index += rows.Advance(elapsed);
+            while (index >= ledsPerStrip)
             {
-                index = 0;
+                index -= ledsPerStrip;
                 drops--;
             }
             return false;
@@ -1050,8 +884,10 @@ private:
     Timer timer;
     Color baseColor;
     Color twinkle;
-    float speed;
+    float speed; // the steps a star lasts
     int density;
+    StepClock steps{ StepsPerSecond };
+    Random random;
 
     class Star
     {
@@ -1064,7 +900,8 @@ private:
     Star *stars = nullptr;
 
 public:
-    TwinkleAnimation(PixelBuffer &buffer, Color baseColor, Color twinkle, float speed, int density) : Animation(AnimationType::Twinkle, buffer)
+    TwinkleAnimation(PixelBuffer &buffer, Color baseColor, Color twinkle, float speed, int density, uint32_t seed = Random::DefaultSeed)
+        : Animation(AnimationType::Twinkle, buffer), random(seed)
     {
         timer.start();
         this->twinkle = twinkle;
@@ -1094,13 +931,42 @@ public:
         return "TwinkleAnimation";
     }
 
-    bool Run() override
+    bool Run(float elapsed) override
     {
         // twinkle animates random pixels between baseColor and twinkle color
-        float dr = (float)twinkle.r - (float)baseColor.r;
-        float dg = (float)twinkle.g - (float)baseColor.g;
-        float db = (float)twinkle.b - (float)baseColor.b;
+        uint32_t base = baseColor.pack();
+        uint32_t star_color = twinkle.pack();
+
+        buffer.SetColor(baseColor);
+        StepStars(steps.Advance(elapsed), [&](int strip, int led, uint32_t brightness) {
+            // interpolate the twinkle effect
+            buffer.SetPixel(Color::from(PixelKernels::Lerp(base, star_color, brightness)), strip, led);
+        });
+
+        Draw();
+        return false; // runs forever
+    }
+
+    // As a layer only the stars are drawn, in the twinkle color with their brightness as the
+    // alpha, over whatever is underneath instead of the base color.
+    void RenderLayer(Compositor &compositor, float elapsed) override
+    {
+        uint32_t star_color = twinkle.pack();
+        StepStars(steps.Advance(elapsed), [&](int strip, int led, uint32_t brightness) {
+            compositor.Fill(led, strip, 1, star_color, brightness);
+        });
+    }
+    void Stop() override
+    {
+        buffer.SetColor(baseColor);
+    }
 
+private:
+    // Move every star on by count steps, draw(strip, led, brightness) is called for the stars
+    // that are showing with a brightness of 0-256.
+    template <typename DrawStar>
+    void StepStars(int count, DrawStar draw)
+    {
         if (density < 1)
         {
             density = 1;
@@ -1108,37 +974,28 @@ public:
 
         if (stars == nullptr)
         {
-            return false;
+            return;
         }
 
         int numStrips = buffer.NumStrips();
-
-        buffer.SetColor(baseColor);
-
         for (int i = 0; i < numStrips; i++)
         {
             for (int j = 0; j < density; j++)
             {
                 int index = (i * density) + j;
                 Star &star = stars[index];
-                float brightness = 0;
-                if (speed == 0 || star.count < star.start)
-                {
-                    buffer.SetPixel(baseColor, i, star.index);
-                }
-                else
+                if (speed != 0 && star.count >= star.start)
                 {
                     int position = star.count - star.start;
-                    brightness = (float)sin((float)position * pi / (float)speed);
-                    // interpolate the twinkle effect
-                    Color ic{(uint8_t)(baseColor.r + (brightness * dr)),
-                             (uint8_t)(baseColor.g + (brightness * dg)),
-                             (uint8_t)(baseColor.b + (brightness * db))};
-
-                    buffer.SetPixel(ic, i, star.index);
+                    // sin(position * pi / speed), half a period over the life of the star.
+                    int32_t brightness = Lookup::Sin(Lookup::Phase((float)position / (2 * speed)));
+                    if (brightness > 0)
+                    {
+                        draw(i, star.index, (uint32_t)brightness >> 7);
+                    }
                 }
 
-                star.count++;
+                star.count += count;
                 if (star.count - star.start >= speed)
                 {
                     // this star is done, replace it with a new one.
@@ -1146,16 +1003,8 @@ public:
                 }
             }
         }
-
-        Draw();
-        return false; // runs forever
-    }
-    void Stop() override
-    {
-        buffer.SetColor(baseColor);
     }
 
-private:
     // get a set of random leds for each strip
     void GetStars(float speed, int density, Star *array)
     {
@@ -1172,22 +1021,146 @@ private:
 
     Star GetRandomStar(float speed)
     {
-        int ledsPerStrip = buffer.NumLedsPerStrip();
-        int index = (int)(static_cast<float>(rand()) / static_cast<float>(RAND_MAX) * ledsPerStrip);
+        int index = (int)random.Below(buffer.NumLedsPerStrip());
         int start = 0;
         if (speed > 0)
         {
-            start = (int)(static_cast<float>(rand()) / static_cast<float>(RAND_MAX) * speed);
+            start = (int)random.Below((uint32_t)speed + 1);
         }
         return Star{index, start, 0};
     }
 };
 
+// Runs an EffectProgram sent by the RpiController.  Each frame the program is evaluated once per
+// LED row and the row filled with its color, or once per pixel when the program asks for it.
+class EffectAnimation : public Animation
+{
+private:
+    EffectProgram program;
+    float seconds = 0;
+    bool forever = false;
+
+public:
+    EffectAnimation(PixelBuffer &buffer, const EffectProgram &program, float seconds)
+        : Animation(AnimationType::Effect, buffer), program(program), seconds(seconds)
+    {
+        forever = (seconds == 0);
+        timer.start();
+    }
+
+    SimpleString GetName() override
+    {
+        return "EffectAnimation";
+    }
+
+    bool Run(float /*elapsed*/) override
+    {
+        if (!program.IsLoaded() || (!forever && timer.seconds() >= seconds))
+        {
+            fps = (float)frames / (float)timer.seconds();
+            return true;
+        }
+
+        int numStrips = buffer.NumStrips();
+        program.Begin(numStrips, buffer.NumLedsPerStrip(), (int32_t)timer.milliseconds());
+        if (program.IsPerPixel())
+        {
+            buffer.ForEachRow([&](int led, uint32_t *pixels) {
+                for (int x = 0; x < numStrips; x++)
+                {
+                    pixels[x] = program.Evaluate(x, led);
+                }
+            });
+        }
+        else
+        {
+            buffer.ForEachRow([&](int led, uint32_t *pixels) {
+                PixelBuffer::FillRow(pixels, program.Evaluate(0, led));
+            });
+        }
+        Draw();
+        return false;
+    }
+};
+
+// Draws a frame of palette indices sent with the IndexedBuffer command, cross fading to it over
+// the given seconds.  It then keeps running so the frame is drawn again whenever the Palette
+// changes, which is how a Palette command fades or cycles the colors of the frame.
+class IndexedAnimation : public Animation
+{
+private:
+    Palette &palette;
+    FrameSlot indexSlot;
+    uint8_t *indices = nullptr;
+    uint32_t count = 0;
+    FrameSlot originalSlot;
+    uint32_t *original = nullptr;
+    float seconds = 0;
+    bool fading = false;
+    uint32_t version = 0;
+
+public:
+    // The animation takes ownership of the slot with the count indices.
+    IndexedAnimation(PixelBuffer &buffer, Palette &palette, FrameSlot &&source, uint32_t count, float seconds)
+        : Animation(AnimationType::Indexed, buffer), palette(palette), indexSlot(static_cast<FrameSlot &&>(source)), seconds(seconds)
+    {
+        uint32_t pixels = buffer.GetNumberOfPixels();
+        this->count = count < pixels ? count : pixels;
+        indices = reinterpret_cast<uint8_t *>(indexSlot.Get());
+        if (seconds > 0)
+        {
+            original = buffer.CopyPixels(originalSlot);
+            fading = (original != nullptr);
+        }
+        version = palette.GetVersion() - 1;
+        timer.start();
+    }
+
+    SimpleString GetName() override
+    {
+        return "IndexedAnimation";
+    }
+
+    bool Run(float elapsed) override
+    {
+        if (indices == nullptr)
+        {
+            return true;
+        }
+        palette.Update(elapsed);
+        if (fading || version != palette.GetVersion())
+        {
+            uint32_t *pixels = buffer.Span();
+            palette.Expand(pixels, indices, count);
+            if (fading)
+            {
+                float percent = (float)timer.seconds() / seconds;
+                PixelKernels::LerpSpan(pixels, original, pixels, count, PixelKernels::Fraction(percent));
+                if (percent >= 1)
+                {
+                    fading = false;
+                    originalSlot.Release();
+                    original = nullptr;
+                }
+            }
+            version = palette.GetVersion();
+        }
+        Draw();
+        return false;
+    }
+};
+
+// The heat is a byte per cell and each temperature is looked up in a table of colors, so a step
+// of the simulation is integer math with one random number per cell.  The same seed makes the
+// same fire on the Teensy and in TeensyUnitTest.
 class FireAnimation : public Animation
 {
 private:
-    // Array of temperature readings at each simulation cell
-    float *heat = nullptr;
+    // Array of temperature readings at each simulation cell, a byte per pixel
+    FrameSlot heatSlot;
+    uint8_t *heat = nullptr;
+    uint32_t palette[256]; // the color of each temperature
+    Random random;
 
     // There are two main parameters you can play with to control the look and
     // feel of your fire: COOLING (used in step 1 above), and SPARKING (used
@@ -1206,25 +1179,31 @@ private:
     float duration = 0;
     bool forever;
     bool reverse;
+    StepClock steps{ StepsPerSecond };
 
 public:
-    FireAnimation(PixelBuffer &buffer, int cooling, int sparkling, float seconds, bool reverse = true) : Animation(AnimationType::Fire, buffer)
+    FireAnimation(PixelBuffer &buffer, int cooling, int sparkling, float seconds, bool reverse = true, uint32_t seed = Random::DefaultSeed)
+        : Animation(AnimationType::Fire, buffer), random(seed)
     {
         timer.start();
         this->reverse = reverse;
         this->cooling = (int)(fmin(cooling, 100));
         this->sparkling = (int)(fmin(sparkling, 255));
-        heat = new float[buffer.GetNumberOfPixels()];
-        duration = seconds;
-        forever = (seconds == 0);
-    }
-
-    ~FireAnimation()
-    {
-        if (heat != nullptr)
+        heat = reinterpret_cast<uint8_t *>(heatSlot.Acquire());
+        if (heat == nullptr)
+        {
+            CrashPrint("### Fire: out of memory\r\n");
+        }
+        else
         {
-            delete[] heat;
+            ::memset(heat, 0, buffer.GetNumberOfPixels());
         }
+        for (int t = 0; t < 256; t++)
+        {
+            palette[t] = HeatColor((uint8_t)t).pack();
+        }
+        duration = seconds;
+        forever = (seconds == 0);
     }
 
     SimpleString GetName() override
@@ -1232,72 +1211,79 @@ public:
         return "FireAnimation";
     }
 
-    float random(int min, int max)
-    {
-        int range = max - min;
-        float r = static_cast<float>(rand());
-        r = min + ((r / static_cast<float>(RAND_MAX)) * range);
-        return r;
-    }
-
-    bool Run() override
+    bool Run(float elapsed) override
     {
-        if (!forever && timer.seconds() > duration)
+        if (heat == nullptr || (!forever && timer.seconds() > duration))
         {
             fps = (float)frames / (float)timer.seconds();
             return true;
         }
 
+        // The fire is random so a slow frame runs one step of the simulation instead of catching
+        // up on the ones it missed, and a fast frame shows the last step again.
+        if (steps.Advance(elapsed) > 0)
+        {
+            Simulate();
+        }
+
+        // Map from heat cells to LED colors
         int num_leds = buffer.NumLedsPerStrip();
         int numStrips = buffer.NumStrips();
-        for (int x = 0; x < numStrips; x++)
-        {
-            int base = (x * num_leds);
-            // Step 1.  Cool down every cell a little
-            for (int i = 0; i < num_leds; i++)
+        buffer.ForEachRow([&](int led, uint32_t *pixels) {
+            const uint8_t *row = heat + (reverse ? num_leds - led - 1 : led) * numStrips;
+            for (int x = 0; x < numStrips; x++)
             {
-                int index = base + i;
-                auto cool = random(0, ((cooling * 10) / num_leds) + 2);
-                auto v = heat[index] - cool;
-                if (v < 0)
-                    v = 0;
-                heat[index] = v;
+                pixels[x] = palette[row[x]];
             }
+        });
+        Draw();
+        return false; // runs forever
+    }
 
-            // Step 2.  Heat from each cell drifts 'up' and diffuses a little
-            for (int i = num_leds - 1; i >= 2; i--)
-            {
-                int index = base + i;
-                auto convection = (heat[index - 1] + heat[index - 2] + heat[index - 2]) / 3;
-                if (convection > 255)
-                    convection = 255;
-                heat[index] = convection;
-            }
+    // One step of the fire.
+    void Simulate()
+    {
+        // The heat cells are laid out like the pixels, a row of cells is the same height on
+        // every strip, so each step runs through the cells in memory order.
+        int num_leds = buffer.NumLedsPerStrip();
+        int numStrips = buffer.NumStrips();
+        int count = num_leds * numStrips;
+
+        // Step 1.  Cool down every cell a little
+        uint32_t maxCool = ((cooling * 10) / num_leds) + 2;
+        for (int index = 0; index < count; index++)
+        {
+            int v = heat[index] - (int)random.Below(maxCool + 1);
+            heat[index] = (uint8_t)(v < 0 ? 0 : v);
+        }
 
-            // Step 3.  Randomly ignite new 'sparks' of heat near the bottom
-            if (random(0, 255) < sparkling)
+        // Step 2.  Heat from each cell drifts 'up' and diffuses a little, the average of three
+        // cells is never more than 255.
+        for (int i = num_leds - 1; i >= 2; i--)
+        {
+            uint8_t *row = heat + i * numStrips;
+            const uint8_t *below1 = row - numStrips;
+            const uint8_t *below2 = below1 - numStrips;
+            for (int x = 0; x < numStrips; x++)
             {
-                int i = (int)random(0, 7);
-                int index = base + i;
-                auto v = heat[index] + random(160, 255);
-                if (v > 255)
-                    v = 255;
-                heat[index] = v;
+                row[x] = (uint8_t)((below1[x] + below2[x] + below2[x]) / 3);
             }
+        }
 
-            // Step 4.  Map from heat cells to LED colors
-            for (int i = 0; i < num_leds; i++)
+        // Step 3.  Randomly ignite new 'sparks' of heat near the bottom
+        for (int x = 0; x < numStrips; x++)
+        {
+            if (random.Byte() < sparkling)
             {
-                int index = base + i;
-                Color color = HeatColor(heat[index]);
-                buffer.SetPixel(color, x, reverse ? num_leds - i - 1 : i);
+                int i = (int)random.Below(7);
+                int index = i * numStrips + x;
+                int v = heat[index] + random.Range(160, 255);
+                heat[index] = (uint8_t)(v > 255 ? 255 : v);
             }
         }
-        Draw();
-        return false; // runs forever
     }
 
-    Color HeatColor(float temperature)
+    static Color HeatColor(uint8_t temperature)
     {
         Color heatcolor;
 
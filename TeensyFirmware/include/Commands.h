@@ -15,6 +15,8 @@
 #include "crc32.h"
 #include "String.h"
 #include "Status.h"
+#include "FrameArena.h"
+#include "EffectVM.h"
 
 enum class CommandType
 {
@@ -33,7 +35,14 @@ enum class CommandType
     Status,
     StartRain,
     StopRain,
-    Fire
+    Fire,
+    Brightness,
+    FrameRate,
+    Effect,
+    Timeline,
+    StopTimeline,
+    IndexedBuffer,
+    Palette
 };
 
 // Provides a wrapper on Commands parsed from the Serial port input.
@@ -52,13 +61,19 @@ public:
     int index = 0; // specify one led in the strip
     int colorsPerStrip = 0; // can optionally specify different colors per strip in Gradient command.
     SimpleString error;
-    // used by EncodedBuffer command.
+    // used by EncodedBuffer command, the pixels are a slot of the FrameArena.  The Timeline
+    // command keeps its cues there too and the IndexedBuffer command a byte per pixel.
+    FrameSlot pixelSlot;
     uint32_t* pixelBuffer = nullptr;
     uint32_t numStrips = 0;
     uint32_t ledsPerStrip = 0;
     uint32_t pixelsUsed = 0;
     float f1 = 0; // factor 1
     float f2 = 0; // factor 2
+    float f3 = 0; // factor 3
+    float f4 = 0; // factor 4
+    bool dither = false; // used by the Brightness command.
+    EffectProgram program; // used by the Effect command.
 
     Command()
     {
@@ -66,42 +81,52 @@ public:
 
     ~Command()
     {
-        if (pixelBuffer != nullptr) {
-            delete[] pixelBuffer;
+    }
+
+    // Moves the names, colors and the frame slot of the pixels instead of copying them.  The
+    // ReadState stays with the Command that reads the serial port.
+    Command(Command&& moved)
+    {
+        operator=(static_cast<Command&&>(moved));
+    }
+
+    Command& operator=(Command&& other)
+    {
+        if (this == &other)
+        {
+            return *this;
         }
+        copyParameters(other);
+        this->command = static_cast<SimpleString&&>(other.command);
+        this->error = static_cast<SimpleString&&>(other.error);
+        // swapped so both commands keep an allocation to parse the next colors into.
+        this->colors.swap(other.colors);
+        this->pixelSlot = static_cast<FrameSlot&&>(other.pixelSlot);
+        this->pixelBuffer = other.pixelBuffer;
+        this->pixelsUsed = other.pixelsUsed;
+        this->numStrips = other.numStrips;
+        this->ledsPerStrip = other.ledsPerStrip;
+        other.pixelBuffer = nullptr;
+        other.pixelsUsed = 0;
+        return *this;
     }
 
     Command& operator=(const Command& other)
     {
-        this->type = other.type;
+        copyParameters(other);
         this->command = other.command;
         this->colors = other.colors;
-        this->seconds = other.seconds;
-        this->iterations = other.iterations;
-        this->size = other.size;
-        this->strip = other.strip;
-        this->index = other.index;
-        this->colorsPerStrip = other.colorsPerStrip;
         this->error = other.error;
-        this->f1 = other.f1;
-        this->f2 = other.f2;
         if (other.pixelsUsed > 0)
         {
-            if (other.pixelsUsed > this->pixelsUsed)
+            pixelBuffer = pixelSlot.Acquire();
+            if (pixelBuffer == nullptr)
             {
-                if (pixelBuffer != nullptr)
-                {
-                    delete [] pixelBuffer;
-                    this->pixelsUsed = 0;
-                }
-                pixelBuffer = new uint32_t[other.pixelsUsed];
-                if (pixelBuffer == nullptr)
-                {
-                    CrashPrint("### Command: out of memory\r\n");
-                    return *this;
-                }
-                this->pixelsUsed = other.pixelsUsed;
+                CrashPrint("### Command: out of memory\r\n");
+                this->pixelsUsed = 0;
+                return *this;
             }
+            this->pixelsUsed = other.pixelsUsed;
             this->numStrips = other.numStrips;
             this->ledsPerStrip = other.ledsPerStrip;
             ::memcpy((void*)pixelBuffer, (void*)other.pixelBuffer, (size_t)(sizeof(uint32_t) * other.pixelsUsed));
@@ -109,6 +134,36 @@ public:
         return *this;
     }
 
+    // Hand the frame slot of the pixels to the caller so they are used where they are instead
+    // of being copied.  The next buffer this command parses acquires a new slot.
+    FrameSlot takePixels()
+    {
+        pixelBuffer = nullptr;
+        pixelsUsed = 0;
+        return static_cast<FrameSlot&&>(pixelSlot);
+    }
+
+    // Everything but the strings, colors and pixels.
+    void copyParameters(const Command& other)
+    {
+        this->type = other.type;
+        this->seconds = other.seconds;
+        this->iterations = other.iterations;
+        this->size = other.size;
+        this->strip = other.strip;
+        this->index = other.index;
+        this->colorsPerStrip = other.colorsPerStrip;
+        this->f1 = other.f1;
+        this->f2 = other.f2;
+        this->f3 = other.f3;
+        this->f4 = other.f4;
+        this->dither = other.dither;
+        if (other.type == CommandType::Effect)
+        {
+            this->program = other.program;
+        }
+    }
+
     void clearColors()
     {
         colors.clear();
@@ -131,26 +186,33 @@ public:
         index = 0;
         colorsPerStrip = 0;
         error = "";
-        // pixelBuffer: leave allocated so we can reuse it, which means we also need to
-        // keep numStrips and ledsPerPixel since those tell us the size of the allocated buffer.
+        // pixelBuffer: keep the frame slot so the next buffer reuses it.
         // numStrips = 0;
         // ledsPerStrip = 0;
         pixelsUsed = 0;
         f1 = 0;
         f2 = 0;
+        f3 = 0;
+        f4 = 0;
+        dither = false;
+        program.Clear();
     }
 
+    // The bytes read from the serial port wait in a ring until the state machine gets to them.
+    // readpos and writepos count every byte that went through it, so writepos - readpos is the
+    // number waiting and the position in the ring is the count masked by RingSize - 1.
     class ReadState
     {
     public:
-        uint32_t bufsize = 8000;
-        uint8_t buffer[8000];
+        static const uint32_t RingSize = 8192; // a power of 2
+        uint8_t buffer[RingSize];
         int header_pos = 0;
         uint32_t readpos = 0; // we're to read next char
         uint32_t writepos = 0; // we're to add the next chunk
         int readState = 0;
         uint32_t count = 0; // a state specific counter.
         uint32_t crc = 0;
+        uint32_t payloadCrc = 0; // of the payload bytes received so far, see crc32_update.
         uint32_t length = 0;
         uint32_t payloadSize = 0;
         uint8_t* payload = nullptr;
@@ -188,6 +250,117 @@ public:
             }
             return true;
         }
+
+        uint32_t used()
+        {
+            return writepos - readpos;
+        }
+
+        // The waiting bytes up to the end of the ring, n is how many.
+        const uint8_t* readSpan(uint32_t& n)
+        {
+            uint32_t index = readpos & (RingSize - 1);
+            n = used();
+            if (n > RingSize - index)
+            {
+                n = RingSize - index;
+            }
+            return &buffer[index];
+        }
+
+        // Read what fits in the free space up to the end of the ring, the rest waits for the
+        // next call.
+        void fill()
+        {
+            if (used() == 0)
+            {
+                // start at the beginning so the read isn't split.
+                readpos = writepos = 0;
+            }
+            uint32_t index = writepos & (RingSize - 1);
+            uint32_t space = RingSize - used();
+            if (space > RingSize - index)
+            {
+                space = RingSize - index;
+            }
+            if (space > 0)
+            {
+                writepos += Serial.readBytes((char*)&buffer[index], space);
+            }
+        }
+
+        // n more bytes of the payload are in place at payload + count.  The CRC takes them in
+        // while they are still in the cache, so it is ready when the last byte arrives.
+        void payloadReceived(uint32_t n)
+        {
+            payloadCrc = crc32_update(payloadCrc, &payload[count], n);
+            count += n;
+            if (count == length)
+            {
+                readState = 5;
+                crc = 0;
+                count = 0;
+            }
+        }
+
+        // Copy the payload bytes that are waiting in the ring in one go, up to the next '#' since
+        // that could be the start of a header.  Returns the number copied, 0 when the next byte
+        // has to go through the header matcher.
+        uint32_t copyPayload()
+        {
+            uint32_t n = 0;
+            const uint8_t* src = readSpan(n);
+            if (n > length - count)
+            {
+                n = length - count;
+            }
+            const uint8_t* hash = (const uint8_t*)::memchr(src, '#', n);
+            if (hash != nullptr)
+            {
+                n = (uint32_t)(hash - src);
+            }
+            ::memcpy(&payload[count], src, n);
+            readpos += n;
+            payloadReceived(n);
+            return n;
+        }
+
+        // Read the payload from the serial port straight into place when the ring is empty.
+        // Anything from a '#' on goes into the ring for the header matcher instead.
+        void readPayload()
+        {
+            uint32_t want = length - count;
+            if (want > RingSize)
+            {
+                want = RingSize;
+            }
+            uint8_t* dst = &payload[count];
+            uint32_t n = Serial.readBytes((char*)dst, want);
+            const uint8_t* hash = (const uint8_t*)::memchr(dst, '#', n);
+            uint32_t keep = hash != nullptr ? (uint32_t)(hash - dst) : n;
+            if (keep < n)
+            {
+                ::memcpy(buffer, hash, n - keep);
+                readpos = 0;
+                writepos = n - keep;
+            }
+            payloadReceived(keep);
+        }
+
+        // Skip the bytes before the next '#' while looking for a header, returns the number
+        // skipped.
+        uint32_t skipToHeader()
+        {
+            uint32_t n = 0;
+            const uint8_t* src = readSpan(n);
+            const uint8_t* hash = (const uint8_t*)::memchr(src, '#', n);
+            if (hash != nullptr)
+            {
+                n = (uint32_t)(hash - src);
+            }
+            readpos += n;
+            return n;
+        }
     };
 
     ReadState state;
@@ -198,41 +371,30 @@ public:
         state.readState = 0;
         while (Serial.available()){
             // flush the input back to empty so we sync up on the next command sent.
-            Serial.readBytes((char*)&state.buffer[0], state.bufsize);
+            Serial.readBytes((char*)&state.buffer[0], ReadState::RingSize);
         }
     }
 
     bool readNextCommand()
     {
         // Option for timout (disabled for now)
-        while (Serial.available() || state.readpos < state.writepos)
+        while (Serial.available() || state.used() > 0)
         {
             // readBytes can return incomplete buffers, so we have a full state machine
             // here that can read in the commands in whatever chunks we get.
-            if (state.writepos >= state.bufsize)
+            if (state.used() == 0)
             {
-                error = "### serial buffer overflow";
-                return true;
-            }
-
-            if (Serial.available())
-            {
-                if (state.readpos > 0)
+                if (state.readState == 4 && state.header_pos == 0)
                 {
-                    if (state.readpos < state.writepos) {
-                        ::memmove(state.buffer, &state.buffer[state.readpos], state.writepos - state.readpos);
-                        state.writepos -= state.readpos;
-                    } else {
-                        state.writepos = 0;
-                    }
-                    state.readpos = 0;
+                    state.readPayload();
+                }
+                else
+                {
+                    state.fill();
                 }
-
-                uint32_t bytesRead = Serial.readBytes((char*)&state.buffer[state.writepos], state.bufsize - state.writepos);
-                state.writepos += bytesRead;
             }
 
-            while (state.readpos < state.writepos)
+            while (state.used() > 0)
             {
                 // each record received starts with "##HEADER##", is followed by 4 byte integer which is the
                 // payload size, followed by that many bytes, and finishing with a CRC for the payload.
@@ -248,7 +410,21 @@ public:
                     state.readState = 1;
                 }
 
-                char ch = state.buffer[state.readpos++];
+                // the bytes that can't be part of a header are skipped or copied into the payload
+                // in bulk, only a '#' and what follows it go through the header matcher one at a time.
+                if (state.header_pos == 0)
+                {
+                    if (state.readState == 1 && state.skipToHeader() > 0)
+                    {
+                        continue;
+                    }
+                    if (state.readState == 4 && state.copyPayload() > 0)
+                    {
+                        continue;
+                    }
+                }
+
+                char ch = state.buffer[state.readpos++ & (ReadState::RingSize - 1)];
 
                 // now we always look for the header no matter what state we are in just in
                 // case we lose UART bits and a command is truncated by the next command we
@@ -267,7 +443,9 @@ public:
                         continue;
                     }
                 } else {
-                    state.header_pos = 0;
+                    // a '#' that doesn't continue the header can start the next one, after
+                    // "##" it is the second '#' of it.
+                    state.header_pos = ch != '#' ? 0 : (state.header_pos == 2 ? 2 : 1);
                 }
 
                 switch (state.readState)
@@ -304,6 +482,7 @@ public:
                     state.count++;
                     if (state.count == 4)
                     {
+                        state.payloadCrc = crc32_begin();
                         if (state.length < 50000)
                         {
                             if (state.length > 0)
@@ -336,13 +515,8 @@ public:
 
                 case 4:
                     // read the payload
-                    state.payload[state.count++] = ch;
-                    if (state.count == state.length)
-                    {
-                        state.readState = 5;
-                        state.crc = 0;
-                        state.count = 0;
-                    }
+                    state.payload[state.count] = ch;
+                    state.payloadReceived(1);
                     break;
 
                 case 5:
@@ -352,7 +526,7 @@ public:
                     if (state.count == 4)
                     {
                         // complete buffer !!
-                        uint32_t actual_crc = crc32(state.payload, state.length);
+                        uint32_t actual_crc = crc32_end(state.payloadCrc);
                         if (state.crc == actual_crc)
                         {
                             // buffer is good!
@@ -472,6 +646,41 @@ public:
             type = CommandType::StartRain;
             return parseStartRain(payload, length);
         }
+        else if (command == "FrameRate")
+        {
+            type = CommandType::FrameRate;
+            return parseFrameRate(payload, length);
+        }
+        else if (command == "Brightness")
+        {
+            type = CommandType::Brightness;
+            return parseBrightness(payload, length);
+        }
+        else if (command == "Effect")
+        {
+            type = CommandType::Effect;
+            return parseEffect(payload, length);
+        }
+        else if (command == "Timeline")
+        {
+            type = CommandType::Timeline;
+            return parseTimeline(payload, length);
+        }
+        else if (command == "StopTimeline")
+        {
+            type = CommandType::StopTimeline;
+            return true;
+        }
+        else if (command == "IndexedBuffer")
+        {
+            type = CommandType::IndexedBuffer;
+            return parseIndexedBuffer(payload, length);
+        }
+        else if (command == "Palette")
+        {
+            type = CommandType::Palette;
+            return parsePalette(payload, length);
+        }
         else
         {
             type = CommandType::None;
@@ -520,8 +729,8 @@ public:
                 return false;
             }
 
-            // set to black.
-            ::memset(pixelBuffer, 0, sizeof(uint32_t) * numPixels);
+            // set to black, the whole slot since it may become the display buffer.
+            ::memset(pixelBuffer, 0, sizeof(uint32_t) * FrameArena::Pixels);
             pixelsUsed = numPixels;
 
             uint32_t strip = 0;
@@ -564,21 +773,21 @@ public:
 
     bool allocatePixelBuffer(uint32_t numStrips, uint32_t ledsPerStrip)
     {
-        if (numStrips != this->numStrips || ledsPerStrip != this->ledsPerStrip)
+        // the slot is kept from one buffer to the next, it holds a frame of any shape up to the
+        // size of the LEDLayout.
+        if (numStrips > 0 && ledsPerStrip > FrameArena::Pixels / numStrips)
         {
-            if (pixelBuffer != nullptr) {
-                delete[] pixelBuffer;
-            }
-            uint32_t numPixels = numStrips * ledsPerStrip;
-            pixelBuffer = new uint32_t[numPixels];
-            if (pixelBuffer == nullptr)
-            {
-                error = "out of memory";
-                return false;
-            }
-            this->numStrips = numStrips;
-            this->ledsPerStrip = ledsPerStrip;
+            error = "too many pixels";
+            return false;
         }
+        pixelBuffer = pixelSlot.Acquire();
+        if (pixelBuffer == nullptr)
+        {
+            error = "out of memory";
+            return false;
+        }
+        this->numStrips = numStrips;
+        this->ledsPerStrip = ledsPerStrip;
         return true;
     }
 
@@ -596,17 +805,18 @@ public:
             {
                 return false;
             }
-            // set to black.
             uint32_t numPixels = numStrips * ledsPerStrip;
-            ::memset(pixelBuffer, 0, sizeof(uint32_t) * numPixels);
             pixelsUsed = numPixels;
 
-            uint32_t remainder = length - position;
+            uint32_t remainder = (length - position) / sizeof(uint32_t);
             if (remainder > numPixels)
             {
                 remainder = numPixels;
             }
+            // the pixels are written once, straight into the slot that becomes the cross fade
+            // target or the display buffer (see takePixels), and the rest of it is set to black.
             ::memcpy(pixelBuffer, &payload[position], sizeof(uint32_t) * remainder);
+            ::memset(pixelBuffer + remainder, 0, sizeof(uint32_t) * (FrameArena::Pixels - remainder));
             return true;
         }
         else
@@ -616,6 +826,73 @@ public:
         return false;
     }
 
+    bool parseIndexedBuffer(uint8_t* payload, uint32_t length)
+    {
+        // a byte per pixel in the same order as the FullBuffer, each one an entry of the Palette.
+        // The palette can come with it, the colors are the first entries and the rest are kept.
+        uint32_t position = 0;
+        if (position + 16 <= length)
+        {
+            uint32_t numStrips = readInt32(&payload[position]);
+            uint32_t ledsPerStrip = readInt32(&payload[position + 4]);
+            seconds = readFloat(&payload[position + 8]);
+            uint32_t paletteSize = readUInt32(&payload[position + 12]);
+            position += 16;
+            if (paletteSize > 256 || paletteSize * sizeof(uint32_t) > length - position)
+            {
+                error = "IndexedBuffer: bad palette";
+                return false;
+            }
+            parseColors(&payload[position], paletteSize * sizeof(uint32_t));
+            position += paletteSize * sizeof(uint32_t);
+            if (!allocatePixelBuffer(numStrips, ledsPerStrip))
+            {
+                return false;
+            }
+            // missing indices are entry 0.
+            uint32_t numPixels = numStrips * ledsPerStrip;
+            uint8_t* indices = reinterpret_cast<uint8_t*>(pixelBuffer);
+            uint32_t remainder = length - position;
+            if (remainder > numPixels)
+            {
+                remainder = numPixels;
+            }
+            ::memcpy(indices, &payload[position], remainder);
+            ::memset(indices + remainder, 0, numPixels - remainder);
+            pixelsUsed = (numPixels + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+            size = numPixels;
+            return true;
+        }
+        else
+        {
+            error = "IndexedBuffer: missing parameters";
+        }
+        return false;
+    }
+
+    bool parsePalette(uint8_t* payload, uint32_t length)
+    {
+        // parse the fade seconds, the cycle speed, first entry and count, then the colors
+        // starting at the given entry.
+        uint32_t position = 0;
+        if (position + 20 <= length)
+        {
+            seconds = readFloat(&payload[position]);
+            f1 = readFloat(&payload[position + 4]);
+            index = readInt32(&payload[position + 8]);
+            size = readUInt32(&payload[position + 12]);
+            strip = readInt32(&payload[position + 16]);
+            position += 20;
+            parseColors(&payload[position], length - position);
+            return true;
+        }
+        else
+        {
+            error = "Palette: missing parameters";
+        }
+        return false;
+    }
+
     bool parseGradient(uint8_t* payload, uint32_t length)
     {
         // parse seconds
@@ -647,7 +924,7 @@ public:
 
     bool parseMovingGradient(uint8_t* payload, uint32_t length)
     {
-        // parse speed, direction, size and colors.
+        // parse speed (LEDs per second), direction, size and colors.
         uint32_t position = 0;
         if (position + 16 <= length) {
             seconds = readFloat(&payload[position]);
@@ -710,6 +987,111 @@ public:
         return false;
     }
 
+    bool parseFrameRate(uint8_t* payload, uint32_t length)
+    {
+        // parse frames per second, zero means run the frames as fast as possible.
+        uint32_t position = 0;
+        if (position + 4 <= length) {
+            f1 = readFloat(&payload[position]);
+            if (!(f1 >= 0 && f1 <= 1000))
+            {
+                error = "FrameRate: invalid parameter";
+                return false;
+            }
+            return true;
+        }
+        else
+        {
+            error = "FrameRate: missing parameters";
+        }
+        return false;
+    }
+
+    bool parseBrightness(uint8_t* payload, uint32_t length)
+    {
+        // parse brightness, gamma for red, green and blue, and dithering on/off.
+        uint32_t position = 0;
+        if (position + 20 <= length) {
+            f1 = readFloat(&payload[position]);
+            f2 = readFloat(&payload[position + 4]);
+            f3 = readFloat(&payload[position + 8]);
+            f4 = readFloat(&payload[position + 12]);
+            dither = readUInt32(&payload[position + 16]) != 0;
+            if (!(f1 >= 0 && f1 <= 1) || !(f2 > 0 && f2 <= 5) || !(f3 > 0 && f3 <= 5) || !(f4 > 0 && f4 <= 5))
+            {
+                error = "Brightness: invalid parameter";
+                return false;
+            }
+            return true;
+        }
+        else
+        {
+            error = "Brightness: missing parameters";
+        }
+        return false;
+    }
+
+    bool parseEffect(uint8_t* payload, uint32_t length)
+    {
+        // parse seconds, flags (1 runs the program per pixel), the number of parameters, the
+        // parameters and then the program.
+        uint32_t position = 0;
+        if (position + 12 <= length) {
+            seconds = readFloat(&payload[position]);
+            uint32_t flags = readUInt32(&payload[position + 4]);
+            uint32_t numParams = readUInt32(&payload[position + 8]);
+            position += 12;
+            if (numParams > (uint32_t)EffectProgram::MaxParams || position + numParams * 4 > length)
+            {
+                error = "Effect: invalid parameters";
+                return false;
+            }
+            uint32_t codeStart = position + numParams * 4;
+            if (!program.Load(&payload[codeStart], length - codeStart, (flags & 1) != 0))
+            {
+                error = "Effect: ";
+                error += program.GetError();
+                return false;
+            }
+            for (uint32_t i = 0; i < numParams; i++)
+            {
+                program.SetParam(i, (int32_t)readUInt32(&payload[position + i * 4]));
+            }
+            return true;
+        }
+        else
+        {
+            error = "Effect: missing parameters";
+        }
+        return false;
+    }
+
+    bool parseTimeline(uint8_t* payload, uint32_t length)
+    {
+        // the cues are checked when the Controller loads them (see Timeline), here they are
+        // kept as they are with size the number of bytes.
+        if (length < 8)
+        {
+            error = "Timeline: missing parameters";
+            return false;
+        }
+        if (length > FrameArena::Pixels * sizeof(uint32_t))
+        {
+            error = "Timeline: too long";
+            return false;
+        }
+        pixelBuffer = pixelSlot.Acquire();
+        if (pixelBuffer == nullptr)
+        {
+            error = "out of memory";
+            return false;
+        }
+        ::memcpy(pixelBuffer, payload, length);
+        pixelsUsed = (length + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+        size = length;
+        return true;
+    }
+
     bool parseWaterDrop(uint8_t* payload, uint32_t length)
     {
         // parse seconds, and number of colors.
@@ -842,23 +1224,29 @@ public:
         return colors.size() > 0;
     }
 
-    uint32_t readUInt32(uint8_t* payload)
+    // The values can be at any offset (the payloads of the Timeline cues are packed), and an
+    // unaligned float or LDRD load faults on the Cortex-M7, so they are read with memcpy, which
+    // the compiler turns into the loads that are safe for the target.
+    uint32_t readUInt32(const uint8_t* payload)
     {
-        uint32_t* ptr = (uint32_t*)payload;
-        return *ptr;
+        uint32_t value;
+        ::memcpy(&value, payload, sizeof(value));
+        return value;
     }
 
-    int readInt32(uint8_t* payload)
+    int readInt32(const uint8_t* payload)
     {
-        int * ptr = (int*)payload;
-        return *ptr;
+        int value;
+        ::memcpy(&value, payload, sizeof(value));
+        return value;
     }
 
-    float readFloat(uint8_t* payload)
+    float readFloat(const uint8_t* payload)
     {
         // let's hope the bytes are in the same order...
-        float* ptr = (float*)payload;
-        return *ptr;
+        float value;
+        ::memcpy(&value, payload, sizeof(value));
+        return value;
     }
 
 };
@@ -0,0 +1,229 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#ifndef _COMPOSITOR_H
+#define _COMPOSITOR_H
+
+#include <stdint.h>
+#include <string.h>
+#include "PixelBuffer.h"
+#include "PixelKernels.h"
+#include "Vector.h"
+#include "FrameScheduler.h"
+
+class Compositor;
+
+enum class BlendMode
+{
+    Replace,    // the layer color
+    Add,        // the layer color added to what is under it, saturating
+    Alpha,      // the layer color over what is under it with the layer opacity
+    Max         // the brighter of the layer color and what is under it
+};
+
+// What a layer of the Compositor draws, once per frame.
+class LayerSource
+{
+public:
+    virtual ~LayerSource() {}
+
+    // Move the layer on by the elapsed seconds since it was last drawn and draw it with the
+    // compositor's Fill() and Blend().
+    virtual void RenderLayer(Compositor& compositor, float elapsed) = 0;
+};
+
+// Draws a stack of layers on top of the frame in the PixelBuffer each time it is written.
+// The bottom layer is whatever the current animation draws in the buffer, every layer above it
+// only draws the spans it touches, blended with its BlendMode.  The rows a layer draws over are
+// saved first and put back once the frame is presented, so the animation underneath never sees
+// the layers and nothing has to keep a snapshot of the whole frame.
+class Compositor : public FrameOverlay
+{
+    struct Layer
+    {
+        LayerSource* source;
+        BlendMode mode;
+        uint32_t opacity; // 0-256
+    };
+
+    static const int MaskWords = (LEDLayout::LedsPerStrip + 31) / 32;
+
+public:
+    static const int MaxLayers = 8;
+
+private:
+    PixelBuffer& buffer;
+    StaticVector<Layer, MaxLayers> layers;
+    StaticVector<int, LEDLayout::LedsPerStrip> savedRows; // rows drawn over this frame, in the order they were saved
+    Vector<uint32_t> saved;     // the pixels of those rows before the layers drew on them
+    uint32_t savedMask[MaskWords];
+    Layer current = {};         // the layer being rendered
+    FrameClock clock;           // the layers move with the time between the frames they are drawn on
+
+public:
+    Compositor(PixelBuffer& buffer) : buffer(buffer)
+    {
+        ::memset(savedMask, 0, sizeof(savedMask));
+    }
+
+    ~Compositor()
+    {
+        Clear();
+    }
+
+    // Add a layer on top of the others, the compositor owns the source from now on.
+    void AddLayer(LayerSource* source, BlendMode mode, float opacity = 1)
+    {
+        if (source == nullptr)
+        {
+            return;
+        }
+        if (layers.size() == 0)
+        {
+            clock.Reset();
+        }
+        if (!layers.push_back(Layer{ source, mode, PixelKernels::Fraction(opacity) }))
+        {
+            CrashPrint("### Compositor: more than %d layers\r\n", MaxLayers);
+            delete source;
+        }
+    }
+
+    // Remove a layer (0 is the bottom) and return its source, which the caller then owns.
+    LayerSource* RemoveLayer(int index)
+    {
+        if (index < 0 || index >= (int)layers.size())
+        {
+            return nullptr;
+        }
+        LayerSource* source = layers[index].source;
+        layers.erase(index);
+        return source;
+    }
+
+    LayerSource* GetLayer(int index) { return layers[index].source; }
+    BlendMode GetBlendMode(int index) { return layers[index].mode; }
+    int NumLayers() { return (int)layers.size(); }
+
+    void Clear()
+    {
+        while (layers.size() > 0)
+        {
+            delete RemoveLayer((int)layers.size() - 1);
+        }
+    }
+
+    void Compose() override
+    {
+        float elapsed = clock.Tick();
+        for (size_t i = 0; i < layers.size(); i++)
+        {
+            current = layers[i];
+            current.source->RenderLayer(*this, elapsed);
+        }
+    }
+
+    void Restore() override
+    {
+        int numStrips = buffer.NumStrips();
+        for (size_t i = 0; i < savedRows.size(); i++)
+        {
+            ::memcpy(buffer.GetRow(savedRows[i]), &saved[i * numStrips], numStrips * sizeof(uint32_t));
+        }
+        savedRows.clear();
+        saved.clear();
+        ::memset(savedMask, 0, sizeof(savedMask));
+    }
+
+    // Draw count pixels of one color on an LED row starting at strip, with the blend mode of
+    // the layer being rendered.  alpha (0-256) fades this span on top of the layer opacity.
+    void Fill(int row, int strip, int count, uint32_t color, uint32_t alpha = PixelKernels::One)
+    {
+        uint32_t* pixels = Span(row, strip, count);
+        if (pixels == nullptr)
+        {
+            return;
+        }
+        uint32_t t = (current.opacity * alpha) >> 8;
+        switch (current.mode)
+        {
+        case BlendMode::Replace:
+            for (int i = 0; i < count; i++)
+                pixels[i] = color;
+            break;
+        case BlendMode::Add:
+            PixelKernels::AddSpan(pixels, pixels, count, PixelKernels::Scale(color, t));
+            break;
+        case BlendMode::Alpha:
+            for (int i = 0; i < count; i++)
+                pixels[i] = PixelKernels::Lerp(pixels[i], color, t);
+            break;
+        case BlendMode::Max:
+            color = PixelKernels::Scale(color, t);
+            for (int i = 0; i < count; i++)
+                pixels[i] = PixelKernels::Max(pixels[i], color);
+            break;
+        }
+    }
+
+    // Draw count pixels of colors on an LED row starting at strip, with the blend mode of the
+    // layer being rendered.
+    void Blend(int row, int strip, const uint32_t* colors, int count)
+    {
+        uint32_t* pixels = Span(row, strip, count);
+        if (pixels == nullptr)
+        {
+            return;
+        }
+        uint32_t t = current.opacity;
+        switch (current.mode)
+        {
+        case BlendMode::Replace:
+            ::memcpy(pixels, colors, count * sizeof(uint32_t));
+            break;
+        case BlendMode::Add:
+            for (int i = 0; i < count; i++)
+                pixels[i] = PixelKernels::AddSaturate(pixels[i], PixelKernels::Scale(colors[i], t));
+            break;
+        case BlendMode::Alpha:
+            PixelKernels::BlendSpan(pixels, colors, count, t);
+            break;
+        case BlendMode::Max:
+            for (int i = 0; i < count; i++)
+                pixels[i] = PixelKernels::Max(pixels[i], PixelKernels::Scale(colors[i], t));
+            break;
+        }
+    }
+
+    // The number of rows saved from under the layers this frame.
+    int GetSavedRows() { return (int)savedRows.size(); }
+
+private:
+    // The pixels of a span that is about to be drawn over, clipped to the buffer, after saving
+    // the row the first time a layer touches it this frame.
+    uint32_t* Span(int row, int strip, int& count)
+    {
+        int numStrips = buffer.NumStrips();
+        if (row < 0 || row >= buffer.NumLedsPerStrip() || strip < 0 || strip >= numStrips)
+        {
+            return nullptr;
+        }
+        if (count > numStrips - strip)
+        {
+            count = numStrips - strip;
+        }
+        uint32_t* pixels = buffer.GetRow(row);
+        uint32_t bit = 1u << (row & 31);
+        if ((savedMask[row >> 5] & bit) == 0)
+        {
+            savedMask[row >> 5] |= bit;
+            savedRows.push_back(row);
+            for (int i = 0; i < numStrips; i++)
+            {
+                saved.push_back(pixels[i]);
+            }
+        }
+        return pixels + strip;
+    }
+};
+
+#endif
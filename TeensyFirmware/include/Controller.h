@@ -6,21 +6,32 @@
 #include "PixelBuffer.h"
 #include "Commands.h"
 #include "Animations.h"
+#include "FrameScheduler.h"
+#include "Compositor.h"
+#include "Timeline.h"
+#include "Palette.h"
 
 class Controller;
 
 void StartThread(Controller* ptr);
 
+// Runs the commands.  The current animation draws the frames and the layers of the compositor
+// (like the rain) are drawn on top of them, the layers keep running when the animation changes.
 class Controller
 {
     PixelBuffer buffer;
     Command currentCommand;
     Animation* animation = nullptr;
+    Compositor compositor;
+    FrameScheduler scheduler;
+    FrameClock clock; // the time between the frames of the animation
+    Timeline timeline;
+    Palette palette; // the colors of the IndexedBuffer frames
 
 public:
-    Controller(int numStrips, int ledsPerStrip)
-        : buffer(numStrips, ledsPerStrip)
+    Controller() : compositor(buffer)
     {
+        buffer.SetOverlay(&compositor);
     }
 
     void Initialize()
@@ -29,6 +40,10 @@ public:
     }
 
     PixelBuffer& GetBuffer() { return buffer; }
+    FrameScheduler& GetScheduler() { return scheduler; }
+    Compositor& GetCompositor() { return compositor; }
+    Timeline& GetTimeline() { return timeline; }
+    Palette& GetPalette() { return palette; }
 
     Command& GetCommand()
     {
@@ -37,7 +52,7 @@ public:
 
     bool HasAnimation()
     {
-        return animation != nullptr;
+        return animation != nullptr || compositor.NumLayers() > 0;
     }
 
     // returns true when command is complete.
@@ -45,37 +60,46 @@ public:
     {
         if (animation != nullptr)
         {
-            if (animation->Run())
+            if (animation->Run(clock.Tick()))
             {
-				// keep the overlay running.
-				Animation* overlay = nullptr;
-				if (animation != nullptr)
-				{
-					overlay = animation->RemoveOverlay();
-				}
                 // it is complete
 				animation->Stop();
                 delete animation;
                 animation = nullptr;
-				if (overlay != nullptr)
-				{
-					animation = new CopySourceAnimation(buffer);
-					if (animation == nullptr)
-					{
-						CrashPrint("### CopySourceAnimation: out of memory\r\n");
-						delete overlay;
-					}
-					else
-					{
-						animation->AddOverlay(overlay);
-					}
-				}
                 return true;
             }
         }
+        else if (compositor.NumLayers() > 0)
+        {
+            // nothing is drawing underneath, keep the layers running over the last frame.
+            buffer.Write();
+        }
         return false;
     }
 
+    // Start the cues of the timeline that are due, this is called between the frames as often
+    // as the commands are read so the cues start on time.  Each cue runs like a command that
+    // was just received.
+    void RunTimeline()
+    {
+        SimpleString name;
+        uint8_t* payload = nullptr;
+        uint32_t length = 0;
+        while (timeline.NextCue(name, payload, length))
+        {
+            currentCommand.reset();
+            currentCommand.command = name;
+            if (currentCommand.parseCommand(name, payload, length))
+            {
+                StartCommand();
+            }
+            else
+            {
+                CrashPrint("### Timeline cue %s: %s\r\n", name.c_str(), currentCommand.error.c_str());
+            }
+        }
+    }
+
     void Close()
     {
         StopCommand();
@@ -142,6 +166,14 @@ public:
         StartCommand();
     }
 
+    // Start a command that was just read, its names, colors and pixels move into the current
+    // command instead of being copied.
+    void StartCommand(Command&& cmd)
+    {
+        this->currentCommand = static_cast<Command&&>(cmd);
+        StartCommand();
+    }
+
     void StartCommand()
     {
         // process overlay commands before stopping anything
@@ -149,38 +181,23 @@ public:
         {
             case CommandType::StartRain:
             {
-                if (animation == nullptr) {
-                    // then create a copy source animation that runs forever that keeps refreshing the background
-                    // so that the animation can run on top of that.
-                    animation = new CopySourceAnimation(buffer);
-                    if (animation == nullptr)
-                    {
-                        CrashPrint("### StartRain: out of memory\r\n");
-                    }
+                // the rain is a layer on top of whatever animation is running, it replaces any
+                // rain that is already falling.
+                RemoveLayers(AnimationType::Rain);
+                auto rain = new RainOverlayAnimation(buffer, currentCommand.size, currentCommand.f1);
+                if (rain == nullptr)
+                {
+                    CrashPrint("### StartRain: out of memory\r\n");
                 }
-                if (animation != nullptr)
+                else
                 {
-                    auto overlay = new RainOverlayAnimation(buffer, currentCommand.size, currentCommand.f1);
-                    if (overlay == nullptr)
-                    {
-                        CrashPrint("### StartRain: out of memory2\r\n");
-                    }
-                    else
-                    {
-                        animation->AddOverlay(overlay);
-                    }
+                    compositor.AddLayer(rain, BlendMode::Add);
                 }
                 return;
             }
             case CommandType::StopRain:
             {
-                if (animation != nullptr) {
-                    Animation* overlay = animation->RemoveOverlay();
-                    if (overlay != nullptr)
-                    {
-                        delete overlay;
-                    }
-                }
+                RemoveLayers(AnimationType::Rain);
                 return;
             }
             case CommandType::Status:
@@ -188,16 +205,49 @@ public:
                 QueryStatus();
                 return;
             }
+            case CommandType::FrameRate:
+            {
+                scheduler.SetFps(currentCommand.f1);
+                return;
+            }
+            case CommandType::Timeline:
+            {
+                // the timeline plays over whatever is running until its first cue.
+                const char* rc = timeline.Load(currentCommand.takePixels(), currentCommand.size);
+                if (rc != nullptr)
+                {
+                    currentCommand.error = "Timeline: ";
+                    currentCommand.error += rc;
+                    CrashPrint("### %s\r\n", currentCommand.error.c_str());
+                }
+                return;
+            }
+            case CommandType::StopTimeline:
+            {
+                timeline.Stop();
+                return;
+            }
+            case CommandType::Palette:
+            {
+                // the frame that is showing changes color, see IndexedAnimation.
+                SetPalette(currentCommand.strip, currentCommand.colors, currentCommand.seconds);
+                palette.SetCycle(currentCommand.index, (int)currentCommand.size, currentCommand.f1);
+                return;
+            }
+            case CommandType::Brightness:
+            {
+                // applies to whatever is showing, the animation keeps running.
+                buffer.SetColorCorrection(currentCommand.f1, currentCommand.f2, currentCommand.f3, currentCommand.f4, currentCommand.dither);
+                if (animation == nullptr)
+                {
+                    buffer.Write();
+                }
+                return;
+            }
             default:
                 break;
         }
 
-        Animation* overlay = nullptr;
-        if (animation != nullptr)
-        {
-            overlay = animation->RemoveOverlay();
-        }
-
         // gradient command is additive.
         if (currentCommand.type == CommandType::Gradient) {
             GradientAnimation* grad = nullptr;
@@ -222,14 +272,10 @@ public:
                     int numStrips = buffer.NumStrips();
                     int offset = 0;
                     int num = (int)currentCommand.colors.size();
-                    Vector<Color> split;
                     for (int i = 0; i < numStrips && offset < num; i++) {
-                        split.clear();
-                        for (int j = 0; j < currentCommand.colorsPerStrip && offset < num; j++) {
-                            split.push_back(currentCommand.colors[offset]);
-                            offset++;
-                        }
-                        grad->AddStrip(i, split, currentCommand.seconds);
+                        int count = currentCommand.colorsPerStrip < num - offset ? currentCommand.colorsPerStrip : num - offset;
+                        grad->AddStrip(i, &currentCommand.colors[offset], count, currentCommand.seconds);
+                        offset += count;
                     }
                 }
                 else {
@@ -260,7 +306,8 @@ public:
                     }
                     else
                     {
-                        animation = new CrossFadeToAnimation(buffer, currentCommand.pixelBuffer, size, currentCommand.seconds);
+                        // the animation owns the pixels from here on, see CrossFadeToAnimation.
+                        animation = new CrossFadeToAnimation(buffer, currentCommand.takePixels(), currentCommand.seconds);
                         if (animation == nullptr)
                         {
                             CrashPrint("### FullBuffer: out of memory");
@@ -272,6 +319,18 @@ public:
                 }
                 break;
 
+            case CommandType::IndexedBuffer:
+                if (currentCommand.pixelBuffer != nullptr)
+                {
+                    SetPalette(0, currentCommand.colors, 0);
+                    animation = new IndexedAnimation(buffer, palette, currentCommand.takePixels(), currentCommand.size, currentCommand.seconds);
+                    if (animation == nullptr)
+                    {
+                        CrashPrint("### IndexedBuffer: out of memory\r\n");
+                    }
+                }
+                break;
+
             case CommandType::Breathe:
                 animation = new BreatheAnimation(buffer, currentCommand.seconds, currentCommand.f1, currentCommand.f2);
                 if (animation == nullptr)
@@ -325,6 +384,13 @@ public:
                     CrashPrint("Fire: out of memory\r\n");
                 }
                 break;
+            case CommandType::Effect:
+                animation = new EffectAnimation(buffer, currentCommand.program, currentCommand.seconds);
+                if (animation == nullptr)
+                {
+                    CrashPrint("### Effect: out of memory\r\n");
+                }
+                break;
             case CommandType::Twinkle:
                 if (currentCommand.colors.size() > 1)
                 {
@@ -345,27 +411,6 @@ public:
             default:
                 break;
         }
-
-        // maintain the existing overlay even when underlying animation switches out.
-        if (overlay != nullptr)
-        {
-            if (animation == nullptr)
-            {
-				animation = new CopySourceAnimation(buffer);
-				if (animation == nullptr)
-				{
-					CrashPrint("### StartRain: out of memory\r\n");
-				}
-            }
-			if (animation != nullptr)
-            {
-				animation->AddOverlay(overlay);
-            }
-			else
-			{
-				delete overlay;
-			}
-        }
     }
 
     void PrintStatus(){
@@ -377,6 +422,11 @@ private:
     void QueryStatus()
     {
         buffer.PrintStatus();
+        DebugPrint("Status draws=%d, fps=%u, frame=%u cycles, setup=%u/%u cycles, latch wait=%u cycles, missed=%u\r\n",
+            gTeensyStatus.draws, gTeensyStatus.fps, gTeensyStatus.frameCycles, gTeensyStatus.setupCycles,
+            gTeensyStatus.setupBudget, gTeensyStatus.latchWaitCycles, gTeensyStatus.missedDeadlines);
+        DebugPrint("Status target fps=%.2f, frames=%u, overruns=%u\r\n", scheduler.GetFps(), scheduler.GetFrames(), scheduler.GetOverruns());
+        DebugPrint("Status frame slots=%u of %d, high water=%u\r\n", gTeensyStatus.frameSlots, FrameArena::Slots, gTeensyStatus.frameSlotsHighWater);
         if (currentCommand.error.size() > 0)
         {
             DebugPrint("%s\r\n", currentCommand.error.c_str());
@@ -389,10 +439,26 @@ private:
         if (animation != nullptr)
         {
             DebugPrint("Animation: %s\r\n", animation->GetName().c_str());
-            Animation* overlay = animation->GetOverlay();
-            if (overlay != nullptr)
+        }
+        if (timeline.IsPlaying())
+        {
+            DebugPrint("Timeline: %d cues, %s, loops=%u\r\n", timeline.NumCues(), timeline.IsLooping() ? "looping" : "once", timeline.GetLoops());
+        }
+        for (int i = 0; i < compositor.NumLayers(); i++)
+        {
+            Animation* layer = static_cast<Animation*>(compositor.GetLayer(i));
+            DebugPrint("Layer %d: %s\r\n", i + 1, layer->GetName().c_str());
+        }
+    }
+
+    // The controller only puts animations on the compositor.
+    void RemoveLayers(AnimationType type)
+    {
+        for (int i = compositor.NumLayers() - 1; i >= 0; i--)
+        {
+            if (static_cast<Animation*>(compositor.GetLayer(i))->GetType() == type)
             {
-                DebugPrint("Overlay animation: %s\r\n", overlay->GetName().c_str());
+                delete compositor.RemoveLayer(i);
             }
         }
     }
@@ -405,6 +471,27 @@ private:
             delete animation;
             animation = nullptr;
         }
+        // the next animation starts from its first frame.
+        clock.Reset();
+    }
+
+    void SetPalette(int first, const Vector<Color>& colors, float seconds)
+    {
+        int count = (int)colors.size();
+        if (count == 0)
+        {
+            return;
+        }
+        uint32_t values[Palette::Size];
+        if (count > Palette::Size)
+        {
+            count = Palette::Size;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            values[i] = colors[i].pack();
+        }
+        palette.Set(first, values, count, seconds);
     }
 
     void InternalSetColor(Color color, int strip, int index)
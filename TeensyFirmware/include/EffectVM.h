@@ -0,0 +1,458 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#ifndef _EFFECTVM_H
+#define _EFFECTVM_H
+
+#include <stdint.h>
+#include <string.h>
+#include "PixelKernels.h"
+#include "LookupTables.h"
+
+// The instructions of an effect program, one byte each followed by their immediate bytes
+// (little endian).  Values are 32 bit integers, fractions are 0-256 like the PixelKernels and
+// colors are packed 0x00GGRRBB pixels.
+enum class EffectOp : uint8_t
+{
+    End,        // pop the color of the pixel
+    Push8,      // push a signed 8 bit immediate
+    Push16,     // push a signed 16 bit immediate
+    Push32,     // push a 32 bit immediate
+    Strip,      // push the strip of the pixel, 0 when the program runs per row
+    Led,        // push the LED of the pixel on its strip
+    Strips,     // push the number of strips
+    Leds,       // push the number of LEDs per strip
+    Time,       // push the milliseconds since the effect started
+    Param,      // push parameter n (8 bit immediate)
+    Load,       // push register n (8 bit immediate)
+    Store,      // pop into register n (8 bit immediate)
+    Dup,
+    Drop,
+    Swap,
+    Add,
+    Sub,
+    Mul,
+    MulQ8,      // a * b / 256, for the 0-256 fractions
+    Div,        // a / b, 0 when b is 0
+    Mod,        // a % b, 0 when b is 0
+    Neg,
+    Abs,
+    Min,
+    Max,
+    And,
+    Or,
+    Xor,
+    Shl,        // a << (b & 31)
+    Shr,        // a >> (b & 31), keeping the sign
+    Less,       // 1 when a < b, otherwise 0
+    Equal,      // 1 when a == b, otherwise 0
+    Jz,         // pop, skip ahead n bytes (8 bit immediate) when it is 0
+    Jmp,        // skip ahead n bytes (8 bit immediate)
+    Sin,        // sin of a 16 bit phase (65536 is one period) as -256 to 256
+    Hue,        // the fully saturated color of a hue, 0-255 around the wheel
+    Rgb,        // the color of red, green and blue, 0-255 each (clamped)
+    Lerp,       // color a + (color b - color a) * t / 256
+    Scale,      // a color times s / 256
+    AddColor,   // two colors added, saturating
+    Count
+};
+
+// A small effect program sent by the RpiController that the EffectAnimation evaluates for every
+// LED row (or every pixel) of every frame, so new effects don't need a new animation and a
+// firmware update, and don't need the bandwidth of streaming FullBuffer frames.
+//
+// The program is checked once when it is loaded and then runs without any checks: every
+// instruction must be known, jumps only go forward to the start of an instruction, and the depth
+// of the stack is the same on every path to an instruction and ends with the one color End pops.
+// So a program can't read or write outside its stack and registers, and it can't take more than
+// one pass over its code per pixel.
+class EffectProgram
+{
+public:
+    static const int MaxCode = 256;
+    static const int MaxParams = 8;
+    static const int Registers = 8;
+    static const int MaxStack = 16;
+
+private:
+    uint8_t code[MaxCode];
+    uint32_t length = 0;
+    int32_t params[MaxParams];
+    int32_t registers[Registers];
+    bool perPixel = false;
+    const char* error = nullptr;
+
+    // the inputs of the frame being evaluated.
+    int32_t strips = 0;
+    int32_t leds = 0;
+    int32_t time = 0;
+
+public:
+    EffectProgram()
+    {
+        Clear();
+    }
+
+    void Clear()
+    {
+        length = 0;
+        perPixel = false;
+        error = nullptr;
+        ::memset(params, 0, sizeof(params));
+        ::memset(registers, 0, sizeof(registers));
+    }
+
+    // Load and check the code, returns false with GetError() when it is rejected.  perPixel runs
+    // the program for every pixel instead of once per LED row.  The parameters and registers
+    // start at 0.
+    bool Load(const uint8_t* bytes, uint32_t size, bool perPixel)
+    {
+        Clear();
+        if (size == 0 || size > (uint32_t)MaxCode)
+        {
+            error = "program is empty or too long";
+            return false;
+        }
+        ::memcpy(code, bytes, size);
+        length = size;
+        this->perPixel = perPixel;
+        error = Verify();
+        if (error != nullptr)
+        {
+            length = 0;
+            return false;
+        }
+        return true;
+    }
+
+    // Parameter i is 0 unless it is set.
+    void SetParam(int i, int32_t value)
+    {
+        if (i >= 0 && i < MaxParams)
+        {
+            params[i] = value;
+        }
+    }
+
+    bool IsLoaded() { return length > 0; }
+    bool IsPerPixel() { return perPixel; }
+    uint32_t GetLength() { return length; }
+    const uint8_t* GetCode() { return code; }
+    int32_t GetParam(int i) { return params[i]; }
+    const char* GetError() { return error; }
+
+    // Set the inputs for the next frame, time is in milliseconds.
+    void Begin(int32_t numStrips, int32_t ledsPerStrip, int32_t milliseconds)
+    {
+        strips = numStrips;
+        leds = ledsPerStrip;
+        time = milliseconds;
+    }
+
+    // Run the program for one pixel (or one row with strip 0) and return its color.  The
+    // registers keep their values from one pixel to the next, so a program can carry state.
+    uint32_t Evaluate(int32_t strip, int32_t led)
+    {
+        if (length == 0)
+        {
+            return 0;
+        }
+        int32_t stack[MaxStack];
+        int32_t* sp = stack; // the next free entry, the top is sp[-1]
+        const uint8_t* pc = code;
+        for (;;)
+        {
+            EffectOp op = (EffectOp)*pc++;
+            switch (op)
+            {
+            case EffectOp::End:
+                return (uint32_t)sp[-1] & 0x00FFFFFF;
+            case EffectOp::Push8:
+                *sp++ = (int8_t)pc[0];
+                pc += 1;
+                break;
+            case EffectOp::Push16:
+                *sp++ = (int16_t)(pc[0] | (pc[1] << 8));
+                pc += 2;
+                break;
+            case EffectOp::Push32:
+                *sp++ = (int32_t)((uint32_t)pc[0] | ((uint32_t)pc[1] << 8) | ((uint32_t)pc[2] << 16) | ((uint32_t)pc[3] << 24));
+                pc += 4;
+                break;
+            case EffectOp::Strip:
+                *sp++ = strip;
+                break;
+            case EffectOp::Led:
+                *sp++ = led;
+                break;
+            case EffectOp::Strips:
+                *sp++ = strips;
+                break;
+            case EffectOp::Leds:
+                *sp++ = leds;
+                break;
+            case EffectOp::Time:
+                *sp++ = time;
+                break;
+            case EffectOp::Param:
+                *sp++ = params[*pc++];
+                break;
+            case EffectOp::Load:
+                *sp++ = registers[*pc++];
+                break;
+            case EffectOp::Store:
+                registers[*pc++] = *--sp;
+                break;
+            case EffectOp::Dup:
+                sp[0] = sp[-1];
+                sp++;
+                break;
+            case EffectOp::Drop:
+                sp--;
+                break;
+            case EffectOp::Swap:
+            {
+                int32_t t = sp[-1];
+                sp[-1] = sp[-2];
+                sp[-2] = t;
+                break;
+            }
+            case EffectOp::Neg:
+                sp[-1] = (int32_t)(0u - (uint32_t)sp[-1]);
+                break;
+            case EffectOp::Abs:
+                sp[-1] = sp[-1] < 0 ? (int32_t)(0u - (uint32_t)sp[-1]) : sp[-1];
+                break;
+            case EffectOp::Sin:
+                sp[-1] = Lookup::Sin((uint32_t)sp[-1]) >> 7;
+                break;
+            case EffectOp::Hue:
+                sp[-1] = (int32_t)Lookup::Hue((uint8_t)sp[-1]);
+                break;
+            case EffectOp::Rgb:
+                sp -= 2;
+                sp[-1] = (int32_t)((Clamp(sp[0], 255) << 16) | (Clamp(sp[-1], 255) << 8) | Clamp(sp[1], 255));
+                break;
+            case EffectOp::Lerp:
+                sp -= 2;
+                sp[-1] = (int32_t)PixelKernels::Lerp((uint32_t)sp[-1], (uint32_t)sp[0], Clamp(sp[1], PixelKernels::One));
+                break;
+            case EffectOp::Jz:
+            {
+                uint8_t skip = *pc++;
+                if (*--sp == 0)
+                {
+                    pc += skip;
+                }
+                break;
+            }
+            case EffectOp::Jmp:
+                pc += *pc + 1;
+                break;
+            default:
+            {
+                // the binary operators, a is under b.
+                int32_t b = *--sp;
+                sp[-1] = Binary(op, sp[-1], b);
+                break;
+            }
+            }
+        }
+    }
+
+private:
+    static uint32_t Clamp(int32_t v, uint32_t max)
+    {
+        return v < 0 ? 0 : (uint32_t)v > max ? max : (uint32_t)v;
+    }
+
+    static int32_t Binary(EffectOp op, int32_t a, int32_t b)
+    {
+        // the arithmetic wraps like the hardware instead of being undefined on overflow.
+        uint32_t ua = (uint32_t)a;
+        uint32_t ub = (uint32_t)b;
+        switch (op)
+        {
+        case EffectOp::Add: return (int32_t)(ua + ub);
+        case EffectOp::Sub: return (int32_t)(ua - ub);
+        case EffectOp::Mul: return (int32_t)(ua * ub);
+        case EffectOp::MulQ8: return (int32_t)(((int64_t)a * b) >> 8);
+        case EffectOp::Div: return b == 0 ? 0 : b == -1 ? (int32_t)(0u - ua) : a / b;
+        case EffectOp::Mod: return (b == 0 || b == -1) ? 0 : a % b;
+        case EffectOp::Min: return a < b ? a : b;
+        case EffectOp::Max: return a > b ? a : b;
+        case EffectOp::And: return (int32_t)(ua & ub);
+        case EffectOp::Or: return (int32_t)(ua | ub);
+        case EffectOp::Xor: return (int32_t)(ua ^ ub);
+        case EffectOp::Shl: return (int32_t)(ua << (b & 31));
+        case EffectOp::Shr: return a >> (b & 31);
+        case EffectOp::Less: return a < b ? 1 : 0;
+        case EffectOp::Equal: return a == b ? 1 : 0;
+        case EffectOp::Scale: return (int32_t)PixelKernels::Scale(ua, Clamp(b, PixelKernels::One));
+        case EffectOp::AddColor: return (int32_t)PixelKernels::AddSaturate(ua, ub);
+        default: return 0;
+        }
+    }
+
+    // The immediate bytes, the values popped and the values pushed by an instruction, false
+    // when the instruction is unknown.
+    static bool Describe(EffectOp op, int& immediate, int& pops, int& pushes)
+    {
+        immediate = 0;
+        pops = 0;
+        pushes = 1;
+        switch (op)
+        {
+        case EffectOp::End: pops = 1; pushes = 0; break;
+        case EffectOp::Push8: immediate = 1; break;
+        case EffectOp::Push16: immediate = 2; break;
+        case EffectOp::Push32: immediate = 4; break;
+        case EffectOp::Strip:
+        case EffectOp::Led:
+        case EffectOp::Strips:
+        case EffectOp::Leds:
+        case EffectOp::Time:
+            break;
+        case EffectOp::Param:
+        case EffectOp::Load:
+            immediate = 1;
+            break;
+        case EffectOp::Store: immediate = 1; pops = 1; pushes = 0; break;
+        case EffectOp::Dup: pops = 1; pushes = 2; break;
+        case EffectOp::Drop: pops = 1; pushes = 0; break;
+        case EffectOp::Swap: pops = 2; pushes = 2; break;
+        case EffectOp::Neg:
+        case EffectOp::Abs:
+        case EffectOp::Sin:
+        case EffectOp::Hue:
+            pops = 1;
+            break;
+        case EffectOp::Rgb:
+        case EffectOp::Lerp:
+            pops = 3;
+            break;
+        case EffectOp::Jz: immediate = 1; pops = 1; pushes = 0; break;
+        case EffectOp::Jmp: immediate = 1; pushes = 0; break;
+        default:
+            if (op >= EffectOp::Count)
+            {
+                return false;
+            }
+            pops = 2; // the binary operators
+            break;
+        }
+        return true;
+    }
+
+    // Check the program can run without any checks, returns the reason when it can't.
+    const char* Verify()
+    {
+        // first find where the instructions start, the jumps have to land on one.
+        bool starts[MaxCode + 1];
+        ::memset(starts, 0, sizeof(starts));
+        uint32_t pc = 0;
+        while (pc < length)
+        {
+            int immediate, pops, pushes;
+            if (!Describe((EffectOp)code[pc], immediate, pops, pushes))
+            {
+                return "unknown instruction";
+            }
+            EffectOp op = (EffectOp)code[pc];
+            if (pc + 1 + immediate > length)
+            {
+                return "truncated instruction";
+            }
+            if ((op == EffectOp::Param && code[pc + 1] >= MaxParams) ||
+                ((op == EffectOp::Load || op == EffectOp::Store) && code[pc + 1] >= Registers))
+            {
+                return "parameter or register out of range";
+            }
+            starts[pc] = true;
+            pc += 1 + immediate;
+        }
+
+        // then the stack depth along every path, the jumps only go forward so every way into an
+        // instruction has been seen by the time it is reached.
+        int16_t depth[MaxCode];
+        for (int i = 0; i < MaxCode; i++)
+        {
+            depth[i] = -1;
+        }
+        depth[0] = 0;
+        pc = 0;
+        while (pc < length)
+        {
+            EffectOp op = (EffectOp)code[pc];
+            int immediate, pops, pushes;
+            Describe(op, immediate, pops, pushes);
+            uint32_t next = pc + 1 + immediate;
+            int d = depth[pc];
+            if (d < 0)
+            {
+                // nothing reaches this instruction.
+                pc = next;
+                continue;
+            }
+            if (d < pops)
+            {
+                return "stack underflow";
+            }
+            d = d - pops + pushes;
+            if (d > MaxStack)
+            {
+                return "stack overflow";
+            }
+            if (op == EffectOp::End)
+            {
+                if (d != 0)
+                {
+                    return "End must leave only the color on the stack";
+                }
+            }
+            else
+            {
+                if (op == EffectOp::Jz || op == EffectOp::Jmp)
+                {
+                    const char* rc = Merge(next + code[pc + 1], d, starts, depth);
+                    if (rc != nullptr)
+                    {
+                        return rc;
+                    }
+                }
+                if (op != EffectOp::Jmp)
+                {
+                    const char* rc = Merge(next, d, starts, depth);
+                    if (rc != nullptr)
+                    {
+                        return rc;
+                    }
+                }
+            }
+            pc = next;
+        }
+        return nullptr;
+    }
+
+    const char* Merge(uint32_t target, int d, const bool* starts, int16_t* depth)
+    {
+        if (target >= length)
+        {
+            return "missing End";
+        }
+        if (!starts[target])
+        {
+            return "jump into the middle of an instruction";
+        }
+        if (depth[target] < 0)
+        {
+            depth[target] = (int16_t)d;
+        }
+        else if (depth[target] != d)
+        {
+            return "the stack is different on two paths";
+        }
+        return nullptr;
+    }
+};
+
+#endif
@@ -0,0 +1,102 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#ifndef _ENVELOPE_H
+#define _ENVELOPE_H
+
+#include <math.h>
+#include <stdint.h>
+#include "PixelKernels.h"
+#include "LookupTables.h"
+
+enum class EnvelopeShape
+{
+    Sine,       // sin(2 pi phase), -1 to 1
+    Breath,     // exp(sin(2 pi phase)), 1/e to e, a sine with a longer quiet time between the peaks
+    Triangle,   // 0 to 1 and back to 0
+    Custom      // samples given to the constructor
+};
+
+// A periodic curve for pulsing effects.  One period is sampled into a table when the envelope is
+// created (the built in shapes come from LookupTables), so the animations look up one value per
+// frame (Evaluate) instead of calling libm, and apply it to the pixels with Apply.
+class Envelope
+{
+public:
+    static const int TableSize = 256;
+
+    // period is in milliseconds, phase (0-1) shifts where the period starts.
+    Envelope(EnvelopeShape shape, float period, float phase = 0) : shape(shape), period(period), phase(phase)
+    {
+        for (int i = 0; i <= TableSize; i++)
+        {
+            float p = (float)i / TableSize;
+            uint32_t angle = (uint32_t)i << 8; // the 16 bit phase of sample i
+            float value = 0;
+            switch (shape)
+            {
+            case EnvelopeShape::Sine:
+                value = Lookup::Sin(angle) / 32767.0f;
+                break;
+            case EnvelopeShape::Breath:
+                value = Lookup::Breath(angle) / 4096.0f;
+                break;
+            case EnvelopeShape::Triangle:
+            default:
+                value = p < 0.5f ? p * 2 : (1 - p) * 2;
+                break;
+            }
+            table[i] = value;
+        }
+    }
+
+    // A custom curve of count samples covering one period, it wraps around to the first sample.
+    Envelope(const float* samples, int count, float period, float phase = 0) : shape(EnvelopeShape::Custom), period(period), phase(phase)
+    {
+        for (int i = 0; i <= TableSize; i++)
+        {
+            float position = (float)i * count / TableSize;
+            int k = (int)position;
+            float fraction = position - k;
+            float a = samples[k % count];
+            float b = samples[(k + 1) % count];
+            table[i] = a + (b - a) * fraction;
+        }
+    }
+
+    EnvelopeShape GetShape() { return shape; }
+
+    // The curve at the given time in milliseconds, linearly interpolated between the samples.
+    float Evaluate(float milliseconds)
+    {
+        float p = milliseconds / period + phase;
+        p -= floorf(p);
+        float position = p * TableSize;
+        int i = (int)position;
+        if (i >= TableSize)
+        {
+            i = TableSize - 1;
+        }
+        float fraction = position - i;
+        return table[i] + (table[i + 1] - table[i]) * fraction;
+    }
+
+    // dst = src scaled by level (0-1) on every channel, the same level for the whole span.
+    static void Apply(uint32_t* dst, const uint32_t* src, uint32_t count, float level)
+    {
+        PixelKernels::ScaleSpan(dst, src, count, PixelKernels::Fraction(level));
+    }
+
+    // One color scaled by level (0-1).
+    static uint32_t Apply(uint32_t color, float level)
+    {
+        return PixelKernels::Scale(color, PixelKernels::Fraction(level));
+    }
+
+private:
+    EnvelopeShape shape;
+    float period;
+    float phase;
+    float table[TableSize + 1]; // one period, the last sample repeats the first
+};
+
+#endif
@@ -0,0 +1,176 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#ifndef _FRAMEARENA_H
+#define _FRAMEARENA_H
+
+#include <stdint.h>
+#include "StripLayout.h"
+#include "Status.h"
+#include "SimpleString.h"
+
+#ifndef DMAMEM
+#define DMAMEM
+#endif
+
+// The number of frames that can be in use at once: the back and front buffers of the
+// PixelBuffer, the snapshot and target of the current animation and the pixels of the next
+// FullBuffer command being received.  The received pixels move on to the Controller and the
+// animation with their slot, so a FullBuffer only holds one slot at a time.
+#ifndef FRAME_SLOTS
+#ifdef UNITTEST
+#define FRAME_SLOTS 16 // the tests keep a few animations and buffers of their own alive
+#else
+#define FRAME_SLOTS 8
+#endif
+#endif
+
+// A frame slot handed out by the FrameArena, 0 is no slot.
+typedef uint8_t FrameHandle;
+
+// A fixed set of frame sized slots (LEDLayout::Pixels each) for everything that needs a whole
+// frame: the PixelBuffer back and front buffers, the animation snapshots, the cross fade targets
+// and the FullBuffer pixels.  On the Teensy the slots are a static DMAMEM array in OCRAM (RAM2)
+// placed at link time, so switching commands never allocates from the heap and 25 KB blocks
+// can't fragment it.  When all the slots are taken Acquire() returns 0 and the caller carries
+// on without the frame, the same as running out of memory.
+class FrameArena
+{
+public:
+    static const int Slots = FRAME_SLOTS;
+    static const uint32_t Pixels = LEDLayout::Pixels;
+    typedef uint32_t Frame[Pixels];
+
+    static_assert(FRAME_SLOTS > 0 && FRAME_SLOTS <= 32, "FrameArena supports 1 to 32 slots");
+
+private:
+    Frame* frames;
+    uint32_t used = 0; // bit per slot
+    int inUse = 0;
+    int highWater = 0;
+
+public:
+    // storage is Slots frames, see gFrameArena.
+    FrameArena(Frame* storage) : frames(storage)
+    {
+    }
+
+    FrameHandle Acquire()
+    {
+        for (int i = 0; i < Slots; i++)
+        {
+            uint32_t bit = 1u << i;
+            if ((used & bit) == 0)
+            {
+                used |= bit;
+                inUse++;
+                if (inUse > highWater)
+                {
+                    highWater = inUse;
+                }
+                gTeensyStatus.frameSlots = inUse;
+                gTeensyStatus.frameSlotsHighWater = highWater;
+                return (FrameHandle)(i + 1);
+            }
+        }
+        CrashPrint("### FrameArena: all %d frame slots are in use\r\n", Slots);
+        return 0;
+    }
+
+    // Give the slot back and clear the handle.
+    void Release(FrameHandle& handle)
+    {
+        if (handle > 0 && handle <= Slots)
+        {
+            uint32_t bit = 1u << (handle - 1);
+            if ((used & bit) != 0)
+            {
+                used &= ~bit;
+                inUse--;
+                gTeensyStatus.frameSlots = inUse;
+            }
+        }
+        handle = 0;
+    }
+
+    uint32_t* Get(FrameHandle handle)
+    {
+        return (handle > 0 && handle <= Slots) ? frames[handle - 1] : nullptr;
+    }
+
+    int GetInUse() { return inUse; }
+    int GetHighWater() { return highWater; }
+};
+
+// Defined with its DMAMEM storage next to gTeensyStatus.
+extern FrameArena gFrameArena;
+
+// Owns one slot of gFrameArena until it goes out of scope or is released.
+class FrameSlot
+{
+    FrameHandle handle = 0;
+
+public:
+    FrameSlot()
+    {
+    }
+
+    ~FrameSlot()
+    {
+        Release();
+    }
+
+    FrameSlot(const FrameSlot&) = delete;
+    FrameSlot& operator=(const FrameSlot&) = delete;
+
+    // The slot moves to the new owner, the frame isn't copied.
+    FrameSlot(FrameSlot&& moved) : handle(moved.handle)
+    {
+        moved.handle = 0;
+    }
+
+    FrameSlot& operator=(FrameSlot&& moved)
+    {
+        if (this != &moved)
+        {
+            Release();
+            handle = moved.handle;
+            moved.handle = 0;
+        }
+        return *this;
+    }
+
+    // The pixels of the slot, acquiring one if this doesn't have one yet, nullptr when the
+    // arena is full.
+    uint32_t* Acquire()
+    {
+        if (handle == 0)
+        {
+            handle = gFrameArena.Acquire();
+        }
+        return gFrameArena.Get(handle);
+    }
+
+    void Release()
+    {
+        gFrameArena.Release(handle);
+    }
+
+    // Trade slots with another owner, neither frame is copied.
+    void Swap(FrameSlot& other)
+    {
+        FrameHandle h = handle;
+        handle = other.handle;
+        other.handle = h;
+    }
+
+    // The pixels, nullptr when there is no slot.
+    uint32_t* Get()
+    {
+        return gFrameArena.Get(handle);
+    }
+
+    bool IsValid() { return handle != 0; }
+    FrameHandle GetHandle() { return handle; }
+};
+
+#endif
@@ -0,0 +1,151 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#ifndef _FRAMESCHEDULER_H
+#define _FRAMESCHEDULER_H
+
+#include <stdint.h>
+#include "Timer.h"
+
+// Runs the animation frames on a fixed cadence.  The main loop reads commands until FrameDue()
+// and then calls StartFrame() and runs one frame, so the time the frames don't need goes to the
+// serial port and the RpiController sees the display at a known rate.
+//
+// A frame that starts a whole period or more late is an overrun: the missed frames are dropped
+// rather than run back to back, and the cadence restarts from that frame.  With no target fps a
+// frame runs on every pass of the main loop, as fast as the animation allows.
+class FrameScheduler
+{
+    Timer timer;            // running since construction, the clock of the schedule
+    uint32_t period = 0;    // microseconds between frames, 0 is free running
+    uint32_t nextFrame = 0; // when the next frame is due
+    uint32_t frames = 0;
+    uint32_t overruns = 0;
+
+    uint32_t Now()
+    {
+        return (uint32_t)timer.microseconds();
+    }
+
+public:
+    FrameScheduler()
+    {
+        timer.start();
+    }
+
+    // Target frames per second, 0 runs the frames as fast as possible.
+    void SetFps(float fps)
+    {
+        period = fps > 0 ? (uint32_t)(1000000 / fps) : 0;
+        nextFrame = Now();
+        overruns = 0;
+    }
+
+    float GetFps()
+    {
+        return period > 0 ? 1000000.0f / period : 0;
+    }
+
+    bool FrameDue()
+    {
+        return period == 0 || (int32_t)(Now() - nextFrame) >= 0;
+    }
+
+    // Microseconds until the next frame is due.
+    uint32_t GetSlack()
+    {
+        int32_t slack = (int32_t)(nextFrame - Now());
+        return (period == 0 || slack < 0) ? 0 : (uint32_t)slack;
+    }
+
+    // A frame is about to run, schedule the next one.
+    void StartFrame()
+    {
+        frames++;
+        if (period == 0)
+        {
+            return;
+        }
+        uint32_t now = Now();
+        if ((int32_t)(now - nextFrame) >= (int32_t)period)
+        {
+            overruns++;
+            nextFrame = now + period;
+        }
+        else
+        {
+            nextFrame += period;
+        }
+    }
+
+    uint32_t GetFrames() { return frames; }
+    uint32_t GetOverruns() { return overruns; }
+};
+
+// The time between the frames of an animation, which is what Animation::Run() is given so the
+// animations move at the same speed whatever the frame rate.  The time is capped so a stall
+// (a long command, the speed test) makes the animations pause instead of jump.
+class FrameClock
+{
+    Timer timer;
+    bool running = false;
+
+public:
+    static constexpr float MaxElapsed = 0.25f;
+
+    // Seconds since the previous tick, 0 on the first one.
+    float Tick()
+    {
+        if (!running)
+        {
+            timer.start();
+            running = true;
+            return 0;
+        }
+        float elapsed = timer.microseconds() / 1000000.0f;
+        timer.start();
+        return elapsed < MaxElapsed ? elapsed : MaxElapsed;
+    }
+
+    // The next tick starts a new animation at 0.
+    void Reset()
+    {
+        running = false;
+    }
+};
+
+// Turns the elapsed time into whole steps for the animations that move in steps (a row at a
+// time, a star at a time) at a fixed rate.  The fraction of a step left over is carried to the
+// next frame, and when frames are slow several steps come back at once so the animation skips
+// the ones in between instead of slowing down with the frame rate.
+class StepClock
+{
+    float rate;         // steps per second
+    float pending = 0;  // fraction of a step carried over
+
+public:
+    StepClock(float stepsPerSecond) : rate(stepsPerSecond)
+    {
+    }
+
+    void SetRate(float stepsPerSecond) { rate = stepsPerSecond; }
+    float GetRate() { return rate; }
+
+    // The whole steps that are due after another elapsed seconds.
+    int Advance(float elapsed)
+    {
+        pending += elapsed * rate;
+        if (!(pending >= 1))
+        {
+            if (!(pending >= 0))
+            {
+                pending = 0;
+            }
+            return 0;
+        }
+        int steps = (int)pending;
+        pending -= steps;
+        return steps;
+    }
+};
+
+#endif
@@ -5,6 +5,7 @@
 #include <stdint.h>
 
 #include "Color.h"
+#include "LookupTables.h"
 
 class HlsColor
 {
@@ -88,6 +89,15 @@ public:
         return saturation;
     }
 
+    /// <summary>
+    /// The fully saturated color of a hue (0-255 around the wheel) from the hue wheel table,
+    /// the same as HlsColor(hue * 360 / 256, 0.5, 1).GetRGB() without the float math.
+    /// </summary>
+    static Color FromHue(uint8_t hue)
+    {
+        return Color::from(Lookup::Hue(hue));
+    }
+
     /// <summary>
     /// Set an RGB color
     /// </summary>
@@ -0,0 +1,179 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#ifndef _LOOKUPTABLES_H
+#define _LOOKUPTABLES_H
+
+#include <stdint.h>
+
+// Fixed point tables for the animations, generated by the compiler so nothing calls libm at
+// runtime.  On the Teensy they live in flash (PROGMEM) with the code instead of taking RAM, on
+// the host the same tables are built so TeensyUnitTest checks the values the firmware uses.
+//
+// Phases are 16 bit, 65536 is one full period, so they wrap around for free.
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+
+template <typename T, int N>
+struct LookupTable
+{
+    T values[N];
+    constexpr T operator[](int i) const { return values[i]; }
+};
+
+// The compile time math the tables are generated with, accurate to far more than the table precision.
+namespace LookupMath
+{
+    constexpr double Pi = 3.14159265358979323846;
+
+    // Taylor series after reducing x to [-pi, pi].
+    constexpr double Sin(double x)
+    {
+        while (x > Pi)
+            x -= 2 * Pi;
+        while (x < -Pi)
+            x += 2 * Pi;
+        double term = x;
+        double sum = x;
+        for (int n = 1; n < 20; n++)
+        {
+            term *= -x * x / ((2 * n) * (2 * n + 1));
+            sum += term;
+        }
+        return sum;
+    }
+
+    constexpr double Exp(double x)
+    {
+        double term = 1;
+        double sum = 1;
+        for (int n = 1; n < 30; n++)
+        {
+            term *= x / n;
+            sum += term;
+        }
+        return sum;
+    }
+
+    constexpr int32_t Round(double x)
+    {
+        return (int32_t)(x < 0 ? x - 0.5 : x + 0.5);
+    }
+
+    // sin(2 pi i / 256) in Q15, 257 samples so the last one can be interpolated to.
+    constexpr LookupTable<int16_t, 257> MakeSine()
+    {
+        LookupTable<int16_t, 257> table{};
+        for (int i = 0; i < 257; i++)
+        {
+            int32_t v = Round(Sin(2 * Pi * i / 256) * 32767);
+            table.values[i] = (int16_t)v;
+        }
+        return table;
+    }
+
+    // exp(sin(2 pi i / 256)) in Q12, 1/e to e.
+    constexpr LookupTable<uint16_t, 257> MakeBreath()
+    {
+        LookupTable<uint16_t, 257> table{};
+        for (int i = 0; i < 257; i++)
+        {
+            table.values[i] = (uint16_t)Round(Exp(Sin(2 * Pi * i / 256)) * 4096);
+        }
+        return table;
+    }
+
+    // sin(pi i / 256)^2 in Q8, a bubble that rises from 0 to 256 and back.
+    constexpr LookupTable<uint16_t, 257> MakeBubble()
+    {
+        LookupTable<uint16_t, 257> table{};
+        for (int i = 0; i < 257; i++)
+        {
+            double s = Sin(Pi * i / 256);
+            table.values[i] = (uint16_t)Round(s * s * 256);
+        }
+        return table;
+    }
+
+    // One channel of the fully saturated hue wheel (HlsColor luminance 0.5, saturation 1), h is
+    // in 1/256ths of the circle.
+    constexpr uint32_t HueChannel(double h)
+    {
+        while (h >= 256)
+            h -= 256;
+        while (h < 0)
+            h += 256;
+        double v = h < 256.0 / 6 ? h * 6 / 256 : h < 128 ? 1 : h < 256.0 * 2 / 3 ? (256.0 * 2 / 3 - h) * 6 / 256 : 0;
+        return (uint32_t)(v * 255);
+    }
+
+    // Packed GRB colors of the hue wheel, hue 0 is red, 85 green and 171 blue.
+    constexpr LookupTable<uint32_t, 256> MakeHueWheel()
+    {
+        LookupTable<uint32_t, 256> table{};
+        for (int i = 0; i < 256; i++)
+        {
+            uint32_t r = HueChannel(i + 256.0 / 3);
+            uint32_t g = HueChannel(i);
+            uint32_t b = HueChannel(i - 256.0 / 3);
+            table.values[i] = (g << 16) | (r << 8) | b;
+        }
+        return table;
+    }
+}
+
+static constexpr LookupTable<int16_t, 257> SineTable PROGMEM = LookupMath::MakeSine();
+static constexpr LookupTable<uint16_t, 257> BreathTable PROGMEM = LookupMath::MakeBreath();
+static constexpr LookupTable<uint16_t, 257> BubbleTable PROGMEM = LookupMath::MakeBubble();
+static constexpr LookupTable<uint32_t, 256> HueWheelTable PROGMEM = LookupMath::MakeHueWheel();
+static_assert(SineTable[64] == 32767 && SineTable[192] == -32767, "the tables are built at compile time");
+
+// Lookups with linear interpolation between the table samples.
+class Lookup
+{
+public:
+    // sin(2 pi phase / 65536) in Q15.
+    static inline int32_t Sin(uint32_t phase)
+    {
+        return Interpolate(SineTable[(phase >> 8) & 0xff], SineTable[((phase >> 8) & 0xff) + 1], phase & 0xff);
+    }
+
+    // cos(2 pi phase / 65536) in Q15.
+    static inline int32_t Cos(uint32_t phase)
+    {
+        return Sin(phase + 16384);
+    }
+
+    // exp(sin(2 pi phase / 65536)) in Q12.
+    static inline int32_t Breath(uint32_t phase)
+    {
+        return Interpolate(BreathTable[(phase >> 8) & 0xff], BreathTable[((phase >> 8) & 0xff) + 1], phase & 0xff);
+    }
+
+    // sin(pi i / steps)^2 in Q8 (0-256), step i of a bubble that is steps long.
+    static inline int32_t Bubble(uint32_t i, uint32_t steps)
+    {
+        uint32_t phase = (uint32_t)((((uint64_t)i << 16) + steps / 2) / steps) & 0xffff;
+        return Interpolate(BubbleTable[phase >> 8], BubbleTable[(phase >> 8) + 1], phase & 0xff);
+    }
+
+    // Packed color of the fully saturated hue (0-255 around the wheel).
+    static inline uint32_t Hue(uint8_t hue)
+    {
+        return HueWheelTable[hue];
+    }
+
+    // The phase of a 0-1 fraction of a period.
+    static inline uint32_t Phase(float fraction)
+    {
+        return (uint32_t)(int32_t)(fraction * 65536);
+    }
+
+private:
+    static inline int32_t Interpolate(int32_t a, int32_t b, uint32_t fraction)
+    {
+        return a + (((b - a) * (int32_t)fraction + 128) >> 8);
+    }
+};
+
+#endif
@@ -21,8 +21,24 @@
 #ifndef _MultiWS2812_H
 #define _MultiWS2812_H
 
-#define MULTIWS2812_MAX_GPIOS (16)
-#define MULTIWS2812_FAST_DBG_GPIO (1)
+// Build with -DMULTIWS2812_FAST_DBG_GPIO to pulse pin 1 on every bit the bit-bang output
+// sends (to check the timing with a scope), pin 1 can't drive a strip then.
+// The PIT/DMA output (see enableDma()) remuxes the strip pins and hasn't been checked on a rig
+// with a scope or logic analyzer yet, so it is opt-in: build with -DMULTIWS2812_DMA_OUTPUT=1
+// (build_flags in platformio.ini) to try it.  By default the strips use the bit-bang output.
+#ifndef MULTIWS2812_DMA_OUTPUT
+#define MULTIWS2812_DMA_OUTPUT (0)
+#endif
+// LED rows the DMA interrupt encodes at a time, the ring holds two of these halves.
+// 8 rows is 240us of output, which is how late the interrupt can be before the strips glitch.
+#define MULTIWS2812_DMA_RING_ROWS (8)
+// The bit-bang output turns interrupts back on after every this many LED rows (0 keeps them
+// off for the whole frame), see setInterruptWindow().  A slow interrupt in a window can latch
+// the LEDs in the middle of the frame and that hasn't been measured on a rig yet, so the
+// windows are opt-in: build with -DMULTIWS2812_INTERRUPT_WINDOW_ROWS=1 to try them.
+#ifndef MULTIWS2812_INTERRUPT_WINDOW_ROWS
+#define MULTIWS2812_INTERRUPT_WINDOW_ROWS (0)
+#endif
 
 #ifndef UNITTEST
 #if (ARDUINO_TEENSY40)
@@ -37,6 +53,9 @@
 #endif
 
 #include "Timer.h"
+#include "WS2812Waveform.h"
+#include "StripLayout.h"
+#include <DMAChannel.h>
 
 #ifdef MULTIWS2812_FAST_DBG_GPIO
 static uint32_t* dbg_pin1_set, * dbg_pin1_clr, dbg_pin1_msk;
@@ -47,38 +66,48 @@ static inline void dbg_write(uint8_t val) {
     else if (val == LOW)
         * dbg_pin1_clr = dbg_pin1_msk;
 }
+#else
+static inline void dbg_write(uint8_t) {}
 #endif
 
 
-// Define the limits and defaults for WS2812 signal generation
-const struct {
-    // Nominal values (F_CPU_ACTUAL typically is 600,000,000, 600MHz, a cycle is 1.666667ns)
-    // Convert cycles to ns: cycles * 1/600e6 = ns (use 1/0.6, to go directly to ns)
-    // Convert cycles to Hz: 1/cycles * 600e6 = Hz (600e3, for kHz)
-
-    // Datasheet says 800khz is the max.
-    const uint32_t DEFAULT_CYCLES_800 = 600e6 / 800000; // 750 cycles [1.25us, 800kHz]
-
-    // Datasheet says T0H should be 0.4 us
-    const uint32_t DEFAULT_CYCLES_T0H = 240; // 400 ns
-    // Datasheet says T0H should be 0.8 us
-    const uint32_t DEFAULT_CYCLES_T1H = 480; // 800 ns
-
-    // Wait a bit longer than 300us to avoid any timing issues
-    // Datasheet says frame reset has to be >= 50 us.
-    const uint32_t DEFAULT_FRAME_RESET = 300; // us of delay
-} WS2812Timing;
-
 extern void DebugPrint(const char* format, ...);
 
-class MultiWS2812 {
+// The output backends that can send a frame to the strips.
+enum class WS2812Output
+{
+    BitBang,    // show() bit bangs GPIO6/GPIO7 with interrupts disabled except between LED rows
+    Dma         // show() returns while DMA streams the frame out of GPIO1/GPIO2, encoding it as it goes
+};
+
+// The output engine: bit-bang timing loop, DMA ring and frame latch timing.  It does not know the
+// strip layout, MultiWS2812<> hands it the port masks and the transposition functions specialized
+// on the layout.
+class MultiWS2812Base {
 public:
-    MultiWS2812(uint16_t LEDsPerStripCount, uint16_t stripCount);
-    ~MultiWS2812();
+    // Transpose/encode rows of the frame (see WS2812Waveform).
+    typedef void (*TransposeFunction)(const uint32_t* frame, uint32_t rows, uint32_t* planes, const WS2812ColorMap* colors);
+    typedef void (*EncodeFunction)(const uint32_t* frame, uint32_t rows, uint32_t* words6, uint32_t* words7, const WS2812ColorMap* colors);
+
+    MultiWS2812Base(uint16_t LEDsPerStripCount, uint16_t stripCount, uint32_t portMask6, uint32_t portMask7,
+        TransposeFunction transpose, EncodeFunction encode);
+    ~MultiWS2812Base();
 
     void show(void);
+    // Send only the first rowCount LEDs of every strip, the LEDs after that keep their colors.
+    void show(uint32_t rowCount);
     int busy(void);
-    boolean enableOutputPin(uint32_t bankStringNum, uint32_t pin);
+    // true while the frame buffer is still being read, the buffer must not change until then.
+    int sending(void) { return update_in_progress; }
+    boolean enableDma(void);
+    WS2812Output getOutput() { return output; }
+    // Let interrupts run between every rows LED rows of the bit-bang output, 0 disables them for the whole frame.
+    void setInterruptWindow(uint32_t rows) { rowGaps.windowRows = rows; }
+    // Gamma per channel, global brightness [0-1] and temporal dithering applied while the frame
+    // is sent.  Brightness 1, gamma 1 and no dithering sends the pixels unchanged.
+    boolean setColorCorrection(float brightness, float gammaR, float gammaG, float gammaB, boolean dither);
+    // Output timing counters, always on.  A DMA frame updates them when it finishes.
+    const WS2812Stats& getStats() { return stats; }
 
     void printTimingCycleStats() {
         DebugPrint("CPU Clock time: %u\r\n", F_CPU_ACTUAL);
@@ -87,11 +116,29 @@ public:
         DebugPrint("T1H NZR high time duration: %u cycles\r\n", timingCyclesT1H);
         DebugPrint("Reset delay %u cycles\r\n", timingFrameResetDelay);
         DebugPrint("frameBuffer: 0x%08X [32bit alignment: 0x%08X]\r\n", (int)frameBuffer, (int)frameBuffer % 32);
+        DebugPrint("Strips: %u x %u LEDs, GPIO6 0x%08X, GPIO7 0x%08X\r\n", numStrips, maxLEDsPerStrip, msk6, msk7);
+        if (colorMapEnabled)
+        {
+            DebugPrint("Color correction: brightness %.3f, gamma %.2f/%.2f/%.2f, dithering %s\r\n",
+                colorBrightness, colorGamma[1], colorGamma[0], colorGamma[2], colorMap.IsDithering() ? "on" : "off");
+        }
+        DebugPrint("Frames: %u, %u fps, last %u cycles [%.2fus] with %u cycles to prepare, %u cycles latch wait\r\n",
+            stats.frames, stats.fps, stats.frameCycles, stats.frameCycles / ((double)F_CPU_ACTUAL / 1e6), stats.prepareCycles, stats.latchWaitCycles);
+        DebugPrint("Worst setup %u of %u cycles, %u missed deadlines\r\n", stats.setupCycles, stats.setupBudget, stats.missedDeadlines);
+        if (output == WS2812Output::Dma)
+        {
+            DebugPrint("Output: DMA channels %u/%u, phase %u cycles, %u rows per interrupt\r\n", dma6->channel, dma7->channel, WS2812Waveform::GetPhaseCycles(), MULTIWS2812_DMA_RING_ROWS);
+        }
+        else
+        {
+            DebugPrint("Output: bit-bang\r\n");
+            DebugPrint("Interrupt window every %u rows, %u gaps using %u cycles [%.2fus] in the last frame\r\n",
+                rowGaps.windowRows, rowGaps.count, rowGaps.cycles, rowGaps.cycles / ((double)F_CPU_ACTUAL / 1e6));
+            DebugPrint("Longest row gap %u cycles [%.2fus], %u gaps over the %uus budget\r\n",
+                rowGaps.maxCycles, rowGaps.maxCycles / ((double)F_CPU_ACTUAL / 1e6), rowGaps.overruns, timingMaxRowGap);
+        }
     }
 
-    void begin(void) {
-        begun = true;
-    }
     void* getBuffer(void) {
         return frameBuffer;
     }
@@ -108,12 +155,30 @@ public:
         return maxLEDsPerStrip;
     }
 
+protected:
+    boolean begun;              // true if begin() previously called, the output pins are setup
+
 private:
-    boolean begun;              // true if begin() previously called
+    void showBitBang(void);
+    void showDma(void);
+    void encodeDmaRows(uint32_t half);
+    void refillDma(void);
+    const WS2812ColorMap* getColorMap(void) { return colorMapEnabled ? &colorMap : NULL; }
+    static void releaseDma(void);
+    static void dmaInterrupt(void);
+
     uint16_t maxLEDsPerStrip;   // Max length of strip, sets size of buffers
     uint16_t numStrips;         // Number of strips/output ports enabled
-    uint16_t numBytes;         // Number of strips/output ports enabled
     uint32_t* frameBuffer;     // Pixel data arranged in [LED][strip] order
+    uint32_t* planes;          // Bit-bang T0H port masks arranged in [LED][bit][port] order (see WS2812Waveform)
+    uint16_t frameRows;        // LED rows of the frame being sent
+    TransposeFunction transposeRows;
+    EncodeFunction encodeRows;
+    WS2812ColorMap colorMap;
+    boolean colorMapEnabled;    // false when the pixels are sent unchanged
+    float colorBrightness;
+    float colorGamma[3];        // GRB order, like the pixels
+    boolean fullFrame;          // send every row on the next show(), the color correction changed
 
   // Cycle timing tuning:
     Timer timer;
@@ -121,26 +186,78 @@ private:
     uint32_t timingCyclesT1H;
     uint32_t timingCyclesT0H;
     uint32_t timingFrameResetDelay;
+    uint32_t timingMaxRowGap;
+
+    // Interrupt windows between the rows of the bit-bang output:
+    WS2812RowGaps rowGaps;
+
+    // Always-on counters (see getStats()):
+    WS2812Stats stats;
+    uint32_t frameStartCycles;  // ARM_DWT_CYCCNT when the frame being sent started
+    uint32_t fpsFrames;         // frames since fpsStart
+    uint32_t fpsStart;          // millis()
 
     // RES (frame latch) timing:
     volatile uint8_t update_in_progress;
     volatile uint32_t update_completed_at;
 
     // Port setting registers on GPIO6 ports
-    uint32_t port6Count;
     volatile uint32_t* set6;
     volatile uint32_t* clr6;
     uint32_t msk6;      // Mask for setting all outputs on
 
     // Port setting registers on GPIO7 port
-    uint32_t port7Count;
     volatile uint32_t* set7;
     volatile uint32_t* clr7;
     uint32_t msk7;      // Mask for setting all outputs on
 
-    // GPIO usage tracking:
-    uint32_t pinNums[MULTIWS2812_MAX_GPIOS];
-    uint32_t curPin;
+    // DMA output engine, the same pins are switched over to GPIO1/GPIO2 since the DMA
+    // cannot reach the fast GPIO6/GPIO7 ports.  Only dmaOwner sends with DMA, so the channels
+    // are allocated once by its enableDma() instead of by every driver.
+    WS2812Output output;
+    static DMAChannel* dma6;
+    static DMAChannel* dma7;
+    uint32_t dmaRowsEncoded;            // LED rows of the frame written to the ring so far
+    volatile uint32_t dmaRowsSent;      // LED rows (including padding) the DMA has finished
+    volatile uint32_t dmaHalf;          // Ring half the next interrupt is for
+    uint32_t dmaStartCycles;            // ARM_DWT_CYCCNT when the DMA was started on the frame
+    static MultiWS2812Base* dmaOwner;
+};
+
+// Driver for Strips parallel strips of LedsPerStrip LEDs wired to the pins in Pins (a PinMap).
+// The layout is known at compile time, so the port masks are constants and the transposition of
+// each row is fully unrolled for exactly this set of strips.
+template <uint32_t Strips, uint32_t LedsPerStrip, typename Pins>
+class MultiWS2812 : public MultiWS2812Base {
+public:
+    typedef StripLayout<Strips, LedsPerStrip, Pins> Layout;
+
+    MultiWS2812() : MultiWS2812Base(LedsPerStrip, Strips, Layout::PortMask6, Layout::PortMask7, transpose, encode)
+    {
+    }
+
+    // Setup the output pins, this has to be done before enableDma().
+    void begin(void) {
+        for (uint32_t strip = 0; strip < Strips; strip++)
+        {
+            pinMode(Pins::Pin(strip), OUTPUT);
+            digitalWrite(Pins::Pin(strip), LOW);
+        }
+        begun = true;
+    }
+
+private:
+    __attribute__((optimize("unroll-loops")))
+    static void transpose(const uint32_t* frame, uint32_t rows, uint32_t* planes, const WS2812ColorMap* colors)
+    {
+        WS2812Waveform::Transpose<Layout>(frame, rows, planes, colors);
+    }
+
+    __attribute__((optimize("unroll-loops")))
+    static void encode(const uint32_t* frame, uint32_t rows, uint32_t* words6, uint32_t* words7, const WS2812ColorMap* colors)
+    {
+        WS2812Waveform::Encode<Layout>(frame, rows, words6, words7, colors);
+    }
 };
 
 #endif // MultiWS2812_H
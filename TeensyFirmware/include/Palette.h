@@ -0,0 +1,168 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#ifndef _PALETTE_H
+#define _PALETTE_H
+
+#include <stdint.h>
+#include <string.h>
+#include "PixelKernels.h"
+#include "FrameScheduler.h"
+
+// The 256 colors the IndexedBuffer frames are drawn with.  The frame is sent once as a byte per
+// pixel and the Palette command changes the colors under it afterwards, fading them to new
+// values or rotating a range of them (color cycling) without sending any pixels again.
+//
+// The frames look their pixels up in a table that has the fade and the rotation applied, it is
+// only rebuilt when one of them moves, and GetVersion() changes when it is so the frame only
+// needs drawing again then.  Until a palette is sent the colors are a gray ramp.
+class Palette
+{
+public:
+    static const int Size = 256;
+
+private:
+    uint32_t entries[Size]; // the colors, part way through the fade while there is one
+    uint32_t from[Size];    // the colors the fade started from
+    uint32_t to[Size];      // the colors the fade ends on
+    uint32_t table[Size];   // entries with the cycle rotation applied
+    float fadeSeconds = 0;
+    float fadeTime = 0;
+    bool fading = false;
+    int cycleFirst = 0;
+    int cycleCount = 0;
+    int cycleOffset = 0;
+    bool cycleReverse = false;
+    StepClock cycle{ 0 };   // entries per second the cycle range rotates by
+    bool dirty = true;
+    uint32_t version = 0;
+
+public:
+    Palette()
+    {
+        for (int i = 0; i < Size; i++)
+        {
+            entries[i] = to[i] = PixelKernels::Gray((uint8_t)i);
+        }
+        Rebuild();
+    }
+
+    // Set count colors starting at entry first, fading to them over the given seconds.  A fade
+    // that is still running starts over from where it got to.
+    void Set(int first, const uint32_t* colors, int count, float seconds)
+    {
+        if (first < 0 || first >= Size)
+        {
+            return;
+        }
+        if (count > Size - first)
+        {
+            count = Size - first;
+        }
+        ::memcpy(&to[first], colors, count * sizeof(uint32_t));
+        if (seconds > 0)
+        {
+            ::memcpy(from, entries, sizeof(from));
+            fadeSeconds = seconds;
+            fadeTime = 0;
+            fading = true;
+        }
+        else if (fading)
+        {
+            // the rest of the palette keeps fading to its new colors.
+            ::memcpy(&from[first], colors, count * sizeof(uint32_t));
+        }
+        else
+        {
+            ::memcpy(&entries[first], colors, count * sizeof(uint32_t));
+        }
+        dirty = true;
+    }
+
+    // Rotate count entries starting at first by speed entries per second, negative speeds
+    // rotate the other way and 0 (or a count less than 2) stops the cycling.
+    void SetCycle(int first, int count, float speed)
+    {
+        if (first < 0 || first >= Size || count < 2 || speed == 0)
+        {
+            count = 0;
+            first = 0;
+        }
+        else if (count > Size - first)
+        {
+            count = Size - first;
+        }
+        cycleFirst = first;
+        cycleCount = count;
+        cycleOffset = 0;
+        cycleReverse = speed < 0;
+        cycle.SetRate(speed < 0 ? -speed : speed);
+        dirty = true;
+    }
+
+    // Move the fade and the cycle on by elapsed seconds, returns true when the colors changed.
+    bool Update(float elapsed)
+    {
+        bool changed = dirty;
+        if (fading)
+        {
+            fadeTime += elapsed;
+            if (fadeTime >= fadeSeconds)
+            {
+                ::memcpy(entries, to, sizeof(entries));
+                fading = false;
+            }
+            else
+            {
+                PixelKernels::LerpSpan(entries, from, to, Size, PixelKernels::Fraction(fadeTime / fadeSeconds));
+            }
+            changed = true;
+        }
+        if (cycleCount > 0)
+        {
+            int steps = cycle.Advance(elapsed) % cycleCount;
+            if (steps > 0)
+            {
+                cycleOffset = (cycleOffset + (cycleReverse ? cycleCount - steps : steps)) % cycleCount;
+                changed = true;
+            }
+        }
+        if (changed)
+        {
+            Rebuild();
+        }
+        return changed;
+    }
+
+    // The color of a pixel with this index.
+    uint32_t Lookup(uint8_t index) const
+    {
+        return table[index];
+    }
+
+    // Look up count indices into dst.
+    void Expand(uint32_t* dst, const uint8_t* indices, uint32_t count) const
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            dst[i] = table[indices[i]];
+        }
+    }
+
+    uint32_t GetVersion() const { return version; }
+    bool IsFading() const { return fading; }
+    bool IsCycling() const { return cycleCount > 0; }
+
+private:
+    void Rebuild()
+    {
+        ::memcpy(table, entries, sizeof(table));
+        for (int i = 0; i < cycleCount; i++)
+        {
+            table[cycleFirst + i] = entries[cycleFirst + (i + cycleOffset) % cycleCount];
+        }
+        dirty = false;
+        version++;
+    }
+};
+
+#endif
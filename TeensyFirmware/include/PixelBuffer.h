@@ -8,42 +8,88 @@
 #include "Timer.h"
 #include "Color.h"
 #include "Status.h"
+#include "StripLayout.h"
+#include "FrameArena.h"
 
 #ifndef UNITTEST
 #include "MultiWS2812.h"
 #endif
 
+// Something drawn over every frame as it is written, without becoming part of the back buffer
+// (see Compositor).  Compose() draws on the back buffer just before it is presented and
+// Restore() puts back what it drew over, so the animations always find their own pixels.
+class FrameOverlay
+{
+public:
+    virtual ~FrameOverlay() {}
+    virtual void Compose() = 0;
+    virtual void Restore() = 0;
+};
+
+// The driver specialized on the strip layout this firmware is built for.
+typedef MultiWS2812<LEDLayout::Strips, LEDLayout::LedsPerStrip, LEDLayout::Pins> LEDDriver;
+
 // This class abstracts the 16 LED strips as one big pixel buffer that we can setup.
 // It provides a "write" method which then sends the buffer to the Teensy.
+//
+// The buffer is double buffered: everything draws into the back buffer (pixBuffer) while the
+// driver is still sending the front buffer, and Present() hands the back buffer over once the
+// driver is done with the front buffer.  The back buffer keeps its contents after Present(),
+// so drawing on top of the previous frame works the same as with a single buffer.
+//
+// It also tracks the highest row (LED index) that changed since the last Present(), Write() only
+// sends the strips up to that row since the LEDs after it keep their colors.  Anything that
+// takes the raw pixels through GetPixelBuffer() marks the whole buffer as changed.
+//
+// The size of the buffer comes from LEDLayout, so all the loops over strips and LEDs have
+// compile time bounds.  Both buffers are slots of the FrameArena.
+//
+// The pixels are stored a row at a time, a row being the same LED on every strip (which is the
+// order the driver sends them in).  Code that touches many pixels should go through Span(),
+// GetRow() and ForEachRow() so it walks the memory in that order, SetPixel() and SetColumn()
+// stride through a whole row per LED.
 class PixelBuffer
 {
-    uint32_t* pixBuffer = nullptr;
-    MultiWS2812 strips;
-    int numStrips;
-    int ledsPerStrip;
+    FrameSlot backSlot;
+    FrameSlot frontSlot;
+    uint32_t* pixBuffer = nullptr;      // back buffer, what gets drawn
+    uint32_t* frontBuffer = nullptr;    // front buffer, what the driver is sending
+    LEDDriver strips;
+    static const int numStrips = LEDLayout::Strips;
+    static const int ledsPerStrip = LEDLayout::LedsPerStrip;
+    int dirtyRows = 0;  // rows [0, dirtyRows) changed since the last Present()
+    bool dithering = false; // the driver dithers, so every Write() sends a frame
+    FrameOverlay* overlay = nullptr;
     float fps = 0;
 
+    inline void MarkDirty(int rows)
+    {
+        if (rows > dirtyRows)
+        {
+            dirtyRows = rows;
+        }
+    }
+
 public:
-    PixelBuffer(int numStrips, int ledsPerStrip) : strips(ledsPerStrip, numStrips)
+    PixelBuffer()
     {
-        this->numStrips = numStrips;
-        this->ledsPerStrip = ledsPerStrip;
     }
 
     ~PixelBuffer()
     {
-        if (pixBuffer != nullptr) {
-            delete[] pixBuffer;
-            pixBuffer = nullptr;
+        if (frontBuffer != nullptr) {
+            while (strips.sending());
+            frontBuffer = nullptr;
         }
         strips.setBuffer(nullptr);
+        // the slots go back to the arena with backSlot and frontSlot.
     }
 
     void Initialize()
     {
         if (pixBuffer == nullptr)
         {
-            pixBuffer = new uint32_t[GetNumberOfPixels()];
+            pixBuffer = backSlot.Acquire();
         }
         if (pixBuffer == nullptr)
         {
@@ -52,7 +98,7 @@ public:
         else
         {
             ::memset(pixBuffer, 0, GetBufferSize());
-            strips.setBuffer(pixBuffer);
+            dirtyRows = ledsPerStrip;
         }
     }
 
@@ -61,16 +107,65 @@ public:
         strips.printTimingCycleStats();
     }
 
-	MultiWS2812& GetDriver() { return strips; }
+	LEDDriver& GetDriver() { return strips; }
     int NumStrips() { return numStrips; }
     int NumLedsPerStrip() { return ledsPerStrip; }
     float GetFps() { return fps; }
 
-    uint32_t* GetPixelBuffer() { return pixBuffer; }
+    uint32_t* GetPixelBuffer()
+    {
+        MarkDirty(ledsPerStrip);
+        return pixBuffer;
+    }
+
+    // All GetNumberOfPixels() pixels in storage order, for the effects that treat every pixel
+    // the same way (fades, dimming, copies), marked as changed.
+    uint32_t* Span()
+    {
+        return GetPixelBuffer();
+    }
 
-    uint32_t* CopyPixels()
+    int GetDirtyRows() { return dirtyRows; }
+
+    // The pixels of one LED on every strip, NumStrips() of them indexed by strip, marked as
+    // changed.
+    uint32_t* GetRow(int led)
     {
-        auto result = new uint32_t[GetNumberOfPixels()];
+        MarkDirty(led + 1);
+        return pixBuffer + (led * numStrips);
+    }
+
+    // Call fn(led, row) for every LED in storage order, row is GetRow(led).
+    template <typename RowFunction>
+    void ForEachRow(RowFunction fn)
+    {
+        for (int led = 0; led < ledsPerStrip; led++)
+        {
+            fn(led, pixBuffer + (led * numStrips));
+        }
+        MarkDirty(ledsPerStrip);
+    }
+
+    // Fill the row of one LED on every strip with a color.
+    static inline void FillRow(uint32_t* row, uint32_t color)
+    {
+        for (int strip = 0; strip < numStrips; strip++)
+        {
+            row[strip] = color;
+        }
+    }
+
+    // Drawn over every frame that is written, nullptr for none.
+    void SetOverlay(FrameOverlay* frameOverlay)
+    {
+        overlay = frameOverlay;
+    }
+
+    // Copy the pixels into a frame slot (acquiring it if it has none) and return them, nullptr
+    // when there is no free slot.
+    uint32_t* CopyPixels(FrameSlot& slot)
+    {
+        auto result = slot.Acquire();
         if (result == nullptr)
         {
             CrashPrint("### CopyPixels: out of memory!\r\n");
@@ -100,6 +195,35 @@ public:
             size = expectedSize;
         }
         ::memcpy(pixBuffer, source, size);
+        uint32_t rowSize = numStrips * sizeof(uint32_t);
+        MarkDirty((int)((size + rowSize - 1) / rowSize));
+    }
+
+    // Make the frame in the slot the back buffer without copying it, the slot gets the old back
+    // buffer (or no slot) in exchange.  The frame has to be in storage order and a whole
+    // GetBufferSize() long.  An empty slot leaves the buffer as it was.
+    void Exchange(FrameSlot& slot)
+    {
+        if (slot.Get() == nullptr)
+        {
+            return;
+        }
+        backSlot.Swap(slot);
+        pixBuffer = backSlot.Get();
+        MarkDirty(ledsPerStrip);
+    }
+
+    // Trade back buffers with another PixelBuffer, for a cross fade target that becomes the
+    // frame on display when the fade ends.
+    void Exchange(PixelBuffer& other)
+    {
+        if (other.pixBuffer == nullptr)
+        {
+            return;
+        }
+        Exchange(other.backSlot);
+        other.pixBuffer = other.backSlot.Get();
+        other.MarkDirty(ledsPerStrip);
     }
 
     void CopyTo(uint32_t* source, uint32_t size)
@@ -117,25 +241,18 @@ public:
     {
         // pack colors according to neopixel format.
         uint32_t value = color.pack();
-        for (int i = 0; i < numStrips; i++)
+        uint32_t* pixels = Span();
+        uint32_t count = GetNumberOfPixels();
+        for (uint32_t i = 0; i < count; i++)
         {
-            for (int j = 0; j < ledsPerStrip; j++)
-            {
-                uint32_t* pixel = (uint32_t*)(pixBuffer + (j * numStrips) + i);
-                *pixel = value;
-            }
+            pixels[i] = value;
         }
     }
 
     // Set a pixel on all strips to this color (so it is a row across the strips).
     void SetRow(Color color, int index)
     {
-        uint32_t value = color.pack();
-        for (int j = 0; j < numStrips; j++)
-        {
-            uint32_t* pixel = (uint32_t*)(pixBuffer + (index * numStrips) + j);
-            *pixel = value;
-        }
+        FillRow(GetRow(index), color.pack());
     }
 
     // Set one color for every led in a strip.
@@ -147,6 +264,7 @@ public:
             uint32_t* pixel = (uint32_t*)(pixBuffer + (i * numStrips) + strip);
             *pixel = value;
         }
+        MarkDirty(ledsPerStrip);
     }
 
     // Set individual colors for every led in a strip.
@@ -160,7 +278,7 @@ public:
         }
         Color black{0,0,0};
         // turn off everything else that was not specified.
-        while (i++ < ledsPerStrip)
+        for (; i < ledsPerStrip; i++)
         {
             SetPixel(black, strip, i);
         }
@@ -170,6 +288,7 @@ public:
     {
         uint32_t* pixel = (uint32_t*)(pixBuffer + (led * numStrips) + strip);
         *pixel = c.pack();
+        MarkDirty(led + 1);
     }
 
     inline Color GetPixel(int strip, int led)
@@ -183,52 +302,105 @@ public:
         float dr = (float)end.r - (float)start.r;
         float dg = (float)end.g - (float)start.g;
         float db = (float)end.b - (float)start.b;
-        for (int i = 0; i < numStrips; i++)
-        {
-            for (int j = 0; j < ledsPerStrip; j++)
-            {
-                uint32_t* pixel = (uint32_t*)(pixBuffer + (j * numStrips) + i);
-                double percent = (double)j / ledsPerStrip;
-                Color ic{ (uint8_t)(start.r + (percent * dr)),
-                          (uint8_t)(start.g + (percent * dg)),
-                          (uint8_t)(start.b + (percent * db)) };
-                *pixel = ic.pack();
-            }
-        }
+        // every strip has the same color at an LED, so it is one color per row.
+        ForEachRow([&](int led, uint32_t* row) {
+            double percent = (double)led / ledsPerStrip;
+            Color ic{ (uint8_t)(start.r + (percent * dr)),
+                      (uint8_t)(start.g + (percent * dg)),
+                      (uint8_t)(start.b + (percent * db)) };
+            FillRow(row, ic.pack());
+        });
     }
 
     // Setup output pins for Ada:
     void setOutputPins() {
 
-        // Setup output pins and initialize strips array->GPIO mapping
+        // Setup output pins, the strip to GPIO mapping is LEDLayout::Pins
         pinMode(1, OUTPUT);
         pinMode(3, OUTPUT);
+        strips.begin();
+
+#if MULTIWS2812_DMA_OUTPUT
+        // Let the DMA send the frames so Write() returns while the strips are updating,
+        // otherwise we keep the bit-bang output.
+        if (!strips.enableDma())
+        {
+            DebugPrint("### DMA output not available, using bit-bang output\r\n");
+        }
+#endif
+    }
+
+    // Make the back buffer the next frame the driver sends and return the number of rows that
+    // changed, which is all the driver has to send.  The front buffer is only allocated here so
+    // the target buffers of the cross fades, which are never written, don't pay for it.
+    int Present()
+    {
+        if (pixBuffer == nullptr)
+        {
+            return 0;
+        }
+        if (frontBuffer == nullptr)
+        {
+            frontBuffer = frontSlot.Acquire();
+            if (frontBuffer == nullptr)
+            {
+                CrashPrint("### Present: out of memory!\r\n");
+                return 0;
+            }
+            strips.setBuffer(frontBuffer);
+            dirtyRows = ledsPerStrip;
+        }
+        // wait for the driver to finish reading the previous frame, then copy rather than
+        // swap so the back buffer (and GetPixelBuffer()) stays the frame we just drew.
+        // Only the changed rows differ from the front buffer.
+        int rows = dirtyRows < ledsPerStrip ? dirtyRows : ledsPerStrip;
+        dirtyRows = 0;
+        while (strips.sending());
+        ::memcpy(frontBuffer, pixBuffer, rows * numStrips * sizeof(uint32_t));
+        return rows;
+    }
 
-        // Level Shifter 1 (U1)
-        strips.enableOutputPin(0, 22); // 6
-        strips.enableOutputPin(1, 23); // 6
-        strips.enableOutputPin(2, 19); // 6
-        strips.enableOutputPin(3, 18); // 6
-        strips.enableOutputPin(4, 17); // 6
-        strips.enableOutputPin(5, 16); // 6
-        strips.enableOutputPin(6, 15); // 6
-        strips.enableOutputPin(7, 14); // 6
-
-        // Level Shifter 2 (U2)
-        strips.enableOutputPin(8, 21); // 6
-        strips.enableOutputPin(1, 6); // 7
-        strips.enableOutputPin(2, 7); // 7
-        strips.enableOutputPin(3, 8); // 7
-        strips.enableOutputPin(4, 9); // 7
-        strips.enableOutputPin(5, 10); // 7
-        strips.enableOutputPin(6, 11); // 7
-        strips.enableOutputPin(7, 12); // 7
+    // Color correction applied by the driver while it sends the frames, so dimming the whole
+    // display or gamma correcting linear pixels costs nothing per pixel here.  Temporal dithering
+    // only moves while frames are being written.
+    void SetColorCorrection(float brightness, float gammaR, float gammaG, float gammaB, bool dither)
+    {
+        if (strips.setColorCorrection(brightness, gammaR, gammaG, gammaB, dither))
+        {
+            dithering = dither;
+        }
+        // the strips show the old correction until every row is sent again.
+        MarkDirty(ledsPerStrip);
     }
 
     int Write()
     {
-        strips.show();
+        if (overlay != nullptr)
+        {
+            overlay->Compose();
+        }
+        int rows = Present();
+        if (overlay != nullptr)
+        {
+            // the front buffer has the overlay, the back buffer goes back to what was drawn.
+            overlay->Restore();
+        }
+        if (rows == 0 && !dithering)
+        {
+            // nothing changed, the strips already show this frame.
+            return 0;
+        }
+        strips.show(rows);
         gTeensyStatus.draws++;
+
+        // a DMA frame is still being sent, so these are mostly from the previous frame.
+        const WS2812Stats& stats = strips.getStats();
+        gTeensyStatus.fps = stats.fps;
+        gTeensyStatus.frameCycles = stats.frameCycles;
+        gTeensyStatus.setupCycles = stats.setupCycles;
+        gTeensyStatus.setupBudget = stats.setupBudget;
+        gTeensyStatus.latchWaitCycles = stats.latchWaitCycles;
+        gTeensyStatus.missedDeadlines = stats.missedDeadlines;
         return 0;
     }
 
@@ -0,0 +1,161 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#ifndef _PIXELKERNELS_H
+#define _PIXELKERNELS_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Per channel math on packed pixels (the 0x00GGRRBB words of the PixelBuffer), a whole pixel at
+// a time instead of unpacking it into three floats.  The multiplies split a pixel into the
+// G/B and R byte lanes spread over 16 bits each, so one 32 bit multiply does two channels and
+// the lanes never carry into each other.  The saturating add/subtract and the average use the
+// Cortex-M7 UQADD8/UQSUB8/UHADD8 instructions on the Teensy and the equivalent SWAR code
+// everywhere else, the results are the same bit for bit so TeensyUnitTest checks what the
+// firmware runs.
+//
+// Fractions are 0-256, where 256 is all of the second color (see Fraction()).
+class PixelKernels
+{
+public:
+    static const uint32_t One = 256;
+
+    // A 0-1 float as a fraction, clamped.
+    static inline uint32_t Fraction(float percent)
+    {
+        if (!(percent > 0))
+            return 0;
+        if (percent >= 1)
+            return One;
+        return (uint32_t)(percent * One);
+    }
+
+    // a + (b - a) * t / 256 on every channel, rounded down, t is 0-256.
+    static inline uint32_t Lerp(uint32_t a, uint32_t b, uint32_t t)
+    {
+        uint32_t s = One - t;
+        uint32_t lo = ((a & 0x00FF00FF) * s + (b & 0x00FF00FF) * t) >> 8;
+        uint32_t hi = ((a >> 8) & 0x00FF00FF) * s + ((b >> 8) & 0x00FF00FF) * t;
+        return (lo & 0x00FF00FF) | (hi & 0xFF00FF00);
+    }
+
+    // Every channel times s / 256, rounded down.
+    static inline uint32_t Scale(uint32_t a, uint32_t s)
+    {
+        uint32_t lo = ((a & 0x00FF00FF) * s) >> 8;
+        uint32_t hi = ((a >> 8) & 0x00FF00FF) * s;
+        return (lo & 0x00FF00FF) | (hi & 0xFF00FF00);
+    }
+
+    // a + b on every channel, saturating at 255.
+    static inline uint32_t AddSaturate(uint32_t a, uint32_t b)
+    {
+#if defined(__ARM_FEATURE_DSP) && !defined(UNITTEST)
+        uint32_t result;
+        asm("uqadd8 %0, %1, %2" : "=r"(result) : "r"(a), "r"(b));
+        return result;
+#else
+        // add the low 7 bits, then bit 7 and its carry out by hand so no byte carries into the next.
+        uint32_t low = (a & 0x7F7F7F7F) + (b & 0x7F7F7F7F);
+        uint32_t carry = ((a & b) | ((a | b) & low)) & 0x80808080;
+        return (low ^ ((a ^ b) & 0x80808080)) | ((carry >> 7) * 0xFF);
+#endif
+    }
+
+    // a - b on every channel, saturating at 0.
+    static inline uint32_t SubSaturate(uint32_t a, uint32_t b)
+    {
+#if defined(__ARM_FEATURE_DSP) && !defined(UNITTEST)
+        uint32_t result;
+        asm("uqsub8 %0, %1, %2" : "=r"(result) : "r"(a), "r"(b));
+        return result;
+#else
+        // 255 - min(255, (255 - a) + b) is max(0, a - b).
+        return ~AddSaturate(~a, b);
+#endif
+    }
+
+    // The brighter of a and b on every channel.
+    static inline uint32_t Max(uint32_t a, uint32_t b)
+    {
+        // no channel can carry, b + (a - b) is at most a.
+        return b + SubSaturate(a, b);
+    }
+
+    // (a + b) / 2 on every channel, rounded down.
+    static inline uint32_t Average(uint32_t a, uint32_t b)
+    {
+#if defined(__ARM_FEATURE_DSP) && !defined(UNITTEST)
+        uint32_t result;
+        asm("uhadd8 %0, %1, %2" : "=r"(result) : "r"(a), "r"(b));
+        return result;
+#else
+        return (a & b) + (((a ^ b) & 0xFEFEFEFE) >> 1);
+#endif
+    }
+
+    // The same gray level on every channel, for AddSaturate().
+    static inline uint32_t Gray(uint8_t level)
+    {
+        return level * 0x010101u;
+    }
+
+    // dst[i] = Lerp(a[i], b[i], t), dst may be a or b.
+    static void LerpSpan(uint32_t* dst, const uint32_t* a, const uint32_t* b, uint32_t count, uint32_t t)
+    {
+        if (t == 0)
+        {
+            CopySpan(dst, a, count);
+            return;
+        }
+        if (t >= One)
+        {
+            CopySpan(dst, b, count);
+            return;
+        }
+        for (uint32_t i = 0; i < count; i++)
+        {
+            dst[i] = Lerp(a[i], b[i], t);
+        }
+    }
+
+    // dst[i] = Scale(src[i], s), dst may be src.
+    static void ScaleSpan(uint32_t* dst, const uint32_t* src, uint32_t count, uint32_t s)
+    {
+        if (s >= One)
+        {
+            CopySpan(dst, src, count);
+            return;
+        }
+        for (uint32_t i = 0; i < count; i++)
+        {
+            dst[i] = Scale(src[i], s);
+        }
+    }
+
+    // dst[i] = AddSaturate(src[i], color), dst may be src.
+    static void AddSpan(uint32_t* dst, const uint32_t* src, uint32_t count, uint32_t color)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            dst[i] = AddSaturate(src[i], color);
+        }
+    }
+
+    // dst[i] = Lerp(dst[i], src[i], t), src drawn over dst with opacity t.
+    static void BlendSpan(uint32_t* dst, const uint32_t* src, uint32_t count, uint32_t t)
+    {
+        LerpSpan(dst, dst, src, count, t);
+    }
+
+private:
+    static void CopySpan(uint32_t* dst, const uint32_t* src, uint32_t count)
+    {
+        if (dst != src)
+        {
+            ::memmove(dst, src, count * sizeof(uint32_t));
+        }
+    }
+};
+
+#endif
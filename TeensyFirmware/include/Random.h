@@ -0,0 +1,58 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#ifndef _RANDOM_H
+#define _RANDOM_H
+
+#include <stdint.h>
+
+// A small xorshift32 generator for the animations that need random numbers every frame.  It is
+// a few shifts and xors instead of a call into the C library's rand(), it keeps its own state
+// so one animation doesn't change what another one draws, and a given seed produces the same
+// numbers on the Teensy and in TeensyUnitTest so the frames can be compared bit for bit.
+class Random
+{
+    uint32_t state;
+
+public:
+    static const uint32_t DefaultSeed = 0x2545F491;
+
+    Random(uint32_t seed = DefaultSeed)
+    {
+        Seed(seed);
+    }
+
+    // xorshift never leaves 0, so 0 is the default seed.
+    void Seed(uint32_t seed)
+    {
+        state = seed != 0 ? seed : DefaultSeed;
+    }
+
+    uint32_t Next()
+    {
+        uint32_t x = state;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        state = x;
+        return x;
+    }
+
+    // 0 to n - 1, scaled with a multiply instead of a divide.
+    uint32_t Below(uint32_t n)
+    {
+        return (uint32_t)(((uint64_t)Next() * n) >> 32);
+    }
+
+    // min to max inclusive.
+    int Range(int min, int max)
+    {
+        return min + (int)Below((uint32_t)(max - min + 1));
+    }
+
+    uint8_t Byte()
+    {
+        return (uint8_t)(Next() >> 24);
+    }
+};
+
+#endif
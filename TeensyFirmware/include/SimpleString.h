@@ -30,52 +30,77 @@ void CrashPrint(const char* format, ...)
     while (timer.milliseconds() < 1000);
 }
 
+// A null terminated string that keeps short strings (command names, most errors) inside the
+// object and only allocates when one grows past InlineSize.  An allocation is kept as a high
+// water mark, so a string that is reused (like the name the parser reads into) stops
+// allocating once it has seen its longest value.
 class SimpleString
 {
+public:
+    static const size_t InlineSize = 32; // including the null terminator
+
 private:
-    char* ptr = nullptr;
-    size_t allocated = 0;
+    char local[InlineSize];
+    char* ptr = local;
+    size_t allocated = InlineSize;
     size_t used = 0;
-public:
-    SimpleString() {}
-    SimpleString(const char* s)
+
+    bool IsInline() const { return ptr == local; }
+
+    void assign(const char* s, size_t size)
     {
-        auto size = strlen(s);
+        if (s == nullptr)
+        {
+            size = 0;
+        }
         reserve(size);
-        if (ptr != nullptr) {
-            strcpy(ptr, s);
-            used = size;
+        if (size > 0)
+        {
+            ::memmove(ptr, s, size);
         }
+        used = size;
+        ptr[used] = '\0';
     }
 
-
-    SimpleString(const SimpleString& other)
+    void append(const char* s, size_t size)
     {
-        if (other.ptr != nullptr)
+        if (used + size + 1 > allocated)
         {
-            auto size = strlen(other.c_str());
-            reserve(size);
-
-            if (ptr != nullptr)
-            {
-                strcpy(ptr, other.c_str());
-                used = size;
-            }
+            // grow by doubling so appending a character at a time doesn't allocate every time.
+            size_t grow = allocated * 2;
+            reserve(used + size > grow ? used + size : grow);
         }
+        ::memcpy(ptr + used, s, size);
+        used += size;
+        ptr[used] = '\0';
+    }
+
+public:
+    SimpleString()
+    {
+        local[0] = '\0';
+    }
+
+    SimpleString(const char* s)
+    {
+        local[0] = '\0';
+        assign(s, s != nullptr ? strlen(s) : 0);
+    }
+
+    SimpleString(const SimpleString& other)
+    {
+        local[0] = '\0';
+        assign(other.ptr, other.used);
     }
 
     SimpleString(SimpleString&& moved)
     {
-        ptr = moved.ptr;
-        allocated = moved.allocated;
-        used = moved.used;
-        moved.ptr = nullptr;
-        moved.used = 0;
-        moved.allocated = 0;
+        local[0] = '\0';
+        operator=(static_cast<SimpleString&&>(moved));
     }
 
     ~SimpleString() {
-        if (ptr != nullptr) {
+        if (!IsInline()) {
             delete[] ptr;
         }
     }
@@ -84,9 +109,10 @@ public:
         return used;
     }
 
+    // Make room for a string of this size plus the null terminator.
     void reserve(size_t size)
     {
-        if (size + 1 >= allocated )
+        if (size + 1 > allocated)
         {
             char* newptr = new char[size + 1];
             if (newptr == nullptr)
@@ -94,15 +120,8 @@ public:
                 CrashPrint("### SimpleString: out of memory!\r\n");
                 return;
             }
-            if (used > 0)
-            {
-                ::memcpy(newptr, ptr, used + 1);
-            }
-            else
-            {
-                newptr[0] = 0;
-            }
-            if (ptr != nullptr) {
+            ::memcpy(newptr, ptr, used + 1);
+            if (!IsInline()) {
                 delete[] ptr;
             }
             ptr = newptr;
@@ -112,48 +131,68 @@ public:
 
     SimpleString& operator=(const char* s)
     {
-        auto size = strlen(s);
-        reserve(size);
-        strcpy(ptr, s);
-        used = size;
+        assign(s, s != nullptr ? strlen(s) : 0);
         return *this;
     }
 
     SimpleString& operator=(const SimpleString& s)
     {
-        return operator=(s.c_str());
+        if (this != &s)
+        {
+            assign(s.ptr, s.used);
+        }
+        return *this;
+    }
+
+    // Takes the allocation of a long string instead of copying it.
+    SimpleString& operator=(SimpleString&& moved)
+    {
+        if (this == &moved)
+        {
+            return *this;
+        }
+        if (moved.IsInline())
+        {
+            assign(moved.ptr, moved.used);
+        }
+        else
+        {
+            if (!IsInline()) {
+                delete[] ptr;
+            }
+            ptr = moved.ptr;
+            allocated = moved.allocated;
+            used = moved.used;
+            moved.ptr = moved.local;
+            moved.allocated = InlineSize;
+        }
+        moved.used = 0;
+        moved.ptr[0] = '\0';
+        return *this;
     }
 
     bool operator==(const char* s) const {
         if (s == nullptr) {
-            return ptr == nullptr;
-        }
-        else if (ptr == nullptr) {
-            return false;
+            return used == 0;
         }
         return strcmp(ptr, s) == 0;
     }
 
     bool operator==(const SimpleString& s) const {
-        return operator==(s.c_str());
+        return used == s.used && ::memcmp(ptr, s.ptr, used) == 0;
     }
 
     SimpleString& operator+(char ch)
     {
-        if (used + 1 >= allocated) {
-            reserve(allocated + 100);
-        }
-        ptr[used++] = ch;
-        ptr[used] = '\0';
+        append(&ch, 1);
         return *this;
     }
 
     SimpleString& operator+(const char* s1)
     {
-        auto size = used + strlen(s1);
-        reserve(size);
-        strcat(ptr, s1);
-        used = size;
+        if (s1 != nullptr) {
+            append(s1, strlen(s1));
+        }
         return *this;
     }
 
@@ -164,12 +203,18 @@ public:
 
     SimpleString& operator+(const SimpleString& s1)
     {
-        return operator+(s1.c_str());
+        if (&s1 == this)
+        {
+            // make the room first so appending doesn't free what it copies from.
+            reserve(used * 2);
+        }
+        append(s1.ptr, s1.used);
+        return *this;
     }
 
     SimpleString& operator+=(const SimpleString& s1)
     {
-        return operator+(s1.c_str());
+        return operator+(s1);
     }
 
     SimpleString& operator+=(const char* s1)
@@ -179,19 +224,20 @@ public:
 
     const char* c_str() const { return ptr; }
 
+    // Empty the string, keeping any allocation for the next value.
     void clear(){
         used = 0;
+        ptr[0] = '\0';
     }
 };
 
 static SimpleString stringf(const char* format, ...)
 {
-   SimpleString result;
-   result.reserve(1024);
+   char buf[1024];
    va_list ap;
    va_start(ap, format);
-   vsnprintf((char*)result.c_str(), 1024, format, ap);
-   return result;
+   vsnprintf(buf, sizeof(buf), format, ap);
+   return SimpleString(buf);
 }
 
 #endif
\ No newline at end of file
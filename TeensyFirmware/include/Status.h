@@ -3,11 +3,25 @@
 #ifndef _STATUS_H
 #define _STATUS_H
 
+#include <stdint.h>
+
 struct TeensyStatus
 {
     int draws;
     int headers;
     int commands;
+    // Output timing of the LED driver, copied from its counters on every draw (see WS2812Stats).
+    uint32_t fps;
+    uint32_t frameCycles;
+    uint32_t setupCycles;
+    uint32_t setupBudget;
+    uint32_t latchWaitCycles;
+    uint32_t missedDeadlines;
+    // Animation frames that started a whole frame late (see FrameScheduler).
+    uint32_t overruns;
+    // Frame slots of the FrameArena in use now and the most that were ever in use at once.
+    uint32_t frameSlots;
+    uint32_t frameSlotsHighWater;
 };
 
 extern TeensyStatus gTeensyStatus;
@@ -0,0 +1,180 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#ifndef _STRIPLAYOUT_H
+#define _STRIPLAYOUT_H
+
+#include <stdint.h>
+
+// The port and bit of a Teensy 4.0 pin on the fast GPIO ports, port is 0 for pins that
+// cannot drive a strip.
+struct WS2812Pin
+{
+    uint8_t port;
+    uint8_t bit;
+};
+
+// Teensy 4.0 pins on GPIO6/GPIO7 (the same bits are used on GPIO1/GPIO2 for the DMA output).
+constexpr WS2812Pin GetWS2812Pin(uint32_t pin)
+{
+    switch (pin)
+    {
+        /*
+            +-------+----------+------+-------+
+            |  Pin  |   Name   | GPIO |  PORT |
+            +-------+----------+------+-------+
+            | 0     | AD_B0_03 |  1.3 | GPIO6 |
+            | 1     | AD_B0_02 |  1.2 | GPIO6 |
+            | 14/A0 | AD_B1_02 | 1.18 | GPIO6 |
+            | 15/A1 | AD_B1_03 | 1.19 | GPIO6 |
+            | 16/A2 | AD_B1_07 | 1.23 | GPIO6 |
+            | 17/A3 | AD_B1_06 | 1.22 | GPIO6 |
+            | 18/A4 | AD_B1_01 | 1.17 | GPIO6 |
+            | 19/A5 | AD_B1_00 | 1.16 | GPIO6 |
+            | 20/A6 | AD_B1_10 | 1.26 | GPIO6 |
+            | 21/A7 | AD_B1_11 | 1.27 | GPIO6 |
+            | 22/A8 | AD_B1_08 | 1.24 | GPIO6 |
+            | 23/A9 | AD_B1_09 | 1.25 | GPIO6 |
+            | 24    | AD_B0_12 | 1.12 | GPIO6 |
+            | 25    | AD_B0_13 | 1.13 | GPIO6 |
+            | 26    | AD_B1_14 | 1.30 | GPIO6 |
+            | 27    | AD_B1_15 | 1.31 | GPIO6 |
+            +-------+----------+------+-------+
+        */
+    case 0: return WS2812Pin{ 6, 3 };
+    case 1: return WS2812Pin{ 6, 2 };  // debug pin when built with MULTIWS2812_FAST_DBG_GPIO
+    case 14: return WS2812Pin{ 6, 18 };
+    case 15: return WS2812Pin{ 6, 19 };
+    case 16: return WS2812Pin{ 6, 23 };
+    case 17: return WS2812Pin{ 6, 22 };
+    case 18: return WS2812Pin{ 6, 17 };
+    case 19: return WS2812Pin{ 6, 16 };
+    case 20: return WS2812Pin{ 6, 26 };
+    case 21: return WS2812Pin{ 6, 27 };
+    case 22: return WS2812Pin{ 6, 24 };
+    case 23: return WS2812Pin{ 6, 25 };
+    case 24: return WS2812Pin{ 6, 12 };
+    case 25: return WS2812Pin{ 6, 13 };
+    case 26: return WS2812Pin{ 6, 30 };
+    case 27: return WS2812Pin{ 6, 31 };
+        /*
+          +-------+----------+------+-------+
+          |  Pin  |   Name   | GPIO |  PORT |
+          +-------+----------+------+-------+
+          | 6     | B0_10    | 2.10 | GPIO7 |
+          | 7     | B1_01    | 2.17 | GPIO7 |
+          | 8     | B1_00    | 2.16 | GPIO7 |
+          | 9     | B0_11    | 2.11 | GPIO7 |
+          | 10    | B0_00    |  2.0 | GPIO7 |
+          | 11    | B0_02    |  2.2 | GPIO7 |
+          | 12    | B0_01    |  2.1 | GPIO7 |
+          | 13    | B0_03    |  2.3 | GPIO7 |
+          | 32    | B0_12    | 2.12 | GPIO7 |
+          +-------+----------+------+-------+
+        */
+    case 6: return WS2812Pin{ 7, 10 };
+    case 7: return WS2812Pin{ 7, 17 };
+    case 8: return WS2812Pin{ 7, 16 };
+    case 9: return WS2812Pin{ 7, 11 };
+    case 10: return WS2812Pin{ 7, 0 };
+    case 11: return WS2812Pin{ 7, 2 };
+    case 12: return WS2812Pin{ 7, 1 };
+    case 13: return WS2812Pin{ 7, 3 };  // onboard LED
+    case 32: return WS2812Pin{ 7, 12 };
+    default: return WS2812Pin{ 0, 0 };
+    }
+}
+
+// The pin of every strip, in strip order.
+template <uint8_t... Pins>
+struct PinMap
+{
+    static constexpr uint32_t Count = sizeof...(Pins);
+
+    static constexpr uint8_t Pin(uint32_t strip)
+    {
+        constexpr uint8_t pins[] = { Pins... };
+        return pins[strip];
+    }
+
+    // GPIO bit of the strip on the given port, or zero if the strip is wired to the other port.
+    static constexpr uint32_t Mask(uint32_t strip, uint32_t port)
+    {
+        return GetWS2812Pin(Pin(strip)).port == port ? (1u << GetWS2812Pin(Pin(strip)).bit) : 0;
+    }
+
+    // All pins can drive a strip and no pin is used twice.
+    static constexpr bool IsValid()
+    {
+        for (uint32_t i = 0; i < Count; i++)
+        {
+            if (GetWS2812Pin(Pin(i)).port == 0)
+                return false;
+#ifdef MULTIWS2812_FAST_DBG_GPIO
+            if (Pin(i) == 1)
+                return false;
+#endif
+            for (uint32_t j = 0; j < i; j++)
+            {
+                if (Pin(i) == Pin(j))
+                    return false;
+            }
+        }
+        return true;
+    }
+};
+
+template <uint8_t... Pins>
+constexpr uint32_t PinMap<Pins...>::Count;
+
+// The compile time geometry of the strips: how many strips, how long they are and the pin each
+// one is wired to.  The driver and PixelBuffer are specialized on it so loop bounds and port masks
+// are constants.
+template <uint32_t StripCount, uint32_t LedCount, typename Map>
+struct StripLayout
+{
+    typedef Map Pins;
+    static constexpr uint32_t Strips = StripCount;
+    static constexpr uint32_t LedsPerStrip = LedCount;
+    static constexpr uint32_t Pixels = StripCount * LedCount;
+
+    static_assert(StripCount > 0 && StripCount <= 32, "StripLayout supports 1 to 32 strips");
+    static_assert(LedCount > 0 && LedCount <= 0xffff, "StripLayout supports 1 to 65535 LEDs per strip");
+    static_assert(Map::Count == StripCount, "StripLayout needs one pin per strip");
+    static_assert(Map::IsValid(), "StripLayout pins must be distinct GPIO6/GPIO7 pins, and not the debug pin");
+
+    static constexpr uint32_t Mask6(uint32_t strip) { return Map::Mask(strip, 6); }
+    static constexpr uint32_t Mask7(uint32_t strip) { return Map::Mask(strip, 7); }
+
+    // Masks of all the outputs on each port.
+    static constexpr uint32_t PortMask(uint32_t port)
+    {
+        uint32_t mask = 0;
+        for (uint32_t strip = 0; strip < StripCount; strip++)
+        {
+            mask |= Map::Mask(strip, port);
+        }
+        return mask;
+    }
+    static constexpr uint32_t PortMask6 = PortMask(6);
+    static constexpr uint32_t PortMask7 = PortMask(7);
+};
+
+template <uint32_t StripCount, uint32_t LedCount, typename Map>
+constexpr uint32_t StripLayout<StripCount, LedCount, Map>::Strips;
+template <uint32_t StripCount, uint32_t LedCount, typename Map>
+constexpr uint32_t StripLayout<StripCount, LedCount, Map>::LedsPerStrip;
+template <uint32_t StripCount, uint32_t LedCount, typename Map>
+constexpr uint32_t StripLayout<StripCount, LedCount, Map>::Pixels;
+template <uint32_t StripCount, uint32_t LedCount, typename Map>
+constexpr uint32_t StripLayout<StripCount, LedCount, Map>::PortMask6;
+template <uint32_t StripCount, uint32_t LedCount, typename Map>
+constexpr uint32_t StripLayout<StripCount, LedCount, Map>::PortMask7;
+
+// Ada: 16 strips of 392 LEDs, level shifter 1 (U1) then level shifter 2 (U2).
+typedef PinMap<22, 23, 19, 18, 17, 16, 15, 14, 21, 6, 7, 8, 9, 10, 11, 12> AdaPins;
+typedef StripLayout<16, 392, AdaPins> AdaLayout;
+
+// The layout this firmware is built for.
+typedef AdaLayout LEDLayout;
+
+#endif
@@ -0,0 +1,223 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#ifndef _TIMELINE_H
+#define _TIMELINE_H
+
+#include <stdint.h>
+#include <string.h>
+#include "Timer.h"
+#include "Vector.h"
+#include "SimpleString.h"
+#include "FrameArena.h"
+
+// A list of cues uploaded with the Timeline command that the Controller plays by itself.  Each
+// cue is the name and payload of another command (the record the RpiController would send
+// without the header and CRC) and starts at its time from the start of the timeline, measured
+// on the GPT1 Timer, so a scripted show needs no round trip to the RpiController between its
+// steps.  A looping timeline starts over after its period, counted from when the last loop was
+// due so the loops don't drift.
+//
+// The cues are kept in a slot of the FrameArena while the timeline is loaded.
+class Timeline
+{
+public:
+    static const uint32_t MaxBytes = FrameArena::Pixels * sizeof(uint32_t);
+    static const uint32_t MaxName = 100;
+
+private:
+    struct Cue
+    {
+        uint32_t at;      // microseconds from the start of the loop
+        uint32_t name;    // offset of the null terminated command name
+        uint32_t payload; // offset of the payload
+        uint32_t length;  // of the payload
+    };
+
+    FrameSlot slot;
+    uint8_t* data = nullptr;
+    Vector<Cue> cues;
+    size_t next = 0;      // the next cue to start
+    bool loop = false;
+    bool playing = false;
+    uint32_t period = 0;  // microseconds
+    uint32_t origin = 0;  // when the current loop started on the clock
+    uint32_t loops = 0;
+    Timer clock;
+
+    uint32_t Now()
+    {
+        return (uint32_t)clock.microseconds() - origin;
+    }
+
+    static uint32_t ReadUInt32(const uint8_t* ptr)
+    {
+        return (uint32_t)ptr[0] | ((uint32_t)ptr[1] << 8) | ((uint32_t)ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+    }
+
+public:
+    // Load a timeline and start playing it, returns nullptr or the reason it was rejected.  The
+    // bytes are the flags (1 loops), the period in microseconds (0 loops at the last cue) and
+    // then the cues, each is its time in microseconds, the null terminated command name, the
+    // payload length and the payload.  The cues are in time order.
+    const char* Load(const uint8_t* bytes, uint32_t length)
+    {
+        Stop();
+        if (length > MaxBytes)
+        {
+            return "too long";
+        }
+        FrameSlot copy;
+        uint8_t* copied = reinterpret_cast<uint8_t*>(copy.Acquire());
+        if (copied == nullptr)
+        {
+            return "out of memory";
+        }
+        ::memcpy(copied, bytes, length);
+        return Load(static_cast<FrameSlot&&>(copy), length);
+    }
+
+    // The same with the bytes already in a frame slot, which the timeline takes ownership of
+    // so the cues aren't copied again.
+    const char* Load(FrameSlot&& bytes, uint32_t length)
+    {
+        Stop();
+        slot = static_cast<FrameSlot&&>(bytes);
+        if (length < 8)
+        {
+            return Fail("missing parameters");
+        }
+        if (length > MaxBytes)
+        {
+            return Fail("too long");
+        }
+        data = reinterpret_cast<uint8_t*>(slot.Get());
+        if (data == nullptr)
+        {
+            return "out of memory";
+        }
+        uint32_t flags = ReadUInt32(data);
+        period = ReadUInt32(data + 4);
+        loop = (flags & 1) != 0;
+
+        uint32_t position = 8;
+        uint32_t last = 0;
+        while (position < length)
+        {
+            Cue cue;
+            if (position + 4 > length)
+            {
+                return Fail("truncated cue");
+            }
+            cue.at = ReadUInt32(data + position);
+            position += 4;
+            cue.name = position;
+            while (position < length && data[position] != 0 && position - cue.name <= MaxName)
+            {
+                position++;
+            }
+            if (position + 5 > length || data[position] != 0)
+            {
+                return Fail("truncated cue");
+            }
+            position++;
+            cue.length = ReadUInt32(data + position);
+            position += 4;
+            cue.payload = position;
+            if (cue.length > length - position)
+            {
+                return Fail("truncated cue");
+            }
+            position += cue.length;
+            if (cue.at < last)
+            {
+                return Fail("cues out of order");
+            }
+            if (::strcmp((const char*)data + cue.name, "Timeline") == 0)
+            {
+                return Fail("a timeline can't be a cue");
+            }
+            last = cue.at;
+            cues.push_back(cue);
+        }
+        if (cues.size() == 0)
+        {
+            return Fail("no cues");
+        }
+        if (period < last)
+        {
+            period = last;
+        }
+        if (loop && period == 0)
+        {
+            return Fail("a loop needs a period");
+        }
+
+        next = 0;
+        loops = 0;
+        origin = 0;
+        playing = true;
+        clock.start();
+        return nullptr;
+    }
+
+    // Stop playing and let go of the cues.
+    void Stop()
+    {
+        playing = false;
+        cues.clear();
+        next = 0;
+        slot.Release();
+        data = nullptr;
+    }
+
+    // The next cue that is due, false when there isn't one yet.  payload points into the
+    // timeline and stays valid until it is stopped or loaded again.
+    bool NextCue(SimpleString& name, uint8_t*& payload, uint32_t& length)
+    {
+        if (!playing)
+        {
+            return false;
+        }
+        if (next == cues.size())
+        {
+            if (!loop)
+            {
+                Stop();
+                return false;
+            }
+            if ((int32_t)(Now() - period) < 0)
+            {
+                return false;
+            }
+            // a loop that is a whole period late starts now instead of catching up.
+            origin = (int32_t)(Now() - 2 * period) >= 0 ? (uint32_t)clock.microseconds() : origin + period;
+            next = 0;
+            loops++;
+        }
+        Cue& cue = cues[next];
+        if ((int32_t)(Now() - cue.at) < 0)
+        {
+            return false;
+        }
+        next++;
+        name = (const char*)data + cue.name;
+        payload = data + cue.payload;
+        length = cue.length;
+        return true;
+    }
+
+    bool IsPlaying() { return playing; }
+    bool IsLooping() { return loop; }
+    int NumCues() { return (int)cues.size(); }
+    uint32_t GetLoops() { return loops; }
+    uint32_t GetPeriod() { return period; }
+
+private:
+    const char* Fail(const char* reason)
+    {
+        Stop();
+        return reason;
+    }
+};
+
+#endif
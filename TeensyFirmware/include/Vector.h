@@ -4,6 +4,8 @@
 
 #include "SimpleString.h"
 
+// A growable array.  clear() keeps the allocation, so a Vector that is reused (like the colors
+// of the Command) only allocates until it has reached its largest size.
 template <typename T>
 class Vector
 {
@@ -17,10 +19,19 @@ public:
 
     Vector(const Vector& other)
     {
+        reserve(other.used);
         for (size_t i = 0; i < other.used; i++)
         {
-            push_back(other[i]);
+            items[i] = other.items[i];
         }
+        used = other.used;
+    }
+
+    Vector(Vector&& moved) : items(moved.items), allocated(moved.allocated), used(moved.used)
+    {
+        moved.items = nullptr;
+        moved.allocated = 0;
+        moved.used = 0;
     }
 
     ~Vector()
@@ -33,10 +44,34 @@ public:
 
     Vector& operator=(const Vector& other)
     {
-        clear();
-        for (size_t i = 0; i < other.used; i++)
+        if (this != &other)
         {
-            push_back(other[i]);
+            clear();
+            reserve(other.used);
+            for (size_t i = 0; i < other.used; i++)
+            {
+                items[i] = other.items[i];
+            }
+            used = other.used;
+        }
+        return *this;
+    }
+
+    // Takes the items of the other vector instead of copying them.
+    Vector& operator=(Vector&& moved)
+    {
+        if (this != &moved)
+        {
+            if (items != nullptr)
+            {
+                delete[] items;
+            }
+            items = moved.items;
+            allocated = moved.allocated;
+            used = moved.used;
+            moved.items = nullptr;
+            moved.allocated = 0;
+            moved.used = 0;
         }
         return *this;
     }
@@ -53,7 +88,7 @@ public:
             }
             for (size_t i = 0; i < used; i++)
             {
-                newBuffer[i] = items[i];
+                newBuffer[i] = static_cast<T&&>(items[i]);
             }
             if (items != nullptr) {
                 delete[] items;
@@ -92,4 +127,92 @@ public:
     {
         used = 0;
     }
-};
\ No newline at end of file
+
+    void swap(Vector& other)
+    {
+        T* tempItems = items;
+        size_t tempAllocated = allocated;
+        size_t tempUsed = used;
+        items = other.items;
+        allocated = other.allocated;
+        used = other.used;
+        other.items = tempItems;
+        other.allocated = tempAllocated;
+        other.used = tempUsed;
+    }
+
+    void erase(size_t index)
+    {
+        if (index < used)
+        {
+            for (size_t i = index + 1; i < used; i++)
+            {
+                items[i - 1] = items[i];
+            }
+            used--;
+        }
+    }
+};
+
+// A Vector with a fixed capacity inside the object, for the lists that have a known limit.  It
+// never allocates, push_back() returns false when it is full.
+template <typename T, size_t N>
+class StaticVector
+{
+    T items[N];
+    size_t used = 0;
+public:
+    static const size_t Capacity = N;
+
+    bool push_back(const T& x)
+    {
+        if (used == N)
+        {
+            return false;
+        }
+        items[used++] = x;
+        return true;
+    }
+
+    size_t reserved() const
+    {
+        return N;
+    }
+
+    size_t size() const
+    {
+        return used;
+    }
+
+    bool full() const
+    {
+        return used == N;
+    }
+
+    T& operator[](size_t index)
+    {
+        return items[index];
+    }
+
+    const T& operator[](size_t index) const
+    {
+        return items[index];
+    }
+
+    void clear()
+    {
+        used = 0;
+    }
+
+    void erase(size_t index)
+    {
+        if (index < used)
+        {
+            for (size_t i = index + 1; i < used; i++)
+            {
+                items[i - 1] = items[i];
+            }
+            used--;
+        }
+    }
+};
@@ -0,0 +1,360 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#ifndef _WS2812WAVEFORM_H
+#define _WS2812WAVEFORM_H
+
+#include <stdint.h>
+#include <math.h>
+
+// Define the limits and defaults for WS2812 signal generation
+const struct {
+    // Nominal values (F_CPU_ACTUAL typically is 600,000,000, 600MHz, a cycle is 1.666667ns)
+    // Convert cycles to ns: cycles * 1/600e6 = ns (use 1/0.6, to go directly to ns)
+    // Convert cycles to Hz: 1/cycles * 600e6 = Hz (600e3, for kHz)
+
+    // Datasheet says 800khz is the max.
+    const uint32_t DEFAULT_CYCLES_800 = 600e6 / 800000; // 750 cycles [1.25us, 800kHz]
+
+    // Datasheet says T0H should be 0.4 us
+    const uint32_t DEFAULT_CYCLES_T0H = 240; // 400 ns
+    // Datasheet says T0H should be 0.8 us
+    const uint32_t DEFAULT_CYCLES_T1H = 480; // 800 ns
+
+    // Wait a bit longer than 300us to avoid any timing issues
+    // Datasheet says frame reset has to be >= 50 us.
+    const uint32_t DEFAULT_FRAME_RESET = 300; // us of delay
+
+    // A LOW longer than the reset time latches the LEDs in the middle of a frame, so the gaps
+    // between rows have to stay well below it (WS2812 is >= 50us, WS2815 >= 280us).
+    const uint32_t DEFAULT_MAX_ROW_GAP = 25; // us
+} WS2812Timing;
+
+// Define the timing of the DMA output engine.  The DMA is paced by a PIT timer and writes
+// one word to the DR_TOGGLE register of each GPIO port per PIT period (a "phase").
+const struct {
+    // The PIT runs from the 24MHz PERCLK, which is 25 cycles of the 600MHz cpu clock.
+    const uint32_t PIT_CLOCK = 24000000;
+    const uint32_t CPU_CYCLES_PER_PIT_TICK = 600e6 / 24000000;
+
+    // Every WS2812 bit is sent in 3 equal phases, so T0H is one phase, T1H is two phases
+    // and the bit period is three phases.
+    const uint32_t PHASES_PER_BIT = 3;
+
+    // 10 ticks is a 416.7ns phase, 250 cycles [T0H], 500 cycles [T1H], 750 cycles [800kHz]
+    const uint32_t PIT_TICKS_PER_PHASE = 10;
+} WS2812DmaTiming;
+
+// Counters the driver keeps on every frame, in cpu cycles (ARM_DWT_CYCCNT) unless noted.  The
+// worst case values and counts are since startup, the others are for the last frame sent.
+struct WS2812Stats
+{
+    uint32_t frames;            // frames sent
+    uint32_t fps;               // frames sent in the last full second
+    uint32_t frameCycles;       // from show() to the end of the last bit, transposing included
+    uint32_t prepareCycles;     // transposing/encoding before the first bit went out
+    uint32_t setupCycles;       // worst time to get a bit slot (bit-bang) or ring half (DMA) ready
+    uint32_t setupBudget;       // the time setupCycles has to stay under, T0H or the send time of a ring half
+    uint32_t latchWaitCycles;   // show() waiting for the previous frame to latch
+    uint32_t missedDeadlines;   // bit slots or ring halves that were late, and row gaps over budget
+};
+
+// The color correction of the output stage: a gamma curve per channel scaled by the global
+// brightness, kept in 8.8 fixed point so the fraction that is lost going back to 8 bits can be
+// temporally dithered.  It is applied to each pixel as it is transposed, so it costs no extra
+// pass over the frame.
+class WS2812ColorMap
+{
+public:
+    static const uint32_t DitherFrames = 8;
+
+    WS2812ColorMap()
+    {
+        const float gamma[3] = { 1, 1, 1 };
+        Set(1, gamma, false);
+    }
+
+    // gamma is in GRB order, like the pixels.
+    void Set(float brightness, const float gamma[3], bool dither)
+    {
+        if (brightness < 0)
+            brightness = 0;
+        if (brightness > 1)
+            brightness = 1;
+        for (int c = 0; c < 3; c++)
+        {
+            float g = gamma[c] > 0 ? gamma[c] : 1;
+            for (int i = 0; i < 256; i++)
+            {
+                // at most 255 * 256 so adding the dither never carries out of the top byte.
+                float v = (g == 1 ? i / 255.0f : powf(i / 255.0f, g)) * brightness * 255.0f * 256.0f;
+                lut[c][i] = (uint16_t)(v + 0.5f);
+            }
+        }
+        dithering = dither;
+        frame = 0;
+        ditherValue = 128;
+    }
+
+    bool IsDithering() const { return dithering; }
+
+    // Move the dither to the next frame, the fraction of every channel is turned on for that
+    // fraction of DitherFrames frames.
+    void NextFrame()
+    {
+        if (dithering)
+        {
+            // bit reversed frame count, so the on frames are spread out.
+            uint32_t f = frame++ % DitherFrames;
+            uint32_t reversed = ((f & 1) << 2) | (f & 2) | ((f & 4) >> 2);
+            ditherValue = reversed * (256 / DitherFrames) + (128 / DitherFrames);
+        }
+    }
+
+    inline uint32_t Apply(uint32_t pixel) const
+    {
+        uint32_t g = (lut[0][(pixel >> 16) & 0xff] + ditherValue) >> 8;
+        uint32_t r = (lut[1][(pixel >> 8) & 0xff] + ditherValue) >> 8;
+        uint32_t b = (lut[2][pixel & 0xff] + ditherValue) >> 8;
+        return (g << 16) | (r << 8) | b;
+    }
+
+private:
+    uint16_t lut[3][256];
+    bool dithering;
+    uint32_t frame;
+    uint32_t ditherValue;   // added to the 8.8 values before dropping the fraction
+};
+
+// This class turns a frame buffer into the GPIO port words that the output engines write.
+// It has no hardware dependencies so TeensyUnitTest can check the generated waveforms
+// against the WS2812Timing values.
+//
+// Transpose() is the bit-slicing pass: for every bit of every LED it produces the port 6 and
+// port 7 masks of the outputs that are sending a 0 (the outputs to clear after T0H), so the
+// bit-bang loop only has to load and store them.
+//
+// Both come in two flavors, one taking the strip masks at runtime and one specialized on a
+// StripLayout, where the strip loop is unrolled at compile time with the masks as constants.
+// Both take an optional WS2812ColorMap that is applied to every pixel on the way.
+//
+// Encode() produces the DMA stream.  All outputs start LOW, and each bit is three words
+// written to the DR_TOGGLE registers:
+//      [msk]           all outputs go HIGH
+//      [zeros]         outputs sending a 0 go LOW after one phase [T0H]
+//      [msk ^ zeros]   outputs sending a 1 go LOW after two phases [T1H]
+// so every output is LOW again at the end of each bit.
+class WS2812Waveform
+{
+public:
+    static const uint32_t PlaneWordsPerBit = 2;
+    static const uint32_t PlaneWordsPerLED = 24 * PlaneWordsPerBit;
+    static const uint32_t WordsPerBit = 3;
+    static const uint32_t WordsPerLED = 24 * WordsPerBit;
+
+    // Number of words Transpose() needs for a frame.
+    static uint32_t GetPlaneWordCount(uint32_t ledsPerStrip)
+    {
+        return ledsPerStrip * PlaneWordsPerLED;
+    }
+
+    // Number of words each port needs to send one frame.
+    static uint32_t GetWordCount(uint32_t ledsPerStrip)
+    {
+        return ledsPerStrip * WordsPerLED;
+    }
+
+    // Length of one DMA phase in cpu cycles.
+    static uint32_t GetPhaseCycles()
+    {
+        return WS2812DmaTiming.PIT_TICKS_PER_PHASE * WS2812DmaTiming.CPU_CYCLES_PER_PIT_TICK;
+    }
+
+    // Add the 24 bits of one strip's pixel to the T0H port masks of its row.
+    static inline void TransposePixel(uint32_t pixel, uint32_t m6, uint32_t m7, uint32_t* zeros)
+    {
+        pixel = ~pixel;
+        for (uint32_t bitMask = 0x01 << 23; bitMask != 0; bitMask >>= 1)
+        {
+            uint32_t isZero = (pixel & bitMask) != 0;
+            zeros[0] |= isZero * m6;
+            zeros[1] |= isZero * m7;
+            zeros += PlaneWordsPerBit;
+        }
+    }
+
+    // Transpose one LED of every strip into 24 pairs of T0H port masks, most significant bit first.
+    // stripMask6/stripMask7 hold the GPIO bit of each strip on that port, or zero if the strip is
+    // wired to the other port.
+    static inline void TransposeRow(const uint32_t* row, uint32_t numStrips,
+        const uint32_t* stripMask6, const uint32_t* stripMask7, uint32_t* zeros, const WS2812ColorMap* colors = nullptr)
+    {
+        for (uint32_t bit = 0; bit < PlaneWordsPerLED; bit++)
+        {
+            zeros[bit] = 0;
+        }
+        // strip outer so each pixel is only read once.
+        for (uint32_t strip = 0; strip < numStrips; strip++)
+        {
+            uint32_t pixel = row[strip];
+            if (colors != nullptr)
+                pixel = colors->Apply(pixel);
+            TransposePixel(pixel, stripMask6[strip], stripMask7[strip], zeros);
+        }
+    }
+
+    template <typename Layout>
+    static inline void TransposeRow(const uint32_t* row, uint32_t* zeros, const WS2812ColorMap* colors);
+
+    // Transpose the frame (pixel data arranged in [LED][strip] order) into T0H port masks
+    // arranged in [LED][bit][port] order.
+    static void Transpose(const uint32_t* frame, uint32_t ledsPerStrip, uint32_t numStrips,
+        const uint32_t* stripMask6, const uint32_t* stripMask7, uint32_t* planes, const WS2812ColorMap* colors = nullptr)
+    {
+        for (uint32_t led = 0; led < ledsPerStrip; led++)
+        {
+            TransposeRow(frame, numStrips, stripMask6, stripMask7, planes, colors);
+            frame += numStrips;
+            planes += PlaneWordsPerLED;
+        }
+    }
+
+    template <typename Layout>
+    static void Transpose(const uint32_t* frame, uint32_t ledsPerStrip, uint32_t* planes, const WS2812ColorMap* colors = nullptr)
+    {
+        for (uint32_t led = 0; led < ledsPerStrip; led++)
+        {
+            TransposeRow<Layout>(frame, planes, colors);
+            frame += Layout::Strips;
+            planes += PlaneWordsPerLED;
+        }
+    }
+
+    // Turn the T0H port masks of one LED into its DMA toggle words.
+    static inline void EncodeRow(const uint32_t* zeros, uint32_t msk6, uint32_t msk7, uint32_t* words6, uint32_t* words7)
+    {
+        for (uint32_t bit = 0; bit < PlaneWordsPerLED; bit += PlaneWordsPerBit)
+        {
+            words6[0] = msk6;
+            words6[1] = zeros[bit];
+            words6[2] = msk6 ^ zeros[bit];
+            words7[0] = msk7;
+            words7[1] = zeros[bit + 1];
+            words7[2] = msk7 ^ zeros[bit + 1];
+            words6 += WordsPerBit;
+            words7 += WordsPerBit;
+        }
+    }
+
+    // Encode the frame into DMA toggle words for port 6 and port 7.
+    static void Encode(const uint32_t* frame, uint32_t ledsPerStrip, uint32_t numStrips,
+        const uint32_t* stripMask6, const uint32_t* stripMask7, uint32_t msk6, uint32_t msk7,
+        uint32_t* words6, uint32_t* words7, const WS2812ColorMap* colors = nullptr)
+    {
+        uint32_t zeros[PlaneWordsPerLED];
+        for (uint32_t led = 0; led < ledsPerStrip; led++)
+        {
+            TransposeRow(frame, numStrips, stripMask6, stripMask7, zeros, colors);
+            EncodeRow(zeros, msk6, msk7, words6, words7);
+            words6 += WordsPerLED;
+            words7 += WordsPerLED;
+            frame += numStrips;
+        }
+    }
+
+    template <typename Layout>
+    static void Encode(const uint32_t* frame, uint32_t ledsPerStrip, uint32_t* words6, uint32_t* words7,
+        const WS2812ColorMap* colors = nullptr)
+    {
+        uint32_t zeros[PlaneWordsPerLED];
+        for (uint32_t led = 0; led < ledsPerStrip; led++)
+        {
+            TransposeRow<Layout>(frame, zeros, colors);
+            EncodeRow(zeros, Layout::PortMask6, Layout::PortMask7, words6, words7);
+            words6 += WordsPerLED;
+            words7 += WordsPerLED;
+            frame += Layout::Strips;
+        }
+    }
+};
+
+// The interrupt windows of the bit-bang output: after every windowRows LED rows the outputs stay
+// LOW while pending interrupts run.  A window longer than the budget might latch the LEDs in the
+// middle of the frame, so it counts as a missed deadline and the rest of the frame is sent
+// without windows.  Times are in cpu cycles.
+struct WS2812RowGaps
+{
+    uint32_t windowRows;        // LED rows between windows, 0 sends the frame without them
+    uint32_t budget;            // cycles a window may take
+    uint32_t count;             // windows opened in the last frame
+    uint32_t cycles;            // cycles spent in them
+    uint32_t maxCycles;         // longest window since startup
+    uint32_t overruns;          // windows over budget since startup
+    bool closed;                // a window of this frame went over budget
+
+    void Begin(uint32_t budgetCycles)
+    {
+        budget = budgetCycles;
+        count = 0;
+        cycles = 0;
+        closed = false;
+    }
+
+    // Number of the remaining plane words to send before the next window.
+    uint32_t NextWindow(uint32_t remainingWords) const
+    {
+        uint32_t windowWords = closed ? 0 : WS2812Waveform::GetPlaneWordCount(windowRows);
+        return windowWords != 0 && remainingWords > windowWords ? windowWords : remainingWords;
+    }
+
+    // Count a window that took gap cycles, returns 1 if it went over budget.
+    uint32_t Record(uint32_t gap)
+    {
+        count++;
+        cycles += gap;
+        if (gap > maxCycles)
+            maxCycles = gap;
+        if (gap <= budget)
+            return 0;
+        overruns++;
+        closed = true;
+        return 1;
+    }
+};
+
+// Unrolls the strip loop of WS2812Waveform::TransposeRow<Layout>() by recursing over the strips,
+// so the masks of each strip are compile time constants and a port the strip isn't on costs nothing.
+template <typename Layout, uint32_t Strip = 0, bool Done = (Strip >= Layout::Strips)>
+struct WS2812TransposeStrips
+{
+    // enumerators so the masks are evaluated by the compiler.
+    enum : uint32_t { M6 = Layout::Mask6(Strip), M7 = Layout::Mask7(Strip) };
+
+    static inline void Apply(const uint32_t* row, uint32_t* zeros, const WS2812ColorMap* colors)
+    {
+        uint32_t pixel = row[Strip];
+        if (colors != nullptr)
+            pixel = colors->Apply(pixel);
+        WS2812Waveform::TransposePixel(pixel, M6, M7, zeros);
+        WS2812TransposeStrips<Layout, Strip + 1>::Apply(row, zeros, colors);
+    }
+};
+
+template <typename Layout, uint32_t Strip>
+struct WS2812TransposeStrips<Layout, Strip, true>
+{
+    static inline void Apply(const uint32_t*, uint32_t*, const WS2812ColorMap*)
+    {
+    }
+};
+
+template <typename Layout>
+inline void WS2812Waveform::TransposeRow(const uint32_t* row, uint32_t* zeros, const WS2812ColorMap* colors)
+{
+    for (uint32_t bit = 0; bit < PlaneWordsPerLED; bit++)
+    {
+        zeros[bit] = 0;
+    }
+    WS2812TransposeStrips<Layout>::Apply(row, zeros, colors);
+}
+
+#endif
@@ -8,4 +8,11 @@
 // calculate a checksum on a buffer, length = bytelength
 uint32_t crc32(uint8_t *buffer, uint32_t bytelength);
 
+// calculate the same checksum a piece at a time, for a buffer that arrives in chunks:
+// crc = crc32_begin(), then crc = crc32_update(crc, piece, length) for each piece in order,
+// and crc32_end(crc) is the checksum of all of them.
+uint32_t crc32_begin();
+uint32_t crc32_update(uint32_t crc, const uint8_t *buffer, uint32_t bytelength);
+uint32_t crc32_end(uint32_t crc);
+
 #endif
\ No newline at end of file
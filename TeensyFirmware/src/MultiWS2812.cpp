@@ -37,27 +37,19 @@
 #include "MultiWS2812.h"
 
 
-  //#define MULTIWS2812_DBG_PRINT_OUTPUTPINS (1)
-  //#define MULTIWS2812_PERF_PRINT_CYCLES (1)
-
-#ifdef MULTIWS2812_DBG_PRINT_OUTPUTPINS
-static void dbg_printmask(uint32_t value, const char* name) {
-    char buf[256];
-    sprintf(buf, "   %s: 0x%08x 0b", name, value);
-    Serial.print(buf);
-    Serial.println(value, BIN);
-}
-#endif
-
-MultiWS2812::MultiWS2812(uint16_t LEDsPerStripCount, uint16_t stripCount) : begun(false), frameBuffer(NULL),
+MultiWS2812Base::MultiWS2812Base(uint16_t LEDsPerStripCount, uint16_t stripCount, uint32_t portMask6, uint32_t portMask7,
+    TransposeFunction transpose, EncodeFunction encode) : begun(false), frameBuffer(NULL), planes(NULL), frameRows(0),
+transposeRows(transpose), encodeRows(encode), colorMapEnabled(false), colorBrightness(1), fullFrame(false),
+rowGaps(),
+frameStartCycles(0), fpsFrames(0), fpsStart(0),
 update_in_progress(0), update_completed_at(0),
-port6Count(0), msk6(0),
-port7Count(0), msk7(0),
-curPin(0)
+msk6(portMask6),
+msk7(portMask7),
+output(WS2812Output::BitBang),
+dmaRowsEncoded(0), dmaRowsSent(0), dmaHalf(0), dmaStartCycles(0)
 {
     maxLEDsPerStrip = LEDsPerStripCount;
     numStrips = stripCount;
-    numBytes = (LEDsPerStripCount * stripCount);
     timer.start();
 
     // Get the set/clear system registers for port 6/7
@@ -74,106 +66,53 @@ curPin(0)
     timingCyclesT0H = WS2812Timing.DEFAULT_CYCLES_T0H;
     timingCyclesT1H = WS2812Timing.DEFAULT_CYCLES_T1H;
     timingFrameResetDelay = WS2812Timing.DEFAULT_FRAME_RESET;
+    timingMaxRowGap = WS2812Timing.DEFAULT_MAX_ROW_GAP;
+    colorGamma[0] = colorGamma[1] = colorGamma[2] = 1;
+    rowGaps.windowRows = MULTIWS2812_INTERRUPT_WINDOW_ROWS;
+    memset(&stats, 0, sizeof(stats));
+    stats.setupBudget = timingCyclesT0H;
+
+    // The counters and the bit-bang timing run off the cycle counter.
+    ARM_DEMCR |= ARM_DEMCR_TRCENA;
+    ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
 }
 
-MultiWS2812::~MultiWS2812()
+MultiWS2812Base::~MultiWS2812Base()
 {
+    if (output == WS2812Output::Dma)
+    {
+        while (update_in_progress);
+        dma6->disable();
+        dma7->disable();
+        releaseDma();
+    }
+    if (planes != NULL)
+        delete[] planes;
 }
 
-// Enable HW control of the appropriate pins and add them to the mask collection
-boolean MultiWS2812::enableOutputPin(uint32_t bankStringNum, uint32_t pin)
+boolean MultiWS2812Base::setColorCorrection(float brightness, float gammaR, float gammaG, float gammaB, boolean dither)
 {
-    switch (pin)
+    // the DMA interrupt may still be encoding rows with the current map.
+    while (sending());
+
+    colorBrightness = brightness;
+    colorGamma[0] = gammaG;
+    colorGamma[1] = gammaR;
+    colorGamma[2] = gammaB;
+    fullFrame = true;
+    if (brightness >= 1 && gammaR == 1 && gammaG == 1 && gammaB == 1 && !dither)
     {
-        /*
-            +-------+----------+------+-------+
-            |  Pin  |   Name   | GPIO |  PORT |
-            +-------+----------+------+-------+
-            | 0     | AD_B0_03 |  1.3 | GPIO6 |
-            | 1     | AD_B0_02 |  1.2 | GPIO6 |
-            | 14/A0 | AD_B1_02 | 1.18 | GPIO6 |
-            | 15/A1 | AD_B1_03 | 1.19 | GPIO6 |
-            | 16/A2 | AD_B1_07 | 1.23 | GPIO6 |
-            | 17/A3 | AD_B1_06 | 1.22 | GPIO6 |
-            | 18/A4 | AD_B1_01 | 1.17 | GPIO6 |
-            | 19/A5 | AD_B1_00 | 1.16 | GPIO6 |
-            | 20/A6 | AD_B1_10 | 1.26 | GPIO6 |
-            | 21/A7 | AD_B1_11 | 1.27 | GPIO6 |
-            | 22/A8 | AD_B1_08 | 1.24 | GPIO6 |
-            | 23/A9 | AD_B1_09 | 1.25 | GPIO6 |
-            +-------+----------+------+-------+
-          */
-          // case 0: [Not used in this hardware]
-          // case 1: [Not used in this hardware]
-    case 14:
-    case 15:
-    case 16:
-    case 17:
-    case 18:
-    case 19:
-        // case 20: [Not used in this hardware]
-    case 21:
-    case 22:
-    case 23:
-        msk6 = msk6 | digitalPinToBitMask(pin);
-        pinMode(pin, OUTPUT);
-        digitalWrite(pin, LOW);
-        if (port6Count < bankStringNum)
-            port6Count = bankStringNum;
-        break;
-        /*
-          +-------+----------+------+-------+
-          |  Pin  |   Name   | GPIO |  PORT |
-          +-------+----------+------+-------+
-          | 6     | B0_10    | 2.10 | GPIO7 |
-          | 7     | B1_01    | 2.17 | GPIO7 |
-          | 8     | B1_00    | 2.16 | GPIO7 |
-          | 9     | B0_11    | 2.11 | GPIO7 |
-          | 10    | B0_00    |  2.0 | GPIO7 |
-          | 11    | B0_02    |  2.2 | GPIO7 |
-          | 12    | B0_01    |  2.1 | GPIO7 |
-          | 13    | B0_03    |  2.3 | GPIO7 |
-          +-------+----------+------+-------+
-        */
-    case 6:
-    case 7:
-    case 8:
-    case 9:
-    case 10:
-    case 11:
-    case 12:
-        // case 13:
-        msk7 = msk7 | digitalPinToBitMask(pin);
-        pinMode(pin, OUTPUT);
-        digitalWrite(pin, LOW);
-        if (port7Count < bankStringNum)
-            port7Count = bankStringNum;
-        break;
-    default:
-        return false;
-        break;
+        // nothing to correct, skip the lookups.
+        colorMapEnabled = false;
+        return true;
     }
-    pinNums[curPin] = pin;
-    curPin++;
-
-#ifdef MULTIWS2812_DBG_PRINT_OUTPUTPINS
-    Serial.println("----------------------------------");
-    char buf[256];
-    sprintf(buf, "[%02d] Adding bank string num: %02d, pin number: %02d\n", curPin, bankStringNum, pin);
-    Serial.print(buf);
-    dbg_printmask((uint32_t)digitalPinToBitMask(pin), " pin");
-    dbg_printmask(msk6, "msk6");
-    dbg_printmask(msk7, "msk7");
-    dbg_printmask(set6, "set6");
-    dbg_printmask(set7, "set7");
-#endif
 
-    return false;
+    colorMap.Set(brightness, colorGamma, dither);
+    colorMapEnabled = true;
+    return true;
 }
 
-
-
-int MultiWS2812::busy(void)
+int MultiWS2812Base::busy(void)
 {
     if (update_in_progress)
         return 1;
@@ -187,18 +126,245 @@ int MultiWS2812::busy(void)
 
 
 
-__attribute__((optimize("unroll-loops")))
-void MultiWS2812::show(void)
+MultiWS2812Base* MultiWS2812Base::dmaOwner = NULL;
+DMAChannel* MultiWS2812Base::dma6 = NULL;
+DMAChannel* MultiWS2812Base::dma7 = NULL;
+
+// The DMA sends the frame out of a ring of toggle words (see WS2812Waveform) that holds two
+// halves of MULTIWS2812_DMA_RING_ROWS LED rows, the interrupt encodes the next rows of the
+// frame buffer into one half while the other half is being sent.  The ring lives in DTCM,
+// which the DMA reads without any cache maintenance.
+static const uint32_t dmaRingHalfWords = MULTIWS2812_DMA_RING_ROWS * WS2812Waveform::WordsPerLED;
+static uint32_t dmaRing6[2 * dmaRingHalfWords] __attribute__((aligned(32)));
+static uint32_t dmaRing7[2 * dmaRingHalfWords] __attribute__((aligned(32)));
+
+// Switch the output pins over to GPIO1/GPIO2 and setup a PIT paced DMA that streams each
+// frame out, so show() returns while the frame is being sent.  Returns false and keeps the
+// bit-bang output if the DMA channels are not available.
+boolean MultiWS2812Base::enableDma(void)
+{
+#if defined(__arm__) && defined(ARDUINO_TEENSY40) && (defined(__IMXRT1052__) || defined(__IMXRT1062__))
+    if (output == WS2812Output::Dma)
+        return true;
+    if (dmaOwner != NULL || !begun)
+        return false;
+
+    // Only DMA channels 0-3 can be periodically triggered by their matching PIT channel,
+    // DMAChannel allocates the lowest free channel when it is constructed.
+    dma6 = new DMAChannel();
+    dma7 = new DMAChannel();
+    if (dma6->channel > 3)
+    {
+        DebugPrint("### MultiWS2812: DMA channel %u cannot be paced by the PIT\r\n", dma6->channel);
+        releaseDma();
+        return false;
+    }
+    dma7->attachInterrupt(dmaInterrupt);
+
+    volatile uint32_t* mux = &DMAMUX_CHCFG0 + dma6->channel;
+    *mux = 0;
+    *mux = DMAMUX_CHCFG_ENBL | DMAMUX_CHCFG_TRIG | DMAMUX_CHCFG_A_ON;
+
+    // The PIT runs continuously, the DMA only listens to it while a frame is being sent.
+    CCM_CCGR1 |= CCM_CCGR1_PIT(CCM_CCGR_ON);
+    PIT_MCR = 0;
+    IMXRT_PIT_CHANNEL_t* pit = IMXRT_PIT_CHANNELS + dma6->channel;
+    pit->TCTRL = 0;
+    pit->LDVAL = WS2812DmaTiming.PIT_TICKS_PER_PHASE - 1;
+    pit->TCTRL = PIT_TCTRL_TEN;
+
+    // GPIO1/GPIO2 use the same bit positions as GPIO6/GPIO7, so msk6/msk7 still apply.
+    GPIO1_DR_CLEAR = msk6;
+    GPIO2_DR_CLEAR = msk7;
+    GPIO1_GDIR |= msk6;
+    GPIO2_GDIR |= msk7;
+    IOMUXC_GPR_GPR26 &= ~msk6;
+    IOMUXC_GPR_GPR27 &= ~msk7;
+
+    dmaOwner = this;
+    output = WS2812Output::Dma;
+    stats.setupBudget = dmaRingHalfWords * WS2812Waveform::GetPhaseCycles();
+    stats.setupCycles = 0;
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Give the DMA channels back, the destructor and a failed enableDma() use this.
+void MultiWS2812Base::releaseDma(void)
+{
+    dma6->release();
+    dma7->release();
+    delete dma6;
+    delete dma7;
+    dma6 = NULL;
+    dma7 = NULL;
+    dmaOwner = NULL;
+}
+
+// Encode the next rows of the frame into one half of the ring, rows past the end of the
+// frame become zero words which leave the outputs LOW.
+void MultiWS2812Base::encodeDmaRows(uint32_t half)
+{
+    uint32_t* words6 = dmaRing6 + half * dmaRingHalfWords;
+    uint32_t* words7 = dmaRing7 + half * dmaRingHalfWords;
+    uint32_t rows = 0;
+    if (dmaRowsEncoded < frameRows)
+    {
+        rows = frameRows - dmaRowsEncoded;
+        if (rows > MULTIWS2812_DMA_RING_ROWS)
+            rows = MULTIWS2812_DMA_RING_ROWS;
+        encodeRows(frameBuffer + dmaRowsEncoded * numStrips, rows, words6, words7, getColorMap());
+        dmaRowsEncoded += rows;
+    }
+    uint32_t used = rows * WS2812Waveform::WordsPerLED;
+    if (used < dmaRingHalfWords)
+    {
+        memset(words6 + used, 0, (dmaRingHalfWords - used) * sizeof(uint32_t));
+        memset(words7 + used, 0, (dmaRingHalfWords - used) * sizeof(uint32_t));
+    }
+}
+
+// One half of the ring has been sent, either the frame is done or that half gets the next rows.
+void MultiWS2812Base::refillDma(void)
+{
+    uint32_t half = dmaHalf;
+    dmaHalf = half ^ 1;
+    dmaRowsSent += MULTIWS2812_DMA_RING_ROWS;
+    if (dmaRowsSent >= frameRows)
+    {
+        // The DMA may have started on the other half, which only holds zero words.
+        dma6->disable();
+        // Start the frame latch/reset pulse timing (see busy())
+        timer.start();
+        stats.frameCycles = ARM_DWT_CYCCNT - frameStartCycles;
+        update_in_progress = 0;
+        return;
+    }
+    encodeDmaRows(half);
+
+    // The DMA is PIT paced, so the half it just finished ended at a known time and it gets back
+    // to the half we refilled one half later.  Anything longer sent stale words.
+    uint32_t halfCycles = stats.setupBudget;
+    uint32_t halfEnd = dmaStartCycles + (dmaRowsSent / MULTIWS2812_DMA_RING_ROWS) * halfCycles;
+    uint32_t setup = ARM_DWT_CYCCNT - halfEnd;
+    if (setup > stats.setupCycles)
+        stats.setupCycles = setup;
+    if (setup > halfCycles)
+        stats.missedDeadlines++;
+}
+
+// DMA half/major loop interrupt of the ring.
+void MultiWS2812Base::dmaInterrupt(void)
+{
+    MultiWS2812Base* owner = dmaOwner;
+    owner->dma7->clearInterrupt();
+    owner->refillDma();
+#if defined(__IMXRT1062__)
+    asm("DSB");
+#endif
+}
+
+void MultiWS2812Base::show(void)
+{
+    show(maxLEDsPerStrip);
+}
+
+void MultiWS2812Base::show(uint32_t rowCount)
 {
     if (frameBuffer == NULL)
         return;
+    if (rowCount == 0 && !fullFrame && (!colorMapEnabled || !colorMap.IsDithering()))
+        return;
     // Data latch = 300+ microsecond pause in the output stream.  Rather than
     // put a delay at the end of the function, the ending time is noted and
     // the function will simply hold off (if needed) on issuing the
     // subsequent round of data until the latch time has elapsed.  This
     // allows the mainline code to start generating the next frame of data
     // rather than stalling for the latch.
+    uint32_t waitStart = ARM_DWT_CYCCNT;
     while (busy());
+    frameStartCycles = ARM_DWT_CYCCNT;
+    stats.latchWaitCycles = frameStartCycles - waitStart;
+
+    // WS2812s pass on everything after the first 24 bits they see, so stopping early and latching
+    // leaves the rest of the strip showing the previous frame.
+    if (rowCount > maxLEDsPerStrip || fullFrame)
+        rowCount = maxLEDsPerStrip;
+    fullFrame = false;
+    if (colorMapEnabled)
+    {
+        // every row changes with the dither, so every row has to be sent.
+        colorMap.NextFrame();
+        if (colorMap.IsDithering())
+            rowCount = maxLEDsPerStrip;
+    }
+    frameRows = rowCount;
+
+    stats.frames++;
+    fpsFrames++;
+    uint32_t now = millis();
+    if (now - fpsStart >= 1000)
+    {
+        stats.fps = fpsFrames * 1000 / (now - fpsStart);
+        fpsFrames = 0;
+        fpsStart = now;
+    }
+
+    if (output == WS2812Output::Dma)
+        showDma();
+    else
+        showBitBang();
+}
+
+void MultiWS2812Base::showDma(void)
+{
+    // The previous frame has been sent (see busy()) so the ring can be reused.
+    dmaRowsEncoded = 0;
+    dmaRowsSent = 0;
+    dmaHalf = 0;
+    encodeDmaRows(0);
+    encodeDmaRows(1);
+    stats.prepareCycles = ARM_DWT_CYCCNT - frameStartCycles;
+
+    // dma6 writes one word to GPIO1 every PIT period and each of its transfers triggers
+    // dma7 to write the matching word to GPIO2, so both ports toggle together.  The channels
+    // are setup again for every frame since the previous frame stopped them part way round the ring.
+    dma6->sourceBuffer(dmaRing6, sizeof(dmaRing6));
+    dma6->destination(GPIO1_DR_TOGGLE);
+    dma7->sourceBuffer(dmaRing7, sizeof(dmaRing7));
+    dma7->destination(GPIO2_DR_TOGGLE);
+    dma7->triggerAtTransfersOf(*dma6);
+    dma7->triggerAtCompletionOf(*dma6);
+    dma7->interruptAtHalf();
+    dma7->interruptAtCompletion();
+
+    update_in_progress = 1;
+    dma6->clearComplete();
+    dma7->clearComplete();
+    dma7->enable();
+    dmaStartCycles = ARM_DWT_CYCCNT;
+    dma6->enable(); // starts on the next PIT period, dmaInterrupt() refills the ring until the frame is sent.
+}
+
+__attribute__((optimize("unroll-loops")))
+void MultiWS2812Base::showBitBang(void)
+{
+    if (planes == NULL)
+    {
+        planes = new uint32_t[WS2812Waveform::GetPlaneWordCount(maxLEDsPerStrip)];
+        if (planes == NULL)
+        {
+            DebugPrint("### MultiWS2812: out of memory for bit planes\r\n");
+            return;
+        }
+    }
+
+    // Transpose the whole frame into the T0H port masks before the timing critical loop starts,
+    // so each bit slot only has to load two words.
+    transposeRows(frameBuffer, frameRows, planes, getColorMap());
+    stats.prepareCycles = ARM_DWT_CYCCNT - frameStartCycles;
 
 #if defined(__arm__)
     noInterrupts(); // Need 100% focus on instruction timing
@@ -216,12 +382,6 @@ void MultiWS2812::show(void)
 #endif
 
 
-#ifdef MULTIWS2812_PERF_PRINT_CYCLES
-    uint32_t cycPerf, elapseAvg = 0, elapseCount = 0;
-    elapseAvg = 0;
-    elapseCount = 0;
-#endif
-
     /*
       This code does all the time sensitive work for outputting multiple WS2812 bit
       banged digital signals. The WS2815 protocol is a NZR protocol where 0 and 1 are
@@ -244,12 +404,13 @@ void MultiWS2812::show(void)
 
       This code works by:
         1) setting everything we're driving high (msk6/msk7)
-        2) Computing the T0H bits based on the pixel data (24-bit data per LED)
+        2) Loading the T0H bits that Transpose() computed from the pixel data (24-bit data per LED)
         3) Waiting until T0H
         4) Setting the T0H bits low after T0H has elapsed
         5) Waiting until T1H
         6) Set all bits low after T1H has elapsed [all outputs are zero]
         7) Waiting until the 800kHz cycle is up
+        8) After every rowGaps.windowRows LEDs, letting pending interrupts run while the outputs are LOW
       After setting every LED (each of which is a 24-bit signal). We wait ~300us (via the busy() function)
       to latch the data (this is usually called the RES reset pulse)
 
@@ -264,106 +425,65 @@ void MultiWS2812::show(void)
       [Color bits]  X   X   X   X   X   X   X   X    G7  G6  G5  G4  G3  G2  G1  G0    R7  R6  R5  R4  R3  R2  R1  R0    B7  B6  B5  B4  B3  B2  B1  B0
      */
 
-    uint32_t* p = frameBuffer;
-    uint32_t* end = p + (numBytes);
-    uint32_t maskT0H_6, maskT0H_7, cyc, curBit;
-    uint32_t bitMask = 0;
+    uint32_t* p = planes;
+    uint32_t* end = p + WS2812Waveform::GetPlaneWordCount(frameRows);
+    uint32_t maskT0H_6, maskT0H_7, cyc, setup;
+    uint32_t worstSetup = stats.setupCycles;
+    uint32_t missed = 0;        // bit slots not ready by T0H and row gaps over budget
+    rowGaps.Begin(timingMaxRowGap * (F_CPU_ACTUAL / 1000000));
 
     update_in_progress = 1;
-    // Ensure that the cycle counter is running:
-    ARM_DEMCR |= ARM_DEMCR_TRCENA;
-    ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
     cyc = ARM_DWT_CYCCNT + timingCyclesPeriod800;
 
-    // Loop through the entire buffer
+    // Loop through every bit of every LED, [0] 24th bit first --> [24] 0th bit
     while (p < end)
     {
-        bitMask = 0x01 << 23; // [0] 24th bit first --> [24] 0th bit
-
-        // Loop through the strips (one 24bit RGB value for each strip):
-        for (curBit = 0; curBit < 24; curBit++)
-        {
-            while (ARM_DWT_CYCCNT - cyc < timingCyclesPeriod800);
-            dbg_write(HIGH); // Set GPIO1 HIGH [fast to avoid overhead]
-            cyc = ARM_DWT_CYCCNT;
-            // Turn on all outputs (NZR protocol)
-            *set6 = msk6;
-            *set7 = msk7;
-            maskT0H_6 = 0;
-            maskT0H_7 = 0;
-
-#if 0
-            // Flexible method (XXXns, by scope -- 48 cycles for core math, 80ns)
-            // With loop unrolling (XXXns, by scope -- 25 cycles for core math, 41.7ns)
-#ifdef MULTIWS2812_PERF_PRINT_CYCLES
-            cycPerf = ARM_DWT_CYCCNT;
-#endif
-            uint32_t curCol = 0;
-            for (int bank = 0; bank < 2; bank++)
-            {
-                if (bank == 0) {
-                    portCount = &port6Count;
-                    maskT0H = &maskT0H_6;
-                }
-                else {
-                    portCount = &port7Count;
-                    maskT0H = &maskT0H_7;
-                }
-
-                // Create GPIO6/GPIO7 masks for each column
-                for (uint32_t curStrip = 0; curStrip <= *portCount; curStrip++) {
-                    // If the bitMask value is 0, add it's PinBitMask to the T0H set
-                    // otherwise it is in the T1H set which we don't need to compute
-                    *maskT0H = *maskT0H | ((!(*(p + curCol) & bitMask)) * digitalPinToBitMask(pinNums[curCol]));
-                    curCol++;
-                }
-            }
-#ifdef MULTIWS2812_PERF_PRINT_CYCLES
-            elapseAvg += ARM_DWT_CYCCNT - cycPerf;
-            elapseCount++;
-#endif
-#endif
+      uint32_t* windowEnd = p + rowGaps.NextWindow(end - p);
+
+      while (p < windowEnd)
+      {
+        while (ARM_DWT_CYCCNT - cyc < timingCyclesPeriod800);
+        dbg_write(HIGH); // Set GPIO1 HIGH [fast to avoid overhead]
+        cyc = ARM_DWT_CYCCNT;
+        // Turn on all outputs (NZR protocol)
+        *set6 = msk6;
+        *set7 = msk7;
+        maskT0H_6 = p[0];
+        maskT0H_7 = p[1];
+        p += WS2812Waveform::PlaneWordsPerBit;
+        setup = ARM_DWT_CYCCNT - cyc;
+        if (setup > worstSetup)
+            worstSetup = setup;
+        missed += setup >= timingCyclesT0H;
+
+        // Wait for 0 transitioning pins [short T0H], we wait wrt the time we turned all outputs on HIGH (cyc):
+        dbg_write(LOW);  // Set GPIO1 LOW [fast to avoid overhead]
+        while (ARM_DWT_CYCCNT - cyc < timingCyclesT0H);
+        *clr6 = maskT0H_6;
+        *clr7 = maskT0H_7;
+
+        // Wait for 1 transitioning pins [long T1H], we wait wrt the time we turned all outputs on HIGH (cyc):
+        // Setting this with the msk (clearing everything) is faster (everything must be 0 now)
+        while (ARM_DWT_CYCCNT - cyc < timingCyclesT1H);
+        *clr6 = msk6;
+        *clr7 = msk7;
+      }
 
-            maskT0H_6 = maskT0H_6 | (!(*p & bitMask) * digitalPinToBitMask(pinNums[0]));
-            maskT0H_6 = maskT0H_6 | (!(*(p + 1) & bitMask) * digitalPinToBitMask(pinNums[1]));
-            maskT0H_6 = maskT0H_6 | (!(*(p + 2) & bitMask) * digitalPinToBitMask(pinNums[2]));
-            maskT0H_6 = maskT0H_6 | (!(*(p + 3) & bitMask) * digitalPinToBitMask(pinNums[3]));
-            maskT0H_6 = maskT0H_6 | (!(*(p + 4) & bitMask) * digitalPinToBitMask(pinNums[4]));
-            maskT0H_6 = maskT0H_6 | (!(*(p + 5) & bitMask) * digitalPinToBitMask(pinNums[5]));
-            maskT0H_6 = maskT0H_6 | (!(*(p + 6) & bitMask) * digitalPinToBitMask(pinNums[6]));
-            maskT0H_6 = maskT0H_6 | (!(*(p + 7) & bitMask) * digitalPinToBitMask(pinNums[7]));
-            maskT0H_6 = maskT0H_6 | (!(*(p + 8) & bitMask) * digitalPinToBitMask(pinNums[8]));
-            maskT0H_7 = maskT0H_7 | (!(*(p + 9) & bitMask) * digitalPinToBitMask(pinNums[9]));
-            maskT0H_7 = maskT0H_7 | (!(*(p + 10) & bitMask) * digitalPinToBitMask(pinNums[10]));
-            maskT0H_7 = maskT0H_7 | (!(*(p + 11) & bitMask) * digitalPinToBitMask(pinNums[11]));
-            maskT0H_7 = maskT0H_7 | (!(*(p + 12) & bitMask) * digitalPinToBitMask(pinNums[12]));
-            maskT0H_7 = maskT0H_7 | (!(*(p + 13) & bitMask) * digitalPinToBitMask(pinNums[13]));
-            maskT0H_7 = maskT0H_7 | (!(*(p + 14) & bitMask) * digitalPinToBitMask(pinNums[14]));
-            maskT0H_7 = maskT0H_7 | (!(*(p + 15) & bitMask) * digitalPinToBitMask(pinNums[15]));
-
-
-            // Wait for 0 transitioning pins [short T0H], we wait wrt the time we turned all outputs on HIGH (cyc):
-            dbg_write(LOW);  // Set GPIO1 LOW [fast to avoid overhead]
-            while (ARM_DWT_CYCCNT - cyc < timingCyclesT0H);
-            *clr6 = maskT0H_6;
-            *clr7 = maskT0H_7;
-            bitMask = bitMask >> 1;
-
-            // Wait for 1 transitioning pins [long T1H], we wait wrt the time we turned all outputs on HIGH (cyc):
-            // Setting this with the msk (clearing everything) is faster (everything must be 0 now)
-            while (ARM_DWT_CYCCNT - cyc < timingCyclesT1H);
-            *clr6 = msk6;
-            *clr7 = msk7;
-        } // Done with all bits
-
-        p = p + numStrips;     // Next set of pixels
+      if (p < end)
+      {
+        // Interrupt window: all outputs are LOW after the last bit of the row, and the LEDs only
+        // latch after a much longer LOW, so any pending interrupt (USB serial) can run here.
+        while (ARM_DWT_CYCCNT - cyc < timingCyclesPeriod800);
+        uint32_t gapStart = ARM_DWT_CYCCNT;
+        interrupts();
+        asm volatile("isb"); // take the pending interrupts
+        noInterrupts();
+        missed += rowGaps.Record(ARM_DWT_CYCCNT - gapStart);
+        // the next bit starts right away
+        cyc = ARM_DWT_CYCCNT - timingCyclesPeriod800;
+      }
     } // Done traversing memory
 
-#ifdef MULTIWS2812_PERF_PRINT_CYCLES
-    Serial.print(" [bit shifting] Cycles avg: ");
-    Serial.println(elapseAvg / elapseCount);
-#endif
-
     // Finish the last cycle
     while (ARM_DWT_CYCCNT - cyc < timingCyclesPeriod800);
 
@@ -371,6 +491,9 @@ void MultiWS2812::show(void)
     // This must be 300us or longer, no activity is allowed until that time is up
     timer.start();
     update_in_progress = 0;
+    stats.frameCycles = ARM_DWT_CYCCNT - frameStartCycles;
+    stats.setupCycles = worstSetup;
+    stats.missedDeadlines += missed;
 
 #endif
     // END ARM ----------------------------------------------------------------
@@ -88,7 +88,11 @@
 #include "Status.h"
 #include "Timer.h"
 
-TeensyStatus gTeensyStatus = {0,0,0};
+TeensyStatus gTeensyStatus = {};
+
+// Every frame sized buffer comes from these slots in OCRAM, see FrameArena.
+DMAMEM static FrameArena::Frame frameSlots[FrameArena::Slots];
+FrameArena gFrameArena(frameSlots);
 
 const int LED_PIN = 13;
 #define ANIM_EXIT_ON_FIRST_RECV_BYTE (1)
@@ -102,11 +106,12 @@ const int LED_PIN = 13;
 /*****************************************************************************
  * LED Strip Layout
  *****************************************************************************/
-static const uint32_t LEDSPerStrip = 392;
-static const uint32_t NUM_LEDStrips = 16;
+// The strip count, length and pins are set by LEDLayout (see StripLayout.h).
+static const uint32_t LEDSPerStrip = LEDLayout::LedsPerStrip;
+static const uint32_t NUM_LEDStrips = LEDLayout::Strips;
 
 // Global PixelBuffer object for writing to all the strips.
-Controller controller(NUM_LEDStrips, LEDSPerStrip);
+Controller controller;
 
 // Timer statusTimer;
 
@@ -148,36 +153,46 @@ void loop() {
     DebugPrint("# INFO: Starting main loop\r\n");
 
     Command cmd;
+    FrameScheduler& scheduler = controller.GetScheduler();
 
     // Main control loop:
     // Recv buffers and send them out to the strips once they're complete
     // If new buffer data is not received for 5 seconds the system slowly fades to black
     // If on the first reboot no buffer data is received for 5 seconds animateNeuralSequence until data arrives
+    // The animation frames run at the FrameRate command's fps, the time in between reads commands
+    // and starts the cues of the timeline.
     while (true) {
-        if (Serial.available())
+        do
         {
-            // digitalWrite(LED_PIN, HIGH); // show we are reading serial
-            bool read_something = cmd.readNextCommand();
-            // digitalWrite(LED_PIN, LOW);
-            if (read_something)
+            // the cues of an uploaded timeline start as close to their time as the reads allow.
+            controller.RunTimeline();
+            if (Serial.available())
             {
-                gTeensyStatus.commands++;
-                if (cmd.error.size() > 0)
-                {
-                    // flush input so we can sync up on the next command.
-                    cmd.resetInput();
-                    DebugPrint("##COMPLETE##: %s at %d bps\r\n", cmd.error.c_str(), Serial.baud());
-                    cmd.error = "";
-                }
-                else
+                // digitalWrite(LED_PIN, HIGH); // show we are reading serial
+                bool read_something = cmd.readNextCommand();
+                // digitalWrite(LED_PIN, LOW);
+                if (read_something)
                 {
-                    // new command received!
-                    controller.StartCommand(cmd);
-                    DebugPrint("##COMPLETE##: %s\r\n", cmd.command.c_str());
+                    gTeensyStatus.commands++;
+                    if (cmd.error.size() > 0)
+                    {
+                        // flush input so we can sync up on the next command.
+                        cmd.resetInput();
+                        DebugPrint("##COMPLETE##: %s at %d bps\r\n", cmd.error.c_str(), Serial.baud());
+                        cmd.error = "";
+                    }
+                    else
+                    {
+                        // new command received, it moves to the controller with its pixels.
+                        controller.StartCommand(static_cast<Command&&>(cmd));
+                        DebugPrint("##COMPLETE##: %s\r\n", controller.GetCommand().command.c_str());
+                    }
                 }
             }
-        }
+        } while (!scheduler.FrameDue());
 
+        scheduler.StartFrame();
+        gTeensyStatus.overruns = scheduler.GetOverruns();
         if (controller.HasAnimation())
         {
             if (controller.RunAnimation()) {
@@ -0,0 +1,48 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#include <stdlib.h>
+#include <new>
+
+// The global operator new and delete count the allocations made on each thread, so the tests
+// can check that what runs for every command stays off the heap.  They are in their own file
+// so the compiler can't inline them into the new and delete expressions of the tests, where it
+// would see malloc and free paired with new and delete.
+thread_local size_t allocations = 0;
+
+void* operator new(size_t size)
+{
+    allocations++;
+    void* ptr = malloc(size != 0 ? size : 1);
+    if (ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    free(ptr);
+}
+
+// the sized versions the compiler calls when it knows the size, they have to match the ones
+// above or the memory would go back to a different allocator.
+void operator delete(void* ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+    free(ptr);
+}
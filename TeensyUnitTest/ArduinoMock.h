@@ -54,6 +54,10 @@ public:
 		}
 		else if (position < size)
         {
+            if (chunkSize > 0 && length > chunkSize)
+            {
+                length = chunkSize;
+            }
             int available = size - position;
             if (available < length)
             {
@@ -73,6 +77,13 @@ public:
         this->position = 0;
     }
 
+    // The most readBytes returns at once, 0 is everything that is left, so the tests can
+    // feed the commands in the pieces the USB port might.
+    void setChunkSize(int length)
+    {
+        chunkSize = length;
+    }
+
 	void print(const char* message)
 	{
 		if (connected)
@@ -92,6 +103,7 @@ private:
     char* buffer;
     int size;
     int position;
+    int chunkSize = 0;
 	TcpClientPort client;
 	bool connected;
 };
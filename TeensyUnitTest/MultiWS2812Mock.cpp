@@ -5,7 +5,24 @@
 #include "Bitmap.h"
 #include "TestWindow.h"
 
-void MultiWS2812::show()
+void MultiWS2812Mock::show(uint32_t rowCount)
+{
+	this->rowCount = rowCount;
+	stats.frames++;
+
+	// the firmware's budget at the nominal 600MHz clock
+	rowGaps.Begin(WS2812Timing.DEFAULT_MAX_ROW_GAP * 600);
+	uint32_t remaining = WS2812Waveform::GetPlaneWordCount(rowCount);
+	while (remaining != 0)
+	{
+		remaining -= rowGaps.NextWindow(remaining);
+		if (remaining != 0)
+			stats.missedDeadlines += rowGaps.Record(interruptLatency);
+	}
+	show();
+}
+
+void MultiWS2812Mock::show()
 {
 	if (window != nullptr && buffer != nullptr)
 	{
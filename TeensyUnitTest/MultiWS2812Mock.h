@@ -2,20 +2,28 @@
 // Licensed under the MIT license.
 #pragma once
 #include <stdint.h>
+#include "WS2812Waveform.h"
 
 class TestWindow;
 
-class MultiWS2812
+// Draws the frames into the TestWindow instead of sending them to the strips.
+class MultiWS2812Mock
 {
 	int ledsPerStrip;
 	int numStrips;
 	uint32_t* buffer = nullptr;
+	uint32_t rowCount = 0;     // rows sent by the last show(rowCount)
+	float brightness = 1;      // last setColorCorrection()
+	WS2812Stats stats = {};
+	WS2812RowGaps rowGaps = {};
+	uint32_t interruptLatency = 0;   // simulated cycles the interrupts take in each window
 	TestWindow* window = nullptr;
 public:
-    MultiWS2812(int ledsPerStrip, int numStrips)
+    MultiWS2812Mock(int ledsPerStrip, int numStrips)
     {
 		this->ledsPerStrip = ledsPerStrip;
 		this->numStrips = numStrips;
+		rowGaps.windowRows = 0;    // like MULTIWS2812_INTERRUPT_WINDOW_ROWS
     }
 
 	void setWindow(TestWindow* window)
@@ -23,18 +31,70 @@ public:
 		this->window = window;
 	}
 
-    void enableOutputPin(int port, int pin)
+    void begin()
     {
     }
 
 	void show();
+	// Walks the interrupt windows of the bit-bang output like the firmware, with every window
+	// taking the simulated interrupt latency.
+	void show(uint32_t rowCount);
+	const WS2812Stats& getStats()
+	{
+		return stats;
+	}
+	uint32_t getRowCount()
+	{
+		return rowCount;
+	}
+	const WS2812RowGaps& getRowGaps()
+	{
+		return rowGaps;
+	}
+	void setInterruptWindow(uint32_t rows)
+	{
+		rowGaps.windowRows = rows;
+	}
+	void setInterruptLatency(uint32_t cycles)
+	{
+		interruptLatency = cycles;
+	}
+
+	int sending()
+	{
+		return 0;
+	}
+
+	bool setColorCorrection(float brightness, float /*gammaR*/, float /*gammaG*/, float /*gammaB*/, bool /*dither*/)
+	{
+		this->brightness = brightness;
+		return true;
+	}
+	float getBrightness()
+	{
+		return brightness;
+	}
 
     void setBuffer(uint32_t* buffer)
     {
 		this->buffer = buffer;
     }
+    void* getBuffer()
+    {
+		return buffer;
+    }
     void printTimingCycleStats()
     {
 
+    }
+};
+
+// Same shape as the firmware's MultiWS2812 template (see StripLayout.h).
+template <uint32_t Strips, uint32_t LedsPerStrip, typename Pins>
+class MultiWS2812 : public MultiWS2812Mock
+{
+public:
+    MultiWS2812() : MultiWS2812Mock(LedsPerStrip, Strips)
+    {
     }
 };
\ No newline at end of file
@@ -4,6 +4,7 @@
 //
 
 #include <iostream>
+#include <vector>
 #include "Timer.h"
 #include "crc32.h"
 #include <thread>
@@ -20,15 +21,23 @@
 #include "Commands.h"
 #include "Bitmap.h"
 #include "HlsColor.h"
+#include "WS2812Waveform.h"
 #include "TestWindow.h"
 
+// Counted by the global operator new in Allocations.cpp, so the tests can check that what runs
+// for every command stays off the heap.
+extern thread_local size_t allocations;
+
 TestWindow window;
 const int animation_delay = 16;
-const int numStrips = 16;
-const int numLeds = 392;
-Controller controller(numStrips, numLeds);
+const float frame_seconds = animation_delay / 1000.0f;
+const int numStrips = LEDLayout::Strips;
+const int numLeds = LEDLayout::LedsPerStrip;
+static FrameArena::Frame frameSlots[FrameArena::Slots];
+FrameArena gFrameArena(frameSlots);
+Controller controller;
 const int tcpPort = 21567;
-TeensyStatus gTeensyStatus = { 0,0,0 };
+TeensyStatus gTeensyStatus = {};
 
 void TestCRC()
 {
@@ -39,6 +48,50 @@ void TestCRC()
     uint8_t buffer2[] = { 0, 1, 2, 3, 4, 5, 6, 7 };
     crc = crc32(buffer2, 8);
     std::cout << "crc of range buffer=" << crc << "\n";
+
+    std::cout << "TestCRC...";
+    int errors = 0;
+    const char* check = "123456789";
+    if (crc32((uint8_t*)check, 9) != 0xCBF43926 || crc32(nullptr, 0) != 0) errors++;
+
+    // the slices and the pieces give the same crc as a bit at a time.
+    uint8_t data[1000];
+    for (int i = 0; i < 1000; i++)
+    {
+        data[i] = (uint8_t)((i * 2654435761u) >> 24);
+    }
+    for (uint32_t length = 0; length <= 1000; length += 37)
+    {
+        uint32_t expected = 0xffffffff;
+        for (uint32_t i = 0; i < length; i++)
+        {
+            expected ^= data[i];
+            for (int bit = 0; bit < 8; bit++)
+            {
+                expected = (expected >> 1) ^ (0xEDB88320 & (0 - (expected & 1)));
+            }
+        }
+        expected ^= 0xffffffff;
+        if (crc32(data, length) != expected) errors++;
+        for (uint32_t piece = 1; piece < 20; piece += 3)
+        {
+            uint32_t streamed = crc32_begin();
+            for (uint32_t i = 0; i < length; i += piece)
+            {
+                streamed = crc32_update(streamed, &data[i], piece < length - i ? piece : length - i);
+            }
+            if (crc32_end(streamed) != expected) errors++;
+        }
+    }
+
+    if (errors > 0)
+    {
+        std::cout << "### found " << errors << " crc errors\n";
+    }
+    else
+    {
+        std::cout << "done\n";
+    }
 }
 
 void TestCommands(std::string name, bool biglength, bool nocolors, bool badCrc)
@@ -85,6 +138,279 @@ void TestCommands(std::string name, bool biglength, bool nocolors, bool badCrc)
     }
 }
 
+// Ada's wiring of the strips to GPIO bits (see AdaPins in StripLayout.h)
+const int port6Strips = 9;
+void GetStripMasks(uint32_t* stripMask6, uint32_t* stripMask7, uint32_t& msk6, uint32_t& msk7)
+{
+    const uint32_t bits6[] = { 24, 25, 16, 17, 22, 23, 19, 18, 27 };
+    const uint32_t bits7[] = { 10, 17, 16, 11, 0, 2, 1 };
+    msk6 = 0;
+    msk7 = 0;
+    for (int i = 0; i < numStrips; i++)
+    {
+        stripMask6[i] = 0;
+        stripMask7[i] = 0;
+        if (i < port6Strips)
+        {
+            stripMask6[i] = 1 << bits6[i];
+            msk6 |= stripMask6[i];
+        }
+        else
+        {
+            stripMask7[i] = 1 << bits7[i - port6Strips];
+            msk7 |= stripMask7[i];
+        }
+    }
+}
+
+// a few rows of test patterns is enough to see every bit in both states on every strip.
+const int waveformLeds = 8;
+void GetWaveformTestFrame(uint32_t* frame)
+{
+    for (int i = 0; i < waveformLeds * numStrips; i++)
+    {
+        frame[i] = (i * 0x9E3779B1) & 0xffffff;
+    }
+    frame[0] = 0;
+    frame[1] = 0xffffff;
+}
+
+void TestTranspose()
+{
+    std::cout << "transpose...";
+    uint32_t stripMask6[numStrips];
+    uint32_t stripMask7[numStrips];
+    uint32_t msk6, msk7;
+    GetStripMasks(stripMask6, stripMask7, msk6, msk7);
+    uint32_t frame[waveformLeds * numStrips];
+    GetWaveformTestFrame(frame);
+
+    std::vector<uint32_t> planes(WS2812Waveform::GetPlaneWordCount(waveformLeds));
+    WS2812Waveform::Transpose(frame, waveformLeds, numStrips, stripMask6, stripMask7, planes.data());
+
+    // compare with the per bit mask computation the bit-bang loop used to do.
+    int errors = 0;
+    uint32_t* p = planes.data();
+    for (int led = 0; led < waveformLeds; led++)
+    {
+        for (uint32_t bitMask = 0x01 << 23; bitMask != 0; bitMask >>= 1)
+        {
+            uint32_t maskT0H_6 = 0;
+            uint32_t maskT0H_7 = 0;
+            for (int strip = 0; strip < numStrips; strip++)
+            {
+                uint32_t pixel = frame[led * numStrips + strip];
+                maskT0H_6 |= !(pixel & bitMask) * stripMask6[strip];
+                maskT0H_7 |= !(pixel & bitMask) * stripMask7[strip];
+            }
+            if (p[0] != maskT0H_6 || p[1] != maskT0H_7)
+            {
+                errors++;
+            }
+            p += WS2812Waveform::PlaneWordsPerBit;
+        }
+    }
+
+    // the versions specialized on the compile time layout must match.
+    static_assert(AdaLayout::Strips == numStrips, "test masks are for Ada");
+    for (int strip = 0; strip < numStrips; strip++)
+    {
+        if (AdaLayout::Mask6(strip) != stripMask6[strip] || AdaLayout::Mask7(strip) != stripMask7[strip])
+        {
+            errors++;
+        }
+    }
+    if (AdaLayout::PortMask6 != msk6 || AdaLayout::PortMask7 != msk7)
+    {
+        errors++;
+    }
+    std::vector<uint32_t> layoutPlanes(planes.size());
+    WS2812Waveform::Transpose<AdaLayout>(frame, waveformLeds, layoutPlanes.data());
+    if (layoutPlanes != planes)
+    {
+        errors++;
+    }
+    std::vector<uint32_t> words6(WS2812Waveform::GetWordCount(waveformLeds));
+    std::vector<uint32_t> words7(words6.size());
+    std::vector<uint32_t> layoutWords6(words6.size());
+    std::vector<uint32_t> layoutWords7(words6.size());
+    WS2812Waveform::Encode(frame, waveformLeds, numStrips, stripMask6, stripMask7, msk6, msk7, words6.data(), words7.data());
+    WS2812Waveform::Encode<AdaLayout>(frame, waveformLeds, layoutWords6.data(), layoutWords7.data());
+    if (layoutWords6 != words6 || layoutWords7 != words7)
+    {
+        errors++;
+    }
+
+    if (errors > 0)
+    {
+        std::cout << "### found " << errors << " transpose errors\n";
+    }
+    else
+    {
+        std::cout << "done\n";
+    }
+}
+
+void TestWaveform()
+{
+    std::cout << "waveform...";
+    uint32_t stripMask6[numStrips];
+    uint32_t stripMask7[numStrips];
+    uint32_t msk6, msk7;
+    GetStripMasks(stripMask6, stripMask7, msk6, msk7);
+    const int leds = waveformLeds;
+    uint32_t frame[waveformLeds * numStrips];
+    GetWaveformTestFrame(frame);
+
+    uint32_t count = WS2812Waveform::GetWordCount(leds);
+    std::vector<uint32_t> words6(count);
+    std::vector<uint32_t> words7(count);
+    WS2812Waveform::Encode(frame, leds, numStrips, stripMask6, stripMask7, msk6, msk7, words6.data(), words7.data());
+
+    // Play the words back through the DR_TOGGLE registers and measure each pulse in cpu cycles.
+    uint32_t phase = WS2812Waveform::GetPhaseCycles();
+    uint32_t period = WS2812DmaTiming.PHASES_PER_BIT * phase;
+    const uint32_t tolerance = 90; // 150ns, the datasheet tolerance on T0H/T1H
+    int errors = 0;
+    for (int strip = 0; strip < numStrips; strip++)
+    {
+        bool onPort6 = strip < port6Strips;
+        uint32_t mask = onPort6 ? stripMask6[strip] : stripMask7[strip];
+        std::vector<uint32_t>& words = onPort6 ? words6 : words7;
+        uint32_t state = 0;
+        uint32_t rise = 0;
+        uint32_t lastRise = 0;
+        int bit = 0;
+        for (uint32_t w = 0; w < count; w++)
+        {
+            uint32_t before = state & mask;
+            state ^= words[w];
+            uint32_t now = w * phase;
+            if (!before && (state & mask))
+            {
+                if (bit > 0 && now - lastRise != WS2812Timing.DEFAULT_CYCLES_800)
+                {
+                    errors++;
+                }
+                rise = lastRise = now;
+            }
+            else if (before && !(state & mask))
+            {
+                uint32_t high = now - rise;
+                uint32_t pixel = frame[(bit / 24) * numStrips + strip];
+                bool one = (pixel >> (23 - (bit % 24))) & 1;
+                uint32_t expected = one ? WS2812Timing.DEFAULT_CYCLES_T1H : WS2812Timing.DEFAULT_CYCLES_T0H;
+                if (high + tolerance < expected || high > expected + tolerance)
+                {
+                    errors++;
+                }
+                bit++;
+            }
+        }
+        if (state & mask || bit != leds * 24)
+        {
+            errors++;
+        }
+    }
+
+    // the other pins on the ports must never be touched.
+    for (uint32_t w = 0; w < count; w++)
+    {
+        if ((words6[w] & ~msk6) || (words7[w] & ~msk7))
+        {
+            errors++;
+        }
+    }
+
+    if (errors > 0)
+    {
+        std::cout << "### found " << errors << " waveform errors at period " << period << " cycles\n";
+    }
+    else
+    {
+        std::cout << "done\n";
+    }
+}
+
+void TestColorMap()
+{
+    std::cout << "TestColorMap...";
+    int errors = 0;
+    WS2812ColorMap colors;
+    const float linear[3] = { 1, 1, 1 };
+    const float gamma[3] = { 2.2f, 2.2f, 2.2f };
+
+    // the identity map sends the pixels unchanged
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t pixel = (i << 16) | ((255 - i) << 8) | (i ^ 0x5a);
+        if (colors.Apply(pixel) != pixel) errors++;
+    }
+
+    // half brightness halves every channel
+    colors.Set(0.5f, linear, false);
+    if (colors.Apply(Color{ 200, 100, 50 }.pack()) != Color{ 100, 50, 25 }.pack()) errors++;
+    if (colors.Apply(0) != 0) errors++;
+
+    // gamma keeps the ends and darkens the middle
+    colors.Set(1, gamma, false);
+    if (colors.Apply(0xffffff) != 0xffffff) errors++;
+    if (((colors.Apply(0x808080) >> 8) & 0xff) > 60) errors++;
+
+    // dithering averages out to the fraction over DitherFrames frames: 10.5 turns 11 on half the time
+    colors.Set(21.0f / 510.0f, linear, true);
+    uint32_t sum = 0;
+    for (uint32_t f = 0; f < WS2812ColorMap::DitherFrames; f++)
+    {
+        colors.NextFrame();
+        uint32_t value = colors.Apply(0xff) & 0xff;
+        if (value != 10 && value != 11) errors++;
+        sum += value;
+    }
+    if (sum != 10 * WS2812ColorMap::DitherFrames + WS2812ColorMap::DitherFrames / 2) errors++;
+
+    // transposing through the map is the same as transposing the mapped pixels
+    colors.Set(0.7f, gamma, false);
+    uint32_t frame[waveformLeds * numStrips];
+    uint32_t mapped[waveformLeds * numStrips];
+    GetWaveformTestFrame(frame);
+    for (int i = 0; i < waveformLeds * numStrips; i++)
+    {
+        mapped[i] = colors.Apply(frame[i]);
+    }
+    std::vector<uint32_t> planes(WS2812Waveform::GetPlaneWordCount(waveformLeds));
+    std::vector<uint32_t> expected(planes.size());
+    WS2812Waveform::Transpose<AdaLayout>(frame, waveformLeds, planes.data(), &colors);
+    WS2812Waveform::Transpose<AdaLayout>(mapped, waveformLeds, expected.data());
+    if (planes != expected) errors++;
+
+    // changing the correction resends every row
+    PixelBuffer buffer;
+    buffer.Initialize();
+    buffer.Write();
+    buffer.SetColorCorrection(0.25f, 1, 1, 1, false);
+    if (buffer.GetDirtyRows() != numLeds) errors++;
+    if (buffer.GetDriver().getBrightness() != 0.25f) errors++;
+
+    // the Brightness command has a gamma per channel and its own dither flag.
+    float brightness[4] = { 0.5f, 2.2f, 2.0f, 1.8f };
+    uint32_t dither = 1;
+    std::vector<uint8_t> payload((uint8_t*)brightness, (uint8_t*)brightness + sizeof(brightness));
+    payload.insert(payload.end(), (uint8_t*)&dither, (uint8_t*)&dither + 4);
+    Command cmd;
+    if (!cmd.parseCommand("Brightness", payload.data(), (uint32_t)payload.size()) || cmd.f1 != 0.5f ||
+        cmd.f2 != 2.2f || cmd.f3 != 2.0f || cmd.f4 != 1.8f || !cmd.dither || cmd.size != 0) errors++;
+
+    if (errors > 0)
+    {
+        std::cout << "### found " << errors << " color map errors\n";
+    }
+    else
+    {
+        std::cout << "done\n";
+    }
+}
+
 void TestStrings()
 {
     SimpleString s = "12345";
@@ -119,6 +445,169 @@ void TestVectors()
     v.clear();
 }
 
+void TestAllocations()
+{
+    std::cout << "TestAllocations...";
+    int errors = 0;
+
+    // a SetColor record read from the serial port the way the firmware reads it.
+    StreamWriter writer;
+    writer.WriteString("##HEADER##SetColor");
+    writer.WriteByte(0);
+    auto lenOffset = writer.Size();
+    writer.WriteInt(0);
+    int offset = writer.Size();
+    writer.WriteInt((uint32_t)-1); // strip
+    writer.WriteInt((uint32_t)-1); // index
+    writer.WriteInt(Color{ 255, 0, 0 }.pack());
+    writer.WriteLength(lenOffset, writer.Size() - offset);
+    writer.WriteCRC(offset);
+
+    // the first command allocates the payload and the colors, the next ones reuse them.
+    Command command;
+    Serial.setBuffer((char*)writer.GetBuffer(), writer.Size());
+    command.readNextCommand();
+    size_t before = allocations;
+    for (int i = 0; i < 10; i++)
+    {
+        Serial.setBuffer((char*)writer.GetBuffer(), writer.Size());
+        if (!command.readNextCommand() || command.type != CommandType::SetColor || command.colors.size() != 1) errors++;
+    }
+    size_t perCommand = (allocations - before) / 10;
+    if (perCommand != 0) errors++;
+
+    // moving a command to the controller's copy takes its names and colors.
+    Command received;
+    before = allocations;
+    received = static_cast<Command&&>(command);
+    if (allocations != before || !(received.command == "SetColor") || received.colors.size() != 1) errors++;
+
+    // short strings stay in the object, a long one allocates once and moves without copying.
+    before = allocations;
+    SimpleString name;
+    const char* text = "MovingGradient";
+    for (const char* p = text; *p != 0; p++)
+    {
+        name += *p;
+    }
+    SimpleString copy = name;
+    SimpleString moved(static_cast<SimpleString&&>(copy));
+    if (allocations != before || !(moved == text) || copy.size() != 0) errors++;
+    SimpleString longer;
+    for (int i = 0; i < 100; i++)
+    {
+        longer += 'x';
+    }
+    size_t grown = allocations - before;
+    SimpleString taken(static_cast<SimpleString&&>(longer));
+    if (grown > 3 || allocations - before != grown || taken.size() != 100 || longer.size() != 0 || *longer.c_str() != 0) errors++;
+
+    // a StaticVector never allocates and stops at its capacity.
+    before = allocations;
+    StaticVector<int, 4> fixed;
+    for (int i = 0; i < 4; i++)
+    {
+        if (!fixed.push_back(i)) errors++;
+    }
+    if (fixed.push_back(4) || fixed.size() != 4 || fixed[3] != 3 || allocations != before) errors++;
+    Vector<int> items;
+    items.push_back(1);
+    before = allocations;
+    Vector<int> owner(static_cast<Vector<int>&&>(items));
+    if (allocations != before || owner.size() != 1 || items.size() != 0) errors++;
+
+    if (errors > 0)
+    {
+        std::cout << "### found " << errors << " allocation errors\n";
+    }
+    else
+    {
+        std::cout << perCommand << " allocations per command...done\n";
+    }
+}
+
+// A FullBuffer record with a pattern that has plenty of '#' bytes in it.
+void WriteFullBufferRecord(StreamWriter& writer, uint32_t numStrips, uint32_t numLeds, uint32_t seed)
+{
+    writer.WriteString("##HEADER##FullBuffer");
+    writer.WriteByte(0);
+    auto lenOffset = writer.Size();
+    writer.WriteInt(0);
+    int offset = writer.Size();
+    writer.WriteInt(numStrips);
+    writer.WriteInt(numLeds);
+    writer.WriteFloat(0);
+    for (uint32_t i = 0; i < numStrips * numLeds; i++)
+    {
+        writer.WriteInt(i % 5 == 0 ? 0x23232323 : (i * seed) & 0xffffff);
+    }
+    writer.WriteLength(lenOffset, writer.Size() - offset);
+    writer.WriteCRC(offset);
+}
+
+void TestReadChunks()
+{
+    std::cout << "TestReadChunks...";
+    int errors = 0;
+    const uint32_t numStrips = 4;
+    const uint32_t numLeds = 300;
+    const uint32_t seeds[3] = { 2654435761u, 40503u, 97u };
+
+    // three records, some noise and a record that is cut short by the next header, together
+    // longer than the ring so it wraps around.
+    StreamWriter writer;
+    WriteFullBufferRecord(writer, numStrips, numLeds, seeds[0]);
+    writer.WriteString("noise # ##HEAD");
+    WriteFullBufferRecord(writer, numStrips, numLeds, seeds[1]);
+    writer.WriteString("##HEADER##FullBuffer");
+    writer.WriteByte(0);
+    writer.WriteInt(1000);
+    writer.WriteString("lost");
+    WriteFullBufferRecord(writer, numStrips, numLeds, seeds[2]);
+
+    const int chunks[] = { 0, 1, 7, 1000, 5000 };
+    for (int chunk : chunks)
+    {
+        Command command;
+        Serial.setBuffer((char*)writer.GetBuffer(), writer.Size());
+        Serial.setChunkSize(chunk);
+        int received = 0;
+        while (Serial.available() || command.state.used() > 0)
+        {
+            if (!command.readNextCommand())
+            {
+                continue;
+            }
+            if (command.error.size() > 0 || command.type != CommandType::FullBuffer || received >= 3)
+            {
+                errors++;
+                continue;
+            }
+            for (uint32_t i = 0; i < numStrips * numLeds; i++)
+            {
+                uint32_t expected = i % 5 == 0 ? 0x23232323 : (i * seeds[received]) & 0xffffff;
+                if (command.pixelBuffer[i] != expected)
+                {
+                    errors++;
+                    break;
+                }
+            }
+            received++;
+        }
+        if (received != 3) errors++;
+    }
+    Serial.setChunkSize(0);
+
+    if (errors > 0)
+    {
+        std::cout << "### found " << errors << " chunked read errors\n";
+    }
+    else
+    {
+        std::cout << "done\n";
+    }
+}
+
 void TestPixelBuffer()
 {
     PixelBuffer& buffer = controller.GetBuffer();
@@ -132,6 +621,225 @@ void TestPixelBuffer()
     std::this_thread::sleep_for(std::chrono::milliseconds(1000));
 }
 
+void TestPixelIteration()
+{
+    std::cout << "TestPixelIteration...";
+    PixelBuffer buffer;
+    buffer.Initialize();
+    int errors = 0;
+
+    // rows come in storage order and GetRow/GetPixel agree on where a pixel is.
+    int expected = 0;
+    buffer.ForEachRow([&](int led, uint32_t* row) {
+        if (led != expected++ || row != buffer.GetRow(led)) errors++;
+        for (int strip = 0; strip < buffer.NumStrips(); strip++)
+        {
+            row[strip] = (uint32_t)(led * 100 + strip);
+        }
+    });
+    if (expected != buffer.NumLedsPerStrip()) errors++;
+    uint32_t* span = buffer.Span();
+    for (uint32_t i = 0; i < buffer.GetNumberOfPixels(); i++)
+    {
+        if (span[i] != (uint32_t)((i / buffer.NumStrips()) * 100 + i % buffer.NumStrips())) errors++;
+    }
+    if (buffer.GetPixel(5, 7).pack() != 705) errors++;
+
+    // a gradient down the strips is the same on every strip.
+    buffer.VerticalGradient(Color{ 0, 0, 0 }, Color{ 200, 100, 0 });
+    for (int led = 0; led < buffer.NumLedsPerStrip(); led += 17)
+    {
+        uint8_t r = (uint8_t)(200.0 * led / buffer.NumLedsPerStrip());
+        for (int strip = 0; strip < buffer.NumStrips(); strip++)
+        {
+            if (buffer.GetPixel(strip, led).r != r) errors++;
+        }
+    }
+
+    // the LEDs past the colors given to SetColumn are turned off, and nothing past the strip.
+    Color colors[3] = { Color{ 1, 2, 3 }, Color{ 4, 5, 6 }, Color{ 7, 8, 9 } };
+    buffer.SetColor(Color{ 50, 50, 50 });
+    buffer.SetColumn(2, colors, 3);
+    if (buffer.GetPixel(2, 1).pack() != colors[1].pack() || buffer.GetPixel(2, 3).pack() != 0 ||
+        buffer.GetPixel(2, buffer.NumLedsPerStrip() - 1).pack() != 0 || buffer.GetPixel(3, 0).pack() != Color{ 50, 50, 50 }.pack()) errors++;
+
+    if (errors > 0)
+    {
+        std::cout << "### found " << errors << " pixel iteration errors\n";
+    }
+    else
+    {
+        std::cout << "done\n";
+    }
+}
+
+void TestDoubleBuffer()
+{
+    std::cout << "TestDoubleBuffer...";
+    PixelBuffer buffer;
+    buffer.Initialize();
+    int errors = 0;
+    uint32_t red = Color{ 80,0,0 }.pack();
+    uint32_t blue = Color{ 0,0,80 }.pack();
+
+    buffer.SetColor(Color::from(red));
+    buffer.Write();
+    uint32_t* front = (uint32_t*)buffer.GetDriver().getBuffer();
+    if (front == nullptr || front == buffer.GetPixelBuffer())
+    {
+        std::cout << "### front buffer is not separate from the back buffer\n";
+        return;
+    }
+
+    // drawing the next frame must not change the frame being sent.
+    buffer.SetColor(Color::from(blue));
+    buffer.SetPixel(Color::from(red), 1, 2);
+    for (uint32_t i = 0; i < buffer.GetNumberOfPixels(); i++)
+    {
+        if (front[i] != red) errors++;
+    }
+
+    // after Write the front has the new frame and the back buffer still holds it.
+    buffer.Write();
+    for (int strip = 0; strip < numStrips; strip++)
+    {
+        for (int led = 0; led < numLeds; led++)
+        {
+            uint32_t expected = (strip == 1 && led == 2) ? red : blue;
+            if (front[led * numStrips + strip] != expected) errors++;
+            if (buffer.GetPixel(strip, led).pack() != expected) errors++;
+        }
+    }
+
+    if (errors > 0)
+    {
+        std::cout << "### found " << errors << " double buffer errors\n";
+    }
+    else
+    {
+        std::cout << "done\n";
+    }
+}
+
+void TestPartialRefresh()
+{
+    std::cout << "TestPartialRefresh...";
+    PixelBuffer buffer;
+    buffer.Initialize();
+    LEDDriver& driver = buffer.GetDriver();
+    int errors = 0;
+
+    // the first frame sends everything
+    buffer.Write();
+    if (driver.getRowCount() != numLeds) errors++;
+
+    buffer.SetPixel(Color{ 0,80,0 }, 3, 10);
+    buffer.SetRow(Color{ 80,0,0 }, 4);
+    if (buffer.GetDirtyRows() != 11) errors++;
+    buffer.Write();
+    if (driver.getRowCount() != 11) errors++;
+    uint32_t* front = (uint32_t*)driver.getBuffer();
+    if (front[10 * numStrips + 3] != Color{ 0,80,0 }.pack()) errors++;
+    if (front[4 * numStrips + 7] != Color{ 80,0,0 }.pack()) errors++;
+
+    // nothing changed so nothing is sent
+    if (buffer.GetDirtyRows() != 0) errors++;
+    buffer.Write();
+    if (driver.getRowCount() != 11) errors++;
+
+    buffer.SetRow(Color{ 0,0,80 }, 2);
+    buffer.Write();
+    if (driver.getRowCount() != 3) errors++;
+
+    // raw pixel access could have changed anything
+    buffer.GetPixelBuffer()[0] = 0;
+    buffer.Write();
+    if (driver.getRowCount() != numLeds) errors++;
+
+    if (errors > 0)
+    {
+        std::cout << "### found " << errors << " partial refresh errors\n";
+    }
+    else
+    {
+        std::cout << "done\n";
+    }
+}
+
+void TestInterruptWindows()
+{
+    std::cout << "TestInterruptWindows...";
+    PixelBuffer buffer;
+    buffer.Initialize();
+    LEDDriver& driver = buffer.GetDriver();
+    int errors = 0;
+    const uint32_t budget = WS2812Timing.DEFAULT_MAX_ROW_GAP * 600;
+    const uint32_t rows = numLeds;
+
+    // the windows are opt-in
+    buffer.Write();
+    const WS2812RowGaps& gaps = driver.getRowGaps();
+    if (gaps.windowRows != 0 || gaps.count != 0) errors++;
+
+    // a short USB interrupt in every window between the rows
+    driver.setInterruptWindow(1);
+    driver.setInterruptLatency(5 * 600);
+    buffer.GetPixelBuffer();
+    buffer.Write();
+    if (gaps.budget != budget) errors++;
+    if (gaps.count != rows - 1) errors++;
+    if (gaps.cycles != gaps.count * 5 * 600) errors++;
+    if (gaps.maxCycles > budget) errors++;
+    if (gaps.overruns != 0) errors++;
+    if (gTeensyStatus.missedDeadlines != 0) errors++;
+
+    // fewer, equally short windows
+    driver.setInterruptWindow(4);
+    buffer.GetPixelBuffer();
+    buffer.Write();
+    if (gaps.count != (rows + 3) / 4 - 1) errors++;
+    if (gaps.maxCycles > budget) errors++;
+    if (gTeensyStatus.missedDeadlines != 0) errors++;
+
+    // only the rows sent get windows, and a window right at the budget is in time
+    driver.setInterruptLatency(budget);
+    buffer.SetRow(Color{ 80,0,0 }, 8);
+    buffer.Write();
+    if (driver.getRowCount() != 9) errors++;
+    if (gaps.count != 2) errors++;
+    if (gaps.maxCycles != budget) errors++;
+    if (gTeensyStatus.missedDeadlines != 0) errors++;
+
+    // a window over budget is a missed deadline, and the rest of the frame goes out without
+    // windows so it can't latch again.  The next frame opens them again.
+    driver.setInterruptLatency(budget + 1);
+    buffer.GetPixelBuffer();
+    buffer.Write();
+    if (gaps.count != 1 || gaps.overruns != 1) errors++;
+    if (gTeensyStatus.missedDeadlines != 1) errors++;
+    buffer.GetPixelBuffer();
+    buffer.Write();
+    uint32_t missed = 2;
+    if (gaps.count != 1 || gaps.overruns != missed) errors++;
+    if (gTeensyStatus.missedDeadlines != missed) errors++;
+
+    // no windows, nothing to miss
+    driver.setInterruptWindow(0);
+    buffer.GetPixelBuffer();
+    buffer.Write();
+    if (gaps.count != 0) errors++;
+    if (gTeensyStatus.missedDeadlines != missed) errors++;
+
+    if (errors > 0)
+    {
+        std::cout << "### found " << errors << " interrupt window errors\n";
+    }
+    else
+    {
+        std::cout << "done\n";
+    }
+}
+
 void TestGradientFade()
 {
     PixelBuffer& buffer = controller.GetBuffer();
@@ -144,7 +852,7 @@ void TestGradientFade()
     GradientAnimation gradient(buffer, false);
     gradient.AddStrip(-1, colors, 2.0);
     std::cout << "fading to blue/red gradient from black...";
-    while (!gradient.Run())
+    while (!gradient.Run(frame_seconds))
     {
         std::this_thread::sleep_for(std::chrono::milliseconds(animation_delay));
     }
@@ -156,7 +864,7 @@ void TestGradientFade()
     colors.push_back(Color{ 0, 255, 0 }); // green
     gradient.AddStrip(5, colors, 2.0);
     std::cout << std::endl << "fading strip 5 to red/yellow/green gradient ...";
-    while (!gradient.Run())
+    while (!gradient.Run(frame_seconds))
     {
         std::this_thread::sleep_for(std::chrono::milliseconds(animation_delay));
     }
@@ -173,11 +881,36 @@ void TestFireAnimation()
     std::cout << "running fire animation...";
     Timer timer;
     timer.start();
-    while (!fire.Run() && timer.seconds() < 10)
+    while (!fire.Run(frame_seconds) && timer.seconds() < 10)
     {
         std::this_thread::sleep_for(std::chrono::milliseconds(animation_delay));
     }
 
+    // the same seed makes the same fire, frame for frame, and xorshift32 makes the same numbers
+    // as it does on the Teensy.
+    int errors = 0;
+    Random random(1);
+    if (random.Next() != 270369 || random.Next() != 67634689 || random.Next() != 2647435461u) errors++;
+    for (int i = 0; i < 1000; i++)
+    {
+        int r = random.Range(160, 255);
+        if (r < 160 || r > 255 || random.Below(7) >= 7) errors++;
+    }
+    PixelBuffer first;
+    first.Initialize();
+    PixelBuffer second;
+    second.Initialize();
+    FireAnimation fire1(first, 55, 120, 0, true, 1234);
+    FireAnimation fire2(second, 55, 120, 0, true, 1234);
+    for (int i = 0; i < 100; i++)
+    {
+        fire1.Run(1 / 32.0f);
+        fire2.Run(1 / 32.0f);
+        if (::memcmp(first.GetPixelBuffer(), second.GetPixelBuffer(), first.GetBufferSize()) != 0) errors++;
+    }
+    // the 100th frame of that fire, a change here changes the fire on the Teensy too.
+    if (crc32((uint8_t*)first.GetPixelBuffer(), first.GetBufferSize()) != 0x5fbfd38f) errors++;
+
     // now test it via the command interface
     buffer.SetColor(Color{ 0,0,0 });
     Command& cmd = controller.GetCommand();
@@ -193,7 +926,60 @@ void TestFireAnimation()
         std::this_thread::sleep_for(std::chrono::milliseconds(animation_delay));
     }
 
-    std::cout << "done\n";
+    if (errors > 0)
+    {
+        std::cout << "### found " << errors << " fire errors\n";
+    }
+    else
+    {
+        std::cout << "done\n";
+    }
+}
+
+void TestGradientStrips()
+{
+    std::cout << "TestGradientStrips...";
+    int errors = 0;
+    PixelBuffer buffer;
+    buffer.Initialize();
+    uint32_t red = Color{ 255, 0, 0 }.pack();
+    uint32_t blue = Color{ 0, 0, 255 }.pack();
+    Vector<Color> colors;
+    colors.push_back(Color::from(red));
+
+    // every strip fades to red, then strip 3 to blue half way through without restarting the
+    // fade of the others.
+    GradientAnimation gradient(buffer, false);
+    gradient.AddStrip(-1, colors, 1);
+    if (gradient.Run(0.5f) || buffer.GetPixel(0, 10).pack() != PixelKernels::Lerp(0, red, 128)) errors++;
+    uint32_t half = buffer.GetPixel(3, 10).pack();
+    colors[0] = Color::from(blue);
+    gradient.AddStrip(3, colors, 1);
+    gradient.Run(0.25f);
+    if (buffer.GetPixel(0, 10).pack() != PixelKernels::Lerp(0, red, 192) || buffer.GetPixel(3, 10).pack() != PixelKernels::Lerp(half, blue, 64)) errors++;
+    if (gradient.Run(0.25f) || buffer.GetPixel(0, 10).pack() != red) errors++;
+    // the strips that are done aren't drawn again while strip 3 is still fading.
+    buffer.SetPixel(Color{ 1, 2, 3 }, 0, 10);
+    if (!gradient.Run(0.5f) || buffer.GetPixel(3, 10).pack() != blue || buffer.GetPixel(4, 10).pack() != red) errors++;
+    if (buffer.GetPixel(0, 10).pack() != Color{ 1, 2, 3 }.pack()) errors++;
+
+    // a gradient for all strips leaves strip 3 with its own colors, and goes from the first
+    // color at the top to the last at the bottom.
+    colors[0] = Color{ 0, 0, 0 };
+    colors.push_back(Color::from(red));
+    gradient.AddStrip(-1, colors, 0);
+    gradient.Run(0);
+    int last = buffer.NumLedsPerStrip() - 1;
+    if (buffer.GetPixel(3, 10).pack() != blue || buffer.GetPixel(7, 0).pack() != 0 || buffer.GetPixel(7, last).pack() != PixelKernels::Lerp(0, red, PixelKernels::Fraction((float)last / (last + 1)))) errors++;
+
+    if (errors > 0)
+    {
+        std::cout << "### found " << errors << " gradient errors\n";
+    }
+    else
+    {
+        std::cout << "done\n";
+    }
 }
 
 void TestCrossFade()
@@ -203,21 +989,21 @@ void TestCrossFade()
     colors.push_back(Color{ 255,0,0 });
     CrossFadeToAnimation crossFade(buffer, colors, 2.0);
     std::cout << "fading to red...";
-    while (!crossFade.Run())
+    while (!crossFade.Run(frame_seconds))
     {
         std::this_thread::sleep_for(std::chrono::milliseconds(animation_delay));
     }
     std::cout << "done\n";
 
     // test cross fade to another buffer.
-    PixelBuffer buffer2(numStrips, numLeds);
+    PixelBuffer buffer2;
     buffer2.Initialize();
     buffer2.SetColor(Color{ 0,0,255 });
 
     uint32_t size = buffer2.GetBufferSize();
     CrossFadeToAnimation crossFadeTarget(buffer, buffer2.GetPixelBuffer(), size, 2.0);
     std::cout << "fading to blue...";
-    while (!crossFadeTarget.Run())
+    while (!crossFadeTarget.Run(frame_seconds))
     {
         std::this_thread::sleep_for(std::chrono::milliseconds(animation_delay));
     }
@@ -227,32 +1013,129 @@ void TestCrossFade()
 void TestOverlayAnimation()
 {
     PixelBuffer& buffer = controller.GetBuffer();
+    Compositor& compositor = controller.GetCompositor();
+    compositor.Clear();
     Vector<Color> colors;
     colors.push_back(Color{ 0, 180, 120 });
     CrossFadeToAnimation crossFade(buffer, colors, 2.0);
-    crossFade.AddOverlay(new RainOverlayAnimation(buffer, 16, 30));
+    compositor.AddLayer(new RainOverlayAnimation(buffer, 16, 30), BlendMode::Add);
     std::cout << "fading to green with raindrops...";
-    while (!crossFade.Run())
+    while (!crossFade.Run(frame_seconds))
     {
         std::this_thread::sleep_for(std::chrono::milliseconds(animation_delay));
     }
-    std::cout << "done\n";
 
-    // overlay on an animating gradient
+    // the rain is only in what was sent, the frame underneath is still the fade.
+    int errors = 0;
+    buffer.Write();
+    const uint32_t* front = (const uint32_t*)buffer.GetDriver().getBuffer();
+    uint32_t green = Color{ 0, 180, 120 }.pack();
+    int raindrops = 0;
+    for (uint32_t i = 0; i < buffer.GetNumberOfPixels(); i++)
+    {
+        if (buffer.GetPixelBuffer()[i] != green) errors++;
+        if (front[i] != green) raindrops++;
+    }
+    if (raindrops == 0 || compositor.GetSavedRows() != 0) errors++;
+    if (errors > 0)
+    {
+        std::cout << "### found " << errors << " overlay errors\n";
+    }
+    else
+    {
+        std::cout << "done\n";
+    }
+
+    // rain over a gradient over twinkling stars
     buffer.SetColor(Color{ 0,0,0 });
 
     colors.push_back(Color{ 0, 0, 180 });
     GradientAnimation gradient(buffer, false);
     gradient.AddStrip(-1, colors, 2.0);
-    gradient.AddOverlay(new RainOverlayAnimation(buffer, 16, 30));
-    std::cout << "fading to green/blue gradient with raindrops...";
-    while (!gradient.Run())
+    compositor.Clear();
+    compositor.AddLayer(new TwinkleAnimation(buffer, Color{ 0, 0, 0 }, Color{ 255, 255, 255 }, 30, 5), BlendMode::Alpha);
+    compositor.AddLayer(new RainOverlayAnimation(buffer, 16, 30), BlendMode::Add);
+    std::cout << "fading to green/blue gradient with stars and raindrops...";
+    while (!gradient.Run(frame_seconds))
     {
         std::this_thread::sleep_for(std::chrono::milliseconds(animation_delay));
     }
+    compositor.Clear();
     std::cout << "done\n";
 }
 
+void TestCompositor()
+{
+    std::cout << "TestCompositor...";
+    int errors = 0;
+    PixelBuffer buffer;
+    buffer.Initialize();
+    Compositor compositor(buffer);
+    buffer.SetOverlay(&compositor);
+
+    // a layer that draws one color on strips 2-5 of row 3 with the mode it was added with.
+    class SpanLayer : public LayerSource
+    {
+    public:
+        uint32_t color;
+        SpanLayer(uint32_t color) : color(color) {}
+        void RenderLayer(Compositor& compositor, float) override
+        {
+            compositor.Fill(3, 2, 4, color);
+        }
+    };
+
+    uint32_t under = Color{ 100, 50, 200 }.pack();
+    uint32_t over = Color{ 80, 100, 40 }.pack();
+    uint32_t expected[4] = {
+        over,                                   // Replace
+        Color{ 180, 150, 240 }.pack(),          // Add
+        PixelKernels::Lerp(under, over, 128),   // Alpha at 0.5
+        Color{ 100, 100, 200 }.pack()           // Max
+    };
+    BlendMode modes[4] = { BlendMode::Replace, BlendMode::Add, BlendMode::Alpha, BlendMode::Max };
+    for (int m = 0; m < 4; m++)
+    {
+        buffer.SetColor(Color::from(under));
+        compositor.AddLayer(new SpanLayer(over), modes[m], modes[m] == BlendMode::Alpha ? 0.5f : 1);
+        buffer.Write();
+        const uint32_t* front = (const uint32_t*)buffer.GetDriver().getBuffer();
+        for (int strip = 0; strip < buffer.NumStrips(); strip++)
+        {
+            for (int led = 0; led < buffer.NumLedsPerStrip(); led++)
+            {
+                bool drawn = led == 3 && strip >= 2 && strip < 6;
+                if (front[led * buffer.NumStrips() + strip] != (drawn ? expected[m] : under)) errors++;
+                // what the animation drew is back in the buffer.
+                if (buffer.GetPixel(strip, led).pack() != under) errors++;
+            }
+        }
+        compositor.Clear();
+    }
+
+    // layers stack in order, the row is saved once.
+    buffer.SetColor(Color{ 0, 0, 0 });
+    compositor.AddLayer(new SpanLayer(Color{ 10, 10, 10 }.pack()), BlendMode::Add);
+    compositor.AddLayer(new SpanLayer(Color{ 20, 0, 5 }.pack()), BlendMode::Add);
+    compositor.Compose();
+    if (compositor.GetSavedRows() != 1 || buffer.GetPixel(2, 3).pack() != Color{ 30, 10, 15 }.pack()) errors++;
+    compositor.Restore();
+    if (buffer.GetPixel(2, 3).pack() != 0) errors++;
+    delete compositor.RemoveLayer(0);
+    if (compositor.NumLayers() != 1) errors++;
+    compositor.Clear();
+    buffer.SetOverlay(nullptr);
+
+    if (errors > 0)
+    {
+        std::cout << "### found " << errors << " compositor errors\n";
+    }
+    else
+    {
+        std::cout << "done\n";
+    }
+}
+
 void TestWaterDrop()
 {
     PixelBuffer& buffer = controller.GetBuffer();
@@ -261,7 +1144,7 @@ void TestWaterDrop()
 
     WaterDropAnimation waterDrop(buffer, 2, 16, 20);
     std::cout << "water drop ...";
-    while (!waterDrop.Run())
+    while (!waterDrop.Run(frame_seconds))
     {
         std::this_thread::sleep_for(std::chrono::milliseconds(animation_delay));
     }
@@ -273,7 +1156,7 @@ void TestRainbowAnimation()
     PixelBuffer& buffer = controller.GetBuffer();
     RainbowAnimation rainbow(buffer, 150, 2);
     std::cout << "rainbow...";
-    while (!rainbow.Run())
+    while (!rainbow.Run(frame_seconds))
     {
         std::this_thread::sleep_for(std::chrono::milliseconds(animation_delay));
     }
@@ -286,7 +1169,7 @@ void TestNeuralDropAnimation()
     NeuralDropAnimation neural(buffer, 1);
 
     std::cout << "neural...";
-    while (!neural.Run())
+    while (!neural.Run(frame_seconds))
     {
         std::this_thread::sleep_for(std::chrono::milliseconds(animation_delay));
     }
@@ -300,7 +1183,7 @@ void TestTwinkleAnimation()
 
     std::cout << "twinkle...";
     int timeout = 60;
-    while (!twinkle.Run() && timeout-- > 0)
+    while (!twinkle.Run(frame_seconds) && timeout-- > 0)
     {
         std::this_thread::sleep_for(std::chrono::milliseconds(animation_delay));
     }
@@ -315,7 +1198,7 @@ void TestBreatheAnimation()
     BreatheAnimation breathe(buffer, 5, 7, 0.4f);
 
     std::cout << "breathe...";
-    while (!breathe.Run())
+    while (!breathe.Run(frame_seconds))
     {
         std::this_thread::sleep_for(std::chrono::milliseconds(animation_delay));
     }
@@ -341,7 +1224,7 @@ void TestMovingGradient()
     cmd.type = CommandType::MovingGradient;
     cmd.command = "MovingGradient";
     cmd.f1 = 1;
-    cmd.seconds = 1;
+    cmd.seconds = 60; // LEDs per second
     cmd.size = 100;
     // animate red on leading edge leaving yellow behind.
     cmd.addColor(Color{ 80, 0, 0 });
@@ -364,7 +1247,7 @@ void TestMovingGradient()
     cmd.type = CommandType::MovingGradient;
     cmd.command = "MovingGradient";
     cmd.f1 = -1;
-    cmd.seconds = 5;
+    cmd.seconds = 300;
     cmd.size = 100;
     // fading the yellow into a blue background
     cmd.clearColors();
@@ -433,6 +1316,617 @@ void TestControlledCrossFade()
 }
 
 
+void TestPixelKernels()
+{
+    std::cout << "TestPixelKernels...";
+    int errors = 0;
+
+    // every kernel against the same math done one channel at a time.
+    uint32_t seed = 12345;
+    for (int i = 0; i < 100000; i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        uint32_t a = seed >> 8;
+        seed = seed * 1664525 + 1013904223;
+        uint32_t b = seed >> 8;
+        uint32_t t = (seed & 0xff) + (i & 1); // 0-256
+        uint32_t lerp = PixelKernels::Lerp(a, b, t);
+        uint32_t scale = PixelKernels::Scale(a, t);
+        uint32_t add = PixelKernels::AddSaturate(a, b);
+        uint32_t average = PixelKernels::Average(a, b);
+        uint32_t sub = PixelKernels::SubSaturate(a, b);
+        uint32_t max = PixelKernels::Max(a, b);
+        for (int shift = 0; shift < 24; shift += 8)
+        {
+            uint32_t x = (a >> shift) & 0xff;
+            uint32_t y = (b >> shift) & 0xff;
+            if (((lerp >> shift) & 0xff) != (x * (256 - t) + y * t) / 256) errors++;
+            if (((scale >> shift) & 0xff) != x * t / 256) errors++;
+            if (((add >> shift) & 0xff) != (x + y > 255 ? 255 : x + y)) errors++;
+            if (((average >> shift) & 0xff) != (x + y) / 2) errors++;
+            if (((sub >> shift) & 0xff) != (x > y ? x - y : 0)) errors++;
+            if (((max >> shift) & 0xff) != (x > y ? x : y)) errors++;
+        }
+        if ((lerp | scale | add | average | sub | max) >> 24) errors++;
+    }
+
+    // the ends of a fade are the colors themselves
+    uint32_t from[3] = { Color{ 10,20,30 }.pack(), Color{ 255,255,255 }.pack(), 0 };
+    uint32_t to[3] = { Color{ 200,100,0 }.pack(), 0, Color{ 255,255,255 }.pack() };
+    uint32_t span[3];
+    PixelKernels::LerpSpan(span, from, to, 3, PixelKernels::Fraction(0));
+    if (memcmp(span, from, sizeof(span)) != 0) errors++;
+    PixelKernels::LerpSpan(span, from, to, 3, PixelKernels::Fraction(1.5f));
+    if (memcmp(span, to, sizeof(span)) != 0) errors++;
+    PixelKernels::AddSpan(span, span, 3, PixelKernels::Gray(100));
+    if (span[0] != Color{ 255,200,100 }.pack() || span[1] != Color{ 100,100,100 }.pack() || span[2] != 0xffffff) errors++;
+
+    if (errors > 0)
+    {
+        std::cout << "### found " << errors << " pixel kernel errors\n";
+    }
+    else
+    {
+        std::cout << "done\n";
+    }
+}
+
+void TestEnvelope()
+{
+    std::cout << "TestEnvelope...";
+    int errors = 0;
+
+    // the tables follow the functions they replace closely enough for a brightness.
+    Envelope breathe(EnvelopeShape::Breath, 4000, 0.25f);
+    Envelope sine(EnvelopeShape::Sine, 6000);
+    Envelope triangle(EnvelopeShape::Triangle, 1000);
+    for (float ms = 0; ms < 20000; ms += 7.3f)
+    {
+        if (fabs(breathe.Evaluate(ms) - exp(cos(ms / 2000 * 3.1415926))) > 0.002) errors++;
+        if (fabs(sine.Evaluate(ms) - sin(ms / 3000 * 3.1415926)) > 0.001) errors++;
+        float p = fmodf(ms, 1000) / 1000;
+        if (fabs(triangle.Evaluate(ms) - (p < 0.5f ? 2 * p : 2 - 2 * p)) > 0.001) errors++;
+    }
+
+    // custom curves wrap around
+    const float steps[4] = { 0, 1, 0, -1 };
+    Envelope custom(steps, 4, 400);
+    if (fabs(custom.Evaluate(100) - 1) > 0.001 || fabs(custom.Evaluate(350) + 0.5f) > 0.001 || fabs(custom.Evaluate(400)) > 0.001) errors++;
+
+    if (Envelope::Apply(Color{ 200, 100, 50 }.pack(), 0.5f) != Color{ 100, 50, 25 }.pack()) errors++;
+
+    if (errors > 0)
+    {
+        std::cout << "### found " << errors << " envelope errors\n";
+    }
+    else
+    {
+        std::cout << "done\n";
+    }
+}
+
+void TestLookupTables()
+{
+    std::cout << "TestLookupTables...";
+    int errors = 0;
+
+    // the fixed point tables against the libm functions they replace.
+    for (uint32_t phase = 0; phase < 65536 * 2; phase += 37)
+    {
+        double angle = phase * 2 * 3.14159265358979 / 65536;
+        if (fabs(Lookup::Sin(phase) / 32767.0 - sin(angle)) > 0.0002) errors++;
+        if (fabs(Lookup::Cos(phase) / 32767.0 - cos(angle)) > 0.0002) errors++;
+        if (fabs(Lookup::Breath(phase) / 4096.0 - exp(sin(angle))) > 0.001) errors++;
+    }
+    for (uint32_t steps = 1; steps < 100; steps++)
+    {
+        for (uint32_t i = 0; i <= steps; i++)
+        {
+            double s = sin(i * 3.14159265358979 / steps);
+            if (fabs(Lookup::Bubble(i, steps) / 256.0 - s * s) > 0.005) errors++;
+        }
+    }
+    if (Lookup::Phase(0.25f) != 16384) errors++;
+
+    // the hue wheel matches HlsColor to the rounding of a channel
+    for (int hue = 0; hue < 256; hue++)
+    {
+        Color expected = HlsColor(hue * 360.0f / 256, 0.5f, 1).GetRGB();
+        Color c = HlsColor::FromHue((uint8_t)hue);
+        if (abs(c.r - expected.r) > 1 || abs(c.g - expected.g) > 1 || abs(c.b - expected.b) > 1) errors++;
+    }
+
+    if (errors > 0)
+    {
+        std::cout << "### found " << errors << " lookup table errors\n";
+    }
+    else
+    {
+        std::cout << "done\n";
+    }
+}
+
+void TestFrameArena()
+{
+    std::cout << "TestFrameArena...";
+    int errors = 0;
+    int before = gFrameArena.GetInUse();
+
+    {
+        FrameSlot a;
+        FrameSlot b;
+        if (a.IsValid() || a.Get() != nullptr) errors++;
+        uint32_t* pixels = a.Acquire();
+        if (pixels == nullptr || a.Acquire() != pixels || b.Acquire() == pixels) errors++;
+        if (gFrameArena.GetInUse() != before + 2 || gTeensyStatus.frameSlots != (uint32_t)(before + 2)) errors++;
+        b.Release();
+        if (b.IsValid() || gFrameArena.GetInUse() != before + 1) errors++;
+    }
+    // the slots went back when they went out of scope
+    if (gFrameArena.GetInUse() != before || gFrameArena.GetHighWater() < before + 2) errors++;
+
+    // every slot can be used at once, and they don't overlap
+    {
+        FrameSlot slots[FrameArena::Slots];
+        int acquired = 0;
+        for (int i = before; i < FrameArena::Slots; i++)
+        {
+            uint32_t* pixels = slots[i].Acquire();
+            if (pixels != nullptr)
+            {
+                ::memset(pixels, i, FrameArena::Pixels * sizeof(uint32_t));
+                acquired++;
+            }
+        }
+        if (acquired != FrameArena::Slots - before || gTeensyStatus.frameSlotsHighWater != (uint32_t)FrameArena::Slots) errors++;
+        for (int i = before; i < FrameArena::Slots; i++)
+        {
+            uint32_t* pixels = slots[i].Get();
+            if (pixels[0] != i * 0x01010101u || pixels[FrameArena::Pixels - 1] != i * 0x01010101u) errors++;
+        }
+    }
+
+    // the animations give their snapshots back
+    {
+        BreatheAnimation breathe(controller.GetBuffer(), 1, 1, 0);
+        if (gFrameArena.GetInUse() != before + 1) errors++;
+    }
+    if (gFrameArena.GetInUse() != before) errors++;
+
+    if (errors > 0)
+    {
+        std::cout << "### found " << errors << " frame arena errors\n";
+    }
+    else
+    {
+        std::cout << "done\n";
+    }
+}
+
+void TestEffectVM()
+{
+    std::cout << "TestEffectVM...";
+    int errors = 0;
+    typedef EffectOp Op;
+    auto B = [](Op op) { return (uint8_t)op; };
+
+    // per row: red is the LED, blue is 200.
+    uint8_t rows[] = { B(Op::Led), B(Op::Push8), 0, B(Op::Push16), 200, 0, B(Op::Rgb), B(Op::End) };
+    // per pixel: red on strips 0 and 1, a parameter everywhere else.
+    uint8_t pixels[] = { B(Op::Strip), B(Op::Push8), 2, B(Op::Less), B(Op::Jz), 6,
+        B(Op::Push32), 0x00, 0xff, 0x00, 0x00, B(Op::End),
+        B(Op::Param), 0, B(Op::End) };
+    // sin of a quarter period is 256, clamped to white.
+    uint8_t sine[] = { B(Op::Push16), 0x00, 0x40, B(Op::Sin), B(Op::Dup), B(Op::Dup), B(Op::Rgb), B(Op::End) };
+
+    EffectProgram program;
+    if (!program.Load(rows, sizeof(rows), false)) errors++;
+    program.Begin(numStrips, numLeds, 0);
+    if (program.Evaluate(0, 100) != Color{ 100, 0, 200 }.pack()) errors++;
+    if (program.Evaluate(0, 300) != Color{ 255, 0, 200 }.pack()) errors++;
+    if (!program.Load(sine, sizeof(sine), false) || program.Evaluate(0, 0) != 0xFFFFFF) errors++;
+
+    // programs that could run off the stack or the code are rejected.
+    uint8_t underflow[] = { B(Op::Add), B(Op::End) };
+    uint8_t noEnd[] = { B(Op::Push8), 1 };
+    uint8_t leftover[] = { B(Op::Push8), 1, B(Op::Dup), B(Op::End) };
+    uint8_t truncated[] = { B(Op::Push32), 1, 2 };
+    uint8_t unknown[] = { 0xEE, B(Op::End) };
+    uint8_t intoImmediate[] = { B(Op::Push8), 0, B(Op::Jz), 1, B(Op::Push16), 1, 0, B(Op::End) };
+    uint8_t uneven[] = { B(Op::Push8), 0, B(Op::Push8), 1, B(Op::Jz), 2, B(Op::Push8), 2, B(Op::End) };
+    uint8_t badRegister[] = { B(Op::Load), 8, B(Op::End) };
+    uint8_t overflow[40];
+    for (int i = 0; i < 34; i += 2)
+    {
+        overflow[i] = B(Op::Push8);
+        overflow[i + 1] = (uint8_t)i;
+    }
+    overflow[34] = B(Op::End);
+    struct { uint8_t* code; uint32_t size; } bad[] = {
+        { underflow, sizeof(underflow) }, { noEnd, sizeof(noEnd) }, { leftover, sizeof(leftover) },
+        { truncated, sizeof(truncated) }, { unknown, sizeof(unknown) }, { intoImmediate, sizeof(intoImmediate) },
+        { uneven, sizeof(uneven) }, { badRegister, sizeof(badRegister) }, { overflow, 35 }
+    };
+    for (auto& b : bad)
+    {
+        if (program.Load(b.code, b.size, false) || program.IsLoaded() || program.GetError() == nullptr) errors++;
+    }
+
+    // the Effect command runs the program with its parameters every frame.
+    uint8_t payload[64];
+    float seconds = 0;
+    uint32_t flags = 1;
+    uint32_t numParams = 1;
+    uint32_t param = Color{ 0, 0, 90 }.pack();
+    ::memcpy(payload, &seconds, 4);
+    ::memcpy(payload + 4, &flags, 4);
+    ::memcpy(payload + 8, &numParams, 4);
+    ::memcpy(payload + 12, &param, 4);
+    ::memcpy(payload + 16, pixels, sizeof(pixels));
+    Command& cmd = controller.GetCommand();
+    cmd.reset();
+    if (!cmd.parseCommand("Effect", payload, 16 + sizeof(pixels))) errors++;
+    controller.StartCommand();
+    controller.RunAnimation();
+    PixelBuffer& buffer = controller.GetBuffer();
+    for (int strip = 0; strip < numStrips; strip++)
+    {
+        uint32_t expected = strip < 2 ? Color{ 255, 0, 0 }.pack() : param;
+        if (buffer.GetPixel(strip, 10).pack() != expected || buffer.GetPixel(strip, numLeds - 1).pack() != expected) errors++;
+    }
+    cmd.reset();
+    payload[16] = B(Op::Add);
+    if (cmd.parseCommand("Effect", payload, 16 + sizeof(pixels)) || !(cmd.error == "Effect: stack underflow")) errors++;
+    controller.SetColor(Color{ 0, 0, 0 });
+
+    if (errors > 0)
+    {
+        std::cout << "### found " << errors << " effect errors\n";
+    }
+    else
+    {
+        std::cout << "done\n";
+    }
+}
+
+// Append a cue that sets every pixel to a color to the bytes of a Timeline command.
+static void AddColorCue(std::vector<uint8_t>& bytes, uint32_t at, Color color)
+{
+    int32_t setColor[3] = { -1, -1, (int32_t)color.pack() }; // strip, index, color
+    uint32_t length = sizeof(setColor);
+    bytes.insert(bytes.end(), (uint8_t*)&at, (uint8_t*)&at + 4);
+    const char* name = "SetColor";
+    bytes.insert(bytes.end(), name, name + strlen(name) + 1);
+    bytes.insert(bytes.end(), (uint8_t*)&length, (uint8_t*)&length + 4);
+    bytes.insert(bytes.end(), (uint8_t*)setColor, (uint8_t*)setColor + length);
+}
+
+static std::vector<uint8_t> TimelineHeader(uint32_t flags, uint32_t period)
+{
+    std::vector<uint8_t> bytes((uint8_t*)&flags, (uint8_t*)&flags + 4);
+    bytes.insert(bytes.end(), (uint8_t*)&period, (uint8_t*)&period + 4);
+    return bytes;
+}
+
+void TestTimeline()
+{
+    std::cout << "TestTimeline...";
+    int errors = 0;
+    PixelBuffer& buffer = controller.GetBuffer();
+    Timeline& timeline = controller.GetTimeline();
+    Command& cmd = controller.GetCommand();
+    uint32_t red = Color{ 255, 0, 0 }.pack();
+    uint32_t blue = Color{ 0, 0, 255 }.pack();
+
+    // red now and blue 50 ms later, played by the controller.
+    std::vector<uint8_t> bytes = TimelineHeader(0, 0);
+    AddColorCue(bytes, 0, Color::from(red));
+    AddColorCue(bytes, 50000, Color::from(blue));
+    cmd.reset();
+    if (!cmd.parseCommand("Timeline", bytes.data(), (uint32_t)bytes.size())) errors++;
+    controller.StartCommand();
+    Timer timer;
+    timer.start();
+    controller.RunTimeline();
+    if (buffer.GetPixel(3, 7).pack() != red || !timeline.IsPlaying()) errors++;
+    while (timeline.IsPlaying() && timer.seconds() < 1)
+    {
+        controller.RunTimeline();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (buffer.GetPixel(3, 7).pack() != blue || timer.milliseconds() < 50 || timeline.IsPlaying()) errors++;
+
+    // a loop every 20 ms keeps going until it is stopped.
+    bytes = TimelineHeader(1, 20000);
+    AddColorCue(bytes, 0, Color::from(red));
+    AddColorCue(bytes, 10000, Color::from(blue));
+    cmd.reset();
+    cmd.parseCommand("Timeline", bytes.data(), (uint32_t)bytes.size());
+    controller.StartCommand();
+    timer.start();
+    while (timer.milliseconds() < 100)
+    {
+        controller.RunTimeline();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (!timeline.IsPlaying() || timeline.GetLoops() < 2) errors++;
+    cmd.reset();
+    cmd.parseCommand("StopTimeline", nullptr, 0);
+    controller.StartCommand();
+    if (timeline.IsPlaying() || gTeensyStatus.frameSlots != (uint32_t)gFrameArena.GetInUse()) errors++;
+
+    // cues out of order, a timeline in a timeline and a cut off cue are rejected.
+    bytes = TimelineHeader(0, 0);
+    AddColorCue(bytes, 50000, Color::from(red));
+    AddColorCue(bytes, 0, Color::from(blue));
+    if (timeline.Load(bytes.data(), (uint32_t)bytes.size()) == nullptr || timeline.IsPlaying()) errors++;
+    std::vector<uint8_t> nested = TimelineHeader(0, 0);
+    uint32_t zero = 0;
+    nested.insert(nested.end(), (uint8_t*)&zero, (uint8_t*)&zero + 4);
+    const char* name = "Timeline";
+    nested.insert(nested.end(), name, name + strlen(name) + 1);
+    nested.insert(nested.end(), (uint8_t*)&zero, (uint8_t*)&zero + 4);
+    if (timeline.Load(nested.data(), (uint32_t)nested.size()) == nullptr) errors++;
+    bytes = TimelineHeader(0, 0);
+    AddColorCue(bytes, 0, Color::from(red));
+    if (timeline.Load(bytes.data(), (uint32_t)bytes.size() - 1) == nullptr || timeline.IsPlaying()) errors++;
+
+    // the cue payloads are packed, so a cue's values can be at any offset.
+    std::vector<uint8_t> packed(3, 0);
+    float fadeSeconds = 0.25f;
+    packed.insert(packed.end(), (uint8_t*)&fadeSeconds, (uint8_t*)&fadeSeconds + 4);
+    packed.insert(packed.end(), (uint8_t*)&blue, (uint8_t*)&blue + 4);
+    Command unaligned;
+    if (!unaligned.parseCommand("CrossFade", &packed[3], 8) || unaligned.seconds != fadeSeconds ||
+        unaligned.colors.size() != 1 || unaligned.colors[0].pack() != blue) errors++;
+    controller.SetColor(Color{ 0, 0, 0 });
+
+    if (errors > 0)
+    {
+        std::cout << "### found " << errors << " timeline errors\n";
+    }
+    else
+    {
+        std::cout << "done\n";
+    }
+}
+
+void TestIndexedBuffer()
+{
+    std::cout << "TestIndexedBuffer...";
+    int errors = 0;
+    PixelBuffer& buffer = controller.GetBuffer();
+    Palette& palette = controller.GetPalette();
+    Command& cmd = controller.GetCommand();
+    uint32_t numStrips = buffer.NumStrips();
+    uint32_t numLeds = buffer.NumLedsPerStrip();
+    uint32_t red = Color{ 255, 0, 0 }.pack();
+    uint32_t green = Color{ 0, 255, 0 }.pack();
+    uint32_t blue = Color{ 0, 0, 255 }.pack();
+
+    // a frame of indices 0-2 down the strips with its own palette.
+    float seconds = 0;
+    uint32_t colors[3] = { 0, red, blue };
+    uint32_t paletteSize = 3;
+    std::vector<uint8_t> bytes((uint8_t*)&numStrips, (uint8_t*)&numStrips + 4);
+    bytes.insert(bytes.end(), (uint8_t*)&numLeds, (uint8_t*)&numLeds + 4);
+    bytes.insert(bytes.end(), (uint8_t*)&seconds, (uint8_t*)&seconds + 4);
+    bytes.insert(bytes.end(), (uint8_t*)&paletteSize, (uint8_t*)&paletteSize + 4);
+    bytes.insert(bytes.end(), (uint8_t*)colors, (uint8_t*)colors + sizeof(colors));
+    for (uint32_t led = 0; led < numLeds; led++)
+    {
+        for (uint32_t strip = 0; strip < numStrips; strip++)
+        {
+            bytes.push_back((uint8_t)(led % 3));
+        }
+    }
+    cmd.reset();
+    if (!cmd.parseCommand("IndexedBuffer", bytes.data(), (uint32_t)bytes.size())) errors++;
+    controller.StartCommand();
+    controller.RunAnimation();
+    if (buffer.GetPixel(5, 0).pack() != 0 || buffer.GetPixel(5, 1).pack() != red || buffer.GetPixel(5, 2).pack() != blue) errors++;
+
+    // the Palette command recolors the frame that is showing.
+    float cycle = 0;
+    int32_t palette_args[3] = { 0, 0, 1 }; // cycle first, cycle count, first entry
+    std::vector<uint8_t> update((uint8_t*)&seconds, (uint8_t*)&seconds + 4);
+    update.insert(update.end(), (uint8_t*)&cycle, (uint8_t*)&cycle + 4);
+    update.insert(update.end(), (uint8_t*)palette_args, (uint8_t*)palette_args + sizeof(palette_args));
+    update.insert(update.end(), (uint8_t*)&green, (uint8_t*)&green + 4);
+    cmd.reset();
+    if (!cmd.parseCommand("Palette", update.data(), (uint32_t)update.size())) errors++;
+    controller.StartCommand();
+    controller.RunAnimation();
+    if (buffer.GetPixel(0, 4).pack() != green || buffer.GetPixel(0, 5).pack() != blue) errors++;
+
+    // cycling the first 3 entries at 64 per second moves them one entry every 1/64 s.
+    palette.SetCycle(0, 3, 64);
+    if (!palette.Update(1 / 64.0f) || palette.Lookup(0) != green || palette.Lookup(1) != blue || palette.Lookup(2) != 0) errors++;
+    palette.SetCycle(0, 3, -64);
+    palette.Update(1 / 64.0f);
+    if (palette.Lookup(0) != blue || palette.Lookup(1) != 0) errors++;
+    palette.SetCycle(0, 0, 0);
+    if (!palette.Update(0) || palette.Update(0) || palette.Lookup(1) != green) errors++;
+
+    // a fade goes half way in half the time.
+    palette.Set(2, &red, 1, 1);
+    palette.Update(0.5f);
+    if (palette.Lookup(2) != PixelKernels::Lerp(blue, red, 128) || !palette.IsFading()) errors++;
+    palette.Update(0.5f);
+    if (palette.Lookup(2) != red || palette.IsFading()) errors++;
+
+    // a palette that doesn't fit is rejected.
+    paletteSize = 1000;
+    ::memcpy(&bytes[12], &paletteSize, 4);
+    cmd.reset();
+    if (cmd.parseCommand("IndexedBuffer", bytes.data(), (uint32_t)bytes.size()) || !(cmd.error == "IndexedBuffer: bad palette")) errors++;
+    controller.SetColor(Color{ 0, 0, 0 });
+
+    if (errors > 0)
+    {
+        std::cout << "### found " << errors << " indexed buffer errors\n";
+    }
+    else
+    {
+        std::cout << "done\n";
+    }
+}
+
+void TestFrameHandOff()
+{
+    std::cout << "TestFrameHandOff...";
+    int errors = 0;
+    PixelBuffer& buffer = controller.GetBuffer();
+    uint32_t numStrips = buffer.NumStrips();
+    uint32_t numLeds = buffer.NumLedsPerStrip();
+    uint32_t numPixels = numStrips * numLeds;
+
+    // a FullBuffer the receive command parsed becomes the display buffer without a copy.
+    float seconds = 0;
+    std::vector<uint8_t> bytes((uint8_t*)&numStrips, (uint8_t*)&numStrips + 4);
+    bytes.insert(bytes.end(), (uint8_t*)&numLeds, (uint8_t*)&numLeds + 4);
+    bytes.insert(bytes.end(), (uint8_t*)&seconds, (uint8_t*)&seconds + 4);
+    for (uint32_t i = 0; i < numPixels; i++)
+    {
+        uint32_t pixel = (i * 2654435761u) & 0xffffff;
+        bytes.insert(bytes.end(), (uint8_t*)&pixel, (uint8_t*)&pixel + 4);
+    }
+    Command cmd;
+    if (!cmd.parseCommand("FullBuffer", bytes.data(), (uint32_t)bytes.size())) errors++;
+    uint32_t* parsed = cmd.pixelBuffer;
+    int before = gFrameArena.GetInUse();
+    controller.StartCommand(static_cast<Command&&>(cmd));
+    if (cmd.pixelBuffer != nullptr || cmd.pixelSlot.IsValid() || controller.GetCommand().pixelSlot.IsValid()) errors++;
+    if (!controller.RunAnimation()) errors++;
+    uint32_t* pixels = buffer.GetPixelBuffer();
+    if (pixels != parsed) errors++;
+    for (uint32_t i = 0; i < numPixels; i++)
+    {
+        if (pixels[i] != ((i * 2654435761u) & 0xffffff)) errors++;
+    }
+    if (gFrameArena.GetInUse() > before) errors++;
+
+    // a cross fade target is swapped in when the fade is stopped, once.
+    {
+        FrameSlot frame;
+        uint32_t* target = frame.Acquire();
+        ::memset(target, 0x10, FrameArena::Pixels * sizeof(uint32_t));
+        CrossFadeToAnimation fade(buffer, static_cast<FrameSlot&&>(frame), 1);
+        if (frame.IsValid()) errors++;
+        fade.Run(0);
+        fade.Stop();
+        fade.Stop();
+        if (buffer.GetPixelBuffer() != target || buffer.GetPixel(3, 7).pack() != 0x101010) errors++;
+    }
+    controller.SetColor(Color{ 0, 0, 0 });
+
+    if (errors > 0)
+    {
+        std::cout << "### found " << errors << " frame hand off errors\n";
+    }
+    else
+    {
+        std::cout << "done\n";
+    }
+}
+
+void TestAnimationClock()
+{
+    std::cout << "TestAnimationClock...";
+    int errors = 0;
+
+    // two seconds at 60 steps per second is 120 steps whatever the frame rate, a slow frame
+    // skips the steps it missed.
+    float rates[] = { 144, 60, 30, 24, 7 };
+    for (float fps : rates)
+    {
+        StepClock clock(60);
+        int steps = 0;
+        int maxSteps = 0;
+        int frames = (int)(2 * fps + 0.5f);
+        for (int i = 0; i < frames; i++)
+        {
+            int n = clock.Advance(1 / fps);
+            steps += n;
+            if (n > maxSteps) maxSteps = n;
+        }
+        if (steps < 119 || steps > 120) errors++;
+        if (maxSteps < 1 || maxSteps > (int)(60 / fps) + 1) errors++;
+    }
+
+    // the rainbow scrolls the same distance at 32 fps as at 64 fps.
+    PixelBuffer fast;
+    fast.Initialize();
+    PixelBuffer slow;
+    slow.Initialize();
+    RainbowAnimation fastRainbow(fast, 150, 0);
+    RainbowAnimation slowRainbow(slow, 150, 0);
+    for (int i = 0; i < 64; i++)
+    {
+        fastRainbow.Run(1 / 64.0f);
+        if (i % 2 == 0)
+        {
+            slowRainbow.Run(1 / 32.0f);
+        }
+    }
+    fastRainbow.Run(0);
+    slowRainbow.Run(0);
+    if (::memcmp(fast.GetPixelBuffer(), slow.GetPixelBuffer(), fast.GetBufferSize()) != 0) errors++;
+
+    // the first tick is 0 and a stall is capped.
+    FrameClock frameClock;
+    if (frameClock.Tick() != 0) errors++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    if (frameClock.Tick() != FrameClock::MaxElapsed) errors++;
+
+    if (errors > 0)
+    {
+        std::cout << "### found " << errors << " animation clock errors\n";
+    }
+    else
+    {
+        std::cout << "done\n";
+    }
+}
+
+void TestFrameScheduler()
+{
+    std::cout << "TestFrameScheduler...";
+    int errors = 0;
+    FrameScheduler scheduler;
+
+    // free running, every pass of the loop is a frame
+    if (!scheduler.FrameDue() || scheduler.GetFps() != 0) errors++;
+
+    scheduler.SetFps(50);
+    if (scheduler.GetFps() != 50) errors++;
+    scheduler.StartFrame();
+    if (scheduler.FrameDue()) errors++;
+    if (scheduler.GetSlack() == 0 || scheduler.GetSlack() > 20000) errors++;
+
+    // a little late is not an overrun
+    std::this_thread::sleep_for(std::chrono::milliseconds(25));
+    if (!scheduler.FrameDue()) errors++;
+    scheduler.StartFrame();
+    if (scheduler.GetOverruns() != 0) errors++;
+
+    // more than a whole frame late drops the missed frames
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    scheduler.StartFrame();
+    if (scheduler.GetOverruns() != 1) errors++;
+    if (scheduler.FrameDue()) errors++;
+    if (scheduler.GetFrames() != 3) errors++;
+
+    if (errors > 0)
+    {
+        std::cout << "### found " << errors << " frame scheduler errors\n";
+    }
+    else
+    {
+        std::cout << "done\n";
+    }
+}
+
 void TestHlsColors()
 {
     int w = 100;
@@ -464,10 +1958,31 @@ void TestThread()
 
     // Low level buffer tests
     TestGradientFade();
+    TestGradientStrips();
     TestHlsColors();
     TestCRC();
+    TestTranspose();
+    TestWaveform();
+    TestDoubleBuffer();
+    TestPixelIteration();
+    TestPartialRefresh();
+    TestInterruptWindows();
+    TestColorMap();
+    TestFrameScheduler();
+    TestAnimationClock();
+    TestEffectVM();
+    TestTimeline();
+    TestIndexedBuffer();
+    TestFrameHandOff();
+    TestPixelKernels();
+    TestEnvelope();
+    TestLookupTables();
+    TestCompositor();
+    TestFrameArena();
     TestStrings();
     TestVectors();
+    TestAllocations();
+    TestReadChunks();
     TestCommands("CrossFade", false, false, false);
     TestCommands("CrossxFade", false, false, false);
     TestCommands("CrossFade", true, false, false);
@@ -503,12 +2018,13 @@ void FirmwareTest()
 				else
 				{
 					// new command received!
-					controller.StartCommand(cmd);
+					controller.StartCommand(static_cast<Command&&>(cmd));
 				}
 				DebugPrint("##COMPLETE##\n");
 			}
 		}
 
+		controller.RunTimeline();
 		if (controller.HasAnimation())
 		{
 			if (controller.RunAnimation()) {